@@ -1,10 +1,8 @@
 
 #include "mempool.h"
 #include "queue.h"
-
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include "mpmalloc_harden.h"
+#include "mpmalloc_pageheap.h"
 
 #include <pthread.h>
 #include <stdlib.h>
@@ -14,14 +12,39 @@
 /* 内存池适配*/
 #define MEMPOOL_MAGIC           0xb5
 
+#define MEMPOOL_SLICE_F_CONSTRUCTED    0x01 /* 元素已经调用过构造函数 */
+#define MEMPOOL_SLICE_F_USED           0x02 /* 调试级别：元素已被取出，用于检测重复释放 */
+#define MEMPOOL_SLICE_F_DIRTY          0x04 /* 数据区内容不确定为0 */
+
+/*
+ * 着色：同一size的内存池起始地址都按页对齐，各池第N个单元会落到相同的cache set；
+ * 每新建一个池，数据区起始位置按cache line轮转偏移，不同size的起始颜色也错开。
+ */
+#define MEMPOOL_CACHE_LINE      64
+#define MEMPOOL_COLOR_NUM       16
+#define MEMPOOL_COLOR_SLOTS     64
+
+#define MEMPOOL_CACHE_ALIGNED   __attribute__((aligned(MEMPOOL_CACHE_LINE)))
+
+/* 每个size类型的颜色计数器，按size散列 */
+static unsigned int g_mempool_color[MEMPOOL_COLOR_SLOTS];
+
+/* 池头部：只读字段、锁和计数各自独立cache line，和单元数据区分开 */
 struct mempool_imp{
     int mempool_id;
-    QUEUE q_idle;
-	QUEUE q_used;
-    size_t used_cnt;
+    unsigned int color;
     size_t  count;
     size_t ele_size;
-    pthread_mutex_t lck;
+    size_t slice_size;      /* 单元步长，按对齐要求取整 */
+    size_t data_offset;     /* 第一个单元头相对内存池起始地址的偏移 */
+    size_t memsize;
+    mempool_ele_fn ctor;
+    mempool_ele_fn dtor;
+    int flags;
+    pthread_mutex_t lck MEMPOOL_CACHE_ALIGNED;
+    QUEUE q_idle MEMPOOL_CACHE_ALIGNED;
+	QUEUE q_used;
+    size_t used_cnt;
 };
 
 /* 内存单元编解码*/
@@ -32,26 +55,82 @@ PACKED_MEMORY(struct mempool_slice{
     QUEUE               q;
     unsigned char        magic;
     unsigned char        id;
-    unsigned char        reserved[2];
+    unsigned char        flags;
+    unsigned char        reserved;
     char                data[0];     
 });
 
+#define MEMPOOL_ALIGN_UP(x, a)  (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+/* MEMPOOL_F_NO_LOCK 时不加锁 */
+static inline int mempool_lock(struct mempool_imp *mp)
+{
+    if (mp->flags & MEMPOOL_F_NO_LOCK) {
+        return 0;
+    }
+    return pthread_mutex_lock(&mp->lck);
+}
+
+static inline void mempool_unlock(struct mempool_imp *mp)
+{
+    if (!(mp->flags & MEMPOOL_F_NO_LOCK)) {
+        pthread_mutex_unlock(&mp->lck);
+    }
+}
+
+static inline struct mempool_slice *mempool_slice_at(struct mempool_imp *mp, size_t i)
+{
+    return (struct mempool_slice *)((char *)mp + mp->data_offset + i * mp->slice_size);
+}
+
 struct mempool_imp *mempool_create_imp(int id, size_t count, size_t ele_size)
+{
+    return mempool_create_ex_imp(id, count, ele_size, 1, 0, 0);
+}
+
+static unsigned int mempool_next_color(int id, size_t ele_size, size_t color_step)
+{
+    unsigned int ncolors;
+    unsigned int slot;
+
+    ncolors = (unsigned int)(MEMPOOL_COLOR_NUM * MEMPOOL_CACHE_LINE / color_step);
+    if (ncolors <= 1) {
+        return 0;
+    }
+    slot = (unsigned int)((ele_size / sizeof(void *)) % MEMPOOL_COLOR_SLOTS);
+    return (__atomic_fetch_add(&g_mempool_color[slot], 1, __ATOMIC_RELAXED) + slot + (unsigned int)id) % ncolors;
+}
+
+struct mempool_imp *mempool_create_ex_imp(int id, size_t count, size_t ele_size, size_t align, size_t head, int flags)
 {
     int rc;
-    int i;
+    size_t i;
     char *page;
+    int zeroed = 0;
     size_t memsize;
     size_t slice_size;
+    size_t data_offset;
+    size_t color_step;
+    unsigned int color = 0;
     struct mempool_imp *handle;
     struct mempool_slice *slices;
 
-    if (!count || !ele_size) {
+    if (!count || !ele_size || head >= ele_size || !align || (align & (align - 1)) || align > MEMPOOL_MAX_ALIGN) {
         return NULL;
     }
-    slice_size = (sizeof(struct mempool_slice) + ele_size);
-    memsize = sizeof(struct mempool_imp) + count * slice_size;
-    page = mmap(NULL, memsize, PROT_READ | PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    /* 保证每个元素数据区偏移head处按align对齐：步长取整，首个元素头向后偏移 */
+    slice_size = MEMPOOL_ALIGN_UP(sizeof(struct mempool_slice) + ele_size, align);
+    data_offset = MEMPOOL_ALIGN_UP(sizeof(struct mempool_imp) + sizeof(struct mempool_slice) + head, align)
+                    - sizeof(struct mempool_slice) - head;
+    /* 颜色步长取cache line和对齐要求的较大值，偏移后仍满足对齐 */
+    color_step = align > MEMPOOL_CACHE_LINE ? align : MEMPOOL_CACHE_LINE;
+    if (!(flags & MEMPOOL_F_NO_COLOR)) {
+        color = mempool_next_color(id, ele_size, color_step);
+        data_offset += color * color_step;
+    }
+    memsize = data_offset + count * slice_size;
+    /* 从进程级页堆申请，可能复用其它句柄归还的页，内容不保证清零 */
+    page = mp_pageheap_alloc_ex(memsize, &zeroed);
     if (!page) {
         return NULL;
     }
@@ -61,7 +140,12 @@ struct mempool_imp *mempool_create_imp(int id, size_t count, size_t ele_size)
 
     handle->count = count;
     handle->ele_size = ele_size;
+    handle->slice_size = slice_size;
+    handle->data_offset = data_offset;
+    handle->memsize = memsize;
     handle->mempool_id = id;
+    handle->color = color;
+    handle->flags = flags;
     handle->used_cnt = 0;
 
     rc = pthread_mutex_init(&handle->lck, NULL);
@@ -74,10 +158,13 @@ struct mempool_imp *mempool_create_imp(int id, size_t count, size_t ele_size)
 	QUEUE_INIT(&handle->q_used);
 
     for (i = 0; i < count; i++) {
-        slices = (struct mempool_slice *)(page + sizeof(struct mempool_imp) + i * slice_size);
+        slices = mempool_slice_at(handle, i);
         QUEUE_INIT(&slices->q);
         slices->id = i;
         slices->magic = MEMPOOL_MAGIC;
+        /* 新映射的页从未写过，单元第一次取出前数据区都是0 */
+        slices->flags = zeroed ? 0 : MEMPOOL_SLICE_F_DIRTY;
+        slices->reserved = 0;
         QUEUE_INSERT_TAIL(&handle->q_idle, &slices->q);
     }
 
@@ -86,7 +173,9 @@ struct mempool_imp *mempool_create_imp(int id, size_t count, size_t ele_size)
 void mempool_free_imp(struct mempool_imp *mp)
 {
     int rc;
+    size_t i;
     size_t memsize;
+    struct mempool_slice *slice;
 
     if (!mp) {
         return;
@@ -97,19 +186,33 @@ void mempool_free_imp(struct mempool_imp *mp)
         return;
     }
     
-    memsize = (sizeof(struct mempool_slice) + mp->ele_size);
-    memsize = sizeof(struct mempool_imp) + mp->count * memsize;
+    memsize = mp->memsize;
     pthread_mutex_unlock(&mp->lck);
     
     assert(mp->used_cnt == 0);
 
+    /* 只有构造过的元素需要析构，未使用过的元素不触碰 */
+    if (mp->dtor) {
+        for (i = 0; i < mp->count; i++) {
+            slice = mempool_slice_at(mp, i);
+            if (slice->flags & MEMPOOL_SLICE_F_CONSTRUCTED) {
+                mp->dtor(slice->data);
+            }
+        }
+    }
+
     pthread_mutex_destroy(&mp->lck);
 
-    munmap(mp, memsize);
+    mp_pageheap_free(mp, memsize);
     return;
 }
 
 void *mempool_get_imp(struct mempool_imp *mp)
+{
+    return mempool_get_ex_imp(mp, NULL);
+}
+
+void *mempool_get_ex_imp(struct mempool_imp *mp, int *zeroed)
 {
     int rc;
     QUEUE* iter;
@@ -119,13 +222,13 @@ void *mempool_get_imp(struct mempool_imp *mp)
         return NULL;
     }
 
-    rc = pthread_mutex_lock(&mp->lck);
+    rc = mempool_lock(mp);
     if (rc != 0) {
         return NULL;
     }
 
     if (QUEUE_EMPTY(&mp->q_idle)){
-        pthread_mutex_unlock(&mp->lck);
+        mempool_unlock(mp);
         return NULL;
     }
 
@@ -133,42 +236,86 @@ void *mempool_get_imp(struct mempool_imp *mp)
 	QUEUE_REMOVE(iter);
 	QUEUE_INIT(iter);
     QUEUE_INSERT_TAIL(&mp->q_used, iter);
-    mp->used_cnt++;
+    /* 计数在锁内修改，统计接口不加锁读取 */
+    __atomic_store_n(&mp->used_cnt, mp->used_cnt + 1, __ATOMIC_RELAXED);
     slice = QUEUE_DATA(iter, struct mempool_slice, q);
-    pthread_mutex_unlock(&mp->lck);
+    mempool_unlock(mp);
     
     if (!slice) {
         return NULL;
     }
+#if MP_HARDEN_DEBUG
+    slice->flags |= MEMPOOL_SLICE_F_USED;
+#endif
+    /* 元素第一次被取出时构造，归还时保持构造状态 */
+    if (mp->ctor && !(slice->flags & MEMPOOL_SLICE_F_CONSTRUCTED)) {
+        mp->ctor(slice->data);
+        slice->flags |= MEMPOOL_SLICE_F_CONSTRUCTED | MEMPOOL_SLICE_F_DIRTY;
+    }
+    if (zeroed) {
+        *zeroed = !(slice->flags & MEMPOOL_SLICE_F_DIRTY);
+    }
+    /* 交给调用者后内容不再可知 */
+    slice->flags |= MEMPOOL_SLICE_F_DIRTY;
     return slice->data;
 }
 
+void mempool_set_ctor_imp(struct mempool_imp *mp, mempool_ele_fn ctor, mempool_ele_fn dtor)
+{
+    if (!mp) {
+        return;
+    }
+    mp->ctor = ctor;
+    mp->dtor = dtor;
+}
+
+int mempool_owns_imp(struct mempool_imp *mp, const void *ele)
+{
+    const char *start;
+
+    if (!mp || !ele) {
+        return 0;
+    }
+    start = (const char *)mp + mp->data_offset;
+    return ((const char *)ele >= start && (const char *)ele < start + mp->count * mp->slice_size);
+}
+
 void mempool_put_imp(struct mempool_imp *mp, void *ele)
+{
+    mempool_put_ex_imp(mp, ele, 0);
+}
+
+void mempool_put_ex_imp(struct mempool_imp *mp, void *ele, int zeroed)
 {
     int rc;
     QUEUE* iter;
     struct mempool_slice *slice;
-    if (!mp || !ele) {
-        abort();
-        return;
-    }
 
+    MP_HARDEN_CHECK(mp && ele);
     slice = (struct mempool_slice*)(((char*)ele - sizeof(struct mempool_slice)));
-    if (slice->magic ^ MEMPOOL_MAGIC) {
-        abort();
-        return;
+    MP_HARDEN_CHECK(!(slice->magic ^ MEMPOOL_MAGIC));
+    if (zeroed) {
+        slice->flags &= ~MEMPOOL_SLICE_F_DIRTY;
     }
 
-    rc = pthread_mutex_lock(&mp->lck);
+    rc = mempool_lock(mp);
     if (rc != 0) {
         return;
     }
+#if MP_HARDEN_DEBUG
+    if (!(slice->flags & MEMPOOL_SLICE_F_USED)) {
+        /* 重复释放 */
+        mempool_unlock(mp);
+        abort();
+    }
+    slice->flags &= ~MEMPOOL_SLICE_F_USED;
+#endif
     
 	QUEUE_REMOVE(&slice->q);
 	QUEUE_INIT(&slice->q);
     QUEUE_INSERT_TAIL(&mp->q_idle, &slice->q);
-    mp->used_cnt--;
-    pthread_mutex_unlock(&mp->lck);
+    __atomic_store_n(&mp->used_cnt, mp->used_cnt - 1, __ATOMIC_RELAXED);
+    mempool_unlock(mp);
     return;
 }
 
@@ -178,7 +325,7 @@ size_t mempool_use_count_imp(struct mempool_imp *mp)
     if (!mp) {
         return 0;
     }
-    return mp->used_cnt;
+    return __atomic_load_n(&mp->used_cnt, __ATOMIC_RELAXED);
 }
 
 size_t mempool_avail_count_imp(struct mempool_imp *mp)
@@ -186,5 +333,29 @@ size_t mempool_avail_count_imp(struct mempool_imp *mp)
     if (!mp) {
         return 0;
     }
-    return (mp->count - mp->used_cnt);
+    return (mp->count - __atomic_load_n(&mp->used_cnt, __ATOMIC_RELAXED));
+}
+
+void mempool_populate_imp(struct mempool_imp *mp)
+{
+    if (!mp) {
+        return;
+    }
+    mp_pageheap_populate(mp, mp->memsize);
+}
+
+void mempool_foreach_used_imp(struct mempool_imp *mp, mempool_iter_fn fn, void *arg)
+{
+    QUEUE *iter;
+
+    if (!mp || !fn) {
+        return;
+    }
+    if (mempool_lock(mp) != 0) {
+        return;
+    }
+    QUEUE_FOREACH(iter, &mp->q_used) {
+        fn(QUEUE_DATA(iter, struct mempool_slice, q)->data, arg);
+    }
+    mempool_unlock(mp);
 }
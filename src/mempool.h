@@ -7,12 +7,34 @@
 #define MP_HASH_IMP_NAME            "zkc_pool"
 #define MP_HASH_POOL_CACHE_SIZE     0 /* cache数量，大小等于前端scsi task的pool cache数量? */
 
+/* 元素数据区最大对齐要求，不超过页大小 */
+#define MEMPOOL_MAX_ALIGN           4096
+
+/* 创建标记 */
+#define MEMPOOL_F_NO_COLOR          0x01 /* 不做着色偏移 */
+#define MEMPOOL_F_NO_LOCK           0x02 /* 只在一个线程里使用，取放不加锁 */
+
+typedef void (*mempool_ele_fn)(void *ele);
+typedef void (*mempool_iter_fn)(void *ele, void *arg);
+
 struct mempool_imp;
 struct mempool_imp *mempool_create_imp(int id, size_t count, size_t ele_size);
+/* 每个元素数据区偏移head处按align对齐，head通常为0；调用者在元素开头存放自己的头时传头部大小 */
+struct mempool_imp *mempool_create_ex_imp(int id, size_t count, size_t ele_size, size_t align, size_t head, int flags);
+void mempool_set_ctor_imp(struct mempool_imp *mp, mempool_ele_fn ctor, mempool_ele_fn dtor);
+int mempool_owns_imp(struct mempool_imp *mp, const void *ele);
 void mempool_free_imp(struct mempool_imp *mp);
 void *mempool_get_imp(struct mempool_imp *mp);
 void mempool_put_imp(struct mempool_imp *mp, void *ele);
+/* zeroed返回元素数据区是否全为0（从未取出过且池内存来自新映射的页，或归还时已清零） */
+void *mempool_get_ex_imp(struct mempool_imp *mp, int *zeroed);
+/* zeroed非0表示调用者已把数据区清零 */
+void mempool_put_ex_imp(struct mempool_imp *mp, void *ele, int zeroed);
 size_t mempool_use_count_imp(struct mempool_imp *mp);
 size_t mempool_avail_count_imp(struct mempool_imp *mp);
+/* 预先触发整个池的缺页，池可以正在使用 */
+void mempool_populate_imp(struct mempool_imp *mp);
+/* 遍历所有已取出的元素（数据区地址），用于泄漏报告，遍历期间持有池锁 */
+void mempool_foreach_used_imp(struct mempool_imp *mp, mempool_iter_fn fn, void *arg);
 
 #endif /* PDN_MEM */
@@ -0,0 +1,287 @@
+
+#include "mempool_bitmap.h"
+#include "mpmalloc_harden.h"
+#include "mpmalloc_pageheap.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MEMPOOL_BITMAP_CACHE_LINE       64
+#define MEMPOOL_BITMAP_WORD_BITS        64
+#define MEMPOOL_BITMAP_MIN_ALIGN        16  /* 单元按max_align_t对齐 */
+#define MEMPOOL_BITMAP_MAX_ALIGN        4096
+#define MEMPOOL_BITMAP_ALIGN_UP(x, a)   (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+struct mempool_bitmap_imp{
+    int mempool_id;
+    int flags;
+    size_t used_cnt;
+    size_t count;
+    size_t ele_size;
+    size_t stride;          /* 单元步长，按对齐要求取整 */
+    size_t memsize;
+    size_t word_num;
+    size_t hint;            /* 不小于该下标的字里才可能有空闲单元 */
+    char *data;
+    uint64_t *zero;         /* 紧跟占用位图，1表示单元数据区全为0 */
+    pthread_mutex_t lck;
+    uint64_t bitmap[0];     /* 1表示空闲 */
+};
+
+/* MEMPOOL_BITMAP_F_NO_LOCK 时不加锁 */
+static inline int mempool_bitmap_lock(struct mempool_bitmap_imp *mp)
+{
+    if (mp->flags & MEMPOOL_BITMAP_F_NO_LOCK) {
+        return 0;
+    }
+    return pthread_mutex_lock(&mp->lck);
+}
+
+static inline void mempool_bitmap_unlock(struct mempool_bitmap_imp *mp)
+{
+    if (!(mp->flags & MEMPOOL_BITMAP_F_NO_LOCK)) {
+        pthread_mutex_unlock(&mp->lck);
+    }
+}
+
+struct mempool_bitmap_imp *mempool_bitmap_create_ex_imp(int id, size_t count, size_t ele_size,
+                                                        size_t align, size_t head, int flags)
+{
+    int rc;
+    size_t i;
+    char *page;
+    int zeroed = 0;
+    size_t word_num;
+    size_t head_size;
+    size_t data_offset;
+    size_t stride;
+    size_t memsize;
+    struct mempool_bitmap_imp *handle;
+
+    if (!count || !ele_size || head >= ele_size || (align & (align - 1)) || align > MEMPOOL_BITMAP_MAX_ALIGN) {
+        return NULL;
+    }
+    if (align < MEMPOOL_BITMAP_MIN_ALIGN) {
+        align = MEMPOOL_BITMAP_MIN_ALIGN;
+    }
+    /* 位图按向量宽度补齐，尾部多出的位保持为0，扫描时不需要额外判断边界 */
+    word_num = MEMPOOL_BITMAP_ALIGN_UP(count, MEMPOOL_BITMAP_WORD_BITS * 2) / MEMPOOL_BITMAP_WORD_BITS;
+    head_size = MEMPOOL_BITMAP_ALIGN_UP(sizeof(struct mempool_bitmap_imp) + 2 * word_num * sizeof(uint64_t),
+                                        MEMPOOL_BITMAP_CACHE_LINE);
+    /* 步长取整，首个单元向后偏移，使每个单元偏移head处都按align对齐 */
+    stride = MEMPOOL_BITMAP_ALIGN_UP(ele_size, align);
+    data_offset = MEMPOOL_BITMAP_ALIGN_UP(head_size + head, align) - head;
+    memsize = data_offset + count * stride;
+    page = mp_pageheap_alloc_ex(memsize, &zeroed);
+    if (!page) {
+        return NULL;
+    }
+
+    /* 页堆复用的页可能有旧数据，头部和位图先清零 */
+    memset(page, 0, head_size);
+    handle = (struct mempool_bitmap_imp *)page;
+    handle->mempool_id = id;
+    handle->flags = flags;
+    handle->used_cnt = 0;
+    handle->count = count;
+    handle->ele_size = ele_size;
+    handle->stride = stride;
+    handle->memsize = memsize;
+    handle->word_num = word_num;
+    handle->hint = 0;
+    handle->data = page + data_offset;
+    handle->zero = handle->bitmap + word_num;
+
+    rc = pthread_mutex_init(&handle->lck, NULL);
+    if (rc != 0) {
+        mp_pageheap_free(page, memsize);
+        return NULL;
+    }
+
+    /* 位图已清零，只需要置位有效单元 */
+    for (i = 0; i < count / MEMPOOL_BITMAP_WORD_BITS; i++) {
+        handle->bitmap[i] = ~(uint64_t)0;
+    }
+    if (count % MEMPOOL_BITMAP_WORD_BITS) {
+        handle->bitmap[i] = ((uint64_t)1 << (count % MEMPOOL_BITMAP_WORD_BITS)) - 1;
+    }
+    /* 新映射的页从未写过，所有单元都是0 */
+    if (zeroed) {
+        memcpy(handle->zero, handle->bitmap, word_num * sizeof(uint64_t));
+    }
+    return handle;
+}
+
+void mempool_bitmap_free_imp(struct mempool_bitmap_imp *mp)
+{
+    if (!mp) {
+        return;
+    }
+    assert(mp->used_cnt == 0);
+    pthread_mutex_destroy(&mp->lck);
+    mp_pageheap_free(mp, mp->memsize);
+}
+
+/* 从hint开始查找第一个非0字，按向量宽度一次比较多个字 */
+static inline size_t mempool_bitmap_find_word(const struct mempool_bitmap_imp *mp)
+{
+    size_t i = mp->hint & ~(size_t)1;
+
+#if defined(__SSE2__)
+    for (; i < mp->word_num; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&mp->bitmap[i]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff) {
+            break;
+        }
+    }
+#endif
+    for (; i < mp->word_num; i++) {
+        if (mp->bitmap[i]) {
+            return i;
+        }
+    }
+    return mp->word_num;
+}
+
+void *mempool_bitmap_get_imp(struct mempool_bitmap_imp *mp)
+{
+    return mempool_bitmap_get_ex_imp(mp, NULL);
+}
+
+void *mempool_bitmap_get_ex_imp(struct mempool_bitmap_imp *mp, int *zeroed)
+{
+    int rc;
+    size_t w;
+    size_t idx;
+    uint64_t bit;
+
+    if (!mp) {
+        return NULL;
+    }
+
+    rc = mempool_bitmap_lock(mp);
+    if (rc != 0) {
+        return NULL;
+    }
+    if (mp->used_cnt == mp->count) {
+        mempool_bitmap_unlock(mp);
+        return NULL;
+    }
+    w = mempool_bitmap_find_word(mp);
+    assert(w < mp->word_num);
+    bit = mp->bitmap[w] & -mp->bitmap[w];
+    idx = w * MEMPOOL_BITMAP_WORD_BITS + __builtin_ctzll(bit);
+    mp->bitmap[w] ^= bit;
+    if (zeroed) {
+        *zeroed = !!(mp->zero[w] & bit);
+    }
+    mp->zero[w] &= ~bit;
+    mp->hint = w;
+    /* 计数在锁内修改，统计接口不加锁读取 */
+    __atomic_store_n(&mp->used_cnt, mp->used_cnt + 1, __ATOMIC_RELAXED);
+    mempool_bitmap_unlock(mp);
+
+    return mp->data + idx * mp->stride;
+}
+
+void mempool_bitmap_put_imp(struct mempool_bitmap_imp *mp, void *ele)
+{
+    mempool_bitmap_put_ex_imp(mp, ele, 0);
+}
+
+void mempool_bitmap_put_ex_imp(struct mempool_bitmap_imp *mp, void *ele, int zeroed)
+{
+    int rc;
+    size_t off;
+    size_t idx;
+    size_t w;
+    uint64_t bit;
+
+    MP_HARDEN_CHECK(mp && ele);
+
+    /* 地址不在池内或不在单元边界上，说明指针非法 */
+    off = (size_t)((char *)ele - mp->data);
+    MP_HARDEN_CHECK((char *)ele >= mp->data && off < mp->count * mp->stride && !(off % mp->stride));
+    idx = off / mp->stride;
+    w = idx / MEMPOOL_BITMAP_WORD_BITS;
+    bit = (uint64_t)1 << (idx % MEMPOOL_BITMAP_WORD_BITS);
+
+    rc = mempool_bitmap_lock(mp);
+    if (rc != 0) {
+        return;
+    }
+#if MP_HARDEN_LEVEL >= 1
+    if (mp->bitmap[w] & bit) {
+        /* 重复释放 */
+        mempool_bitmap_unlock(mp);
+        abort();
+        return;
+    }
+#endif
+    mp->bitmap[w] |= bit;
+    if (zeroed) {
+        mp->zero[w] |= bit;
+    }
+    if (w < mp->hint) {
+        mp->hint = w;
+    }
+    __atomic_store_n(&mp->used_cnt, mp->used_cnt - 1, __ATOMIC_RELAXED);
+    mempool_bitmap_unlock(mp);
+}
+
+size_t mempool_bitmap_use_count_imp(struct mempool_bitmap_imp *mp)
+{
+    if (!mp) {
+        return 0;
+    }
+    return __atomic_load_n(&mp->used_cnt, __ATOMIC_RELAXED);
+}
+
+size_t mempool_bitmap_avail_count_imp(struct mempool_bitmap_imp *mp)
+{
+    if (!mp) {
+        return 0;
+    }
+    return (mp->count - __atomic_load_n(&mp->used_cnt, __ATOMIC_RELAXED));
+}
+
+void mempool_bitmap_populate_imp(struct mempool_bitmap_imp *mp)
+{
+    if (!mp) {
+        return;
+    }
+    mp_pageheap_populate(mp, mp->memsize);
+}
+
+void mempool_bitmap_foreach_used_imp(struct mempool_bitmap_imp *mp, mempool_bitmap_iter_fn fn, void *arg)
+{
+    size_t w;
+    size_t idx;
+    uint64_t used;
+
+    if (!mp || !fn) {
+        return;
+    }
+    if (mempool_bitmap_lock(mp) != 0) {
+        return;
+    }
+    for (w = 0; w * MEMPOOL_BITMAP_WORD_BITS < mp->count; w++) {
+        used = ~mp->bitmap[w];
+        while (used) {
+            idx = w * MEMPOOL_BITMAP_WORD_BITS + __builtin_ctzll(used);
+            used &= used - 1;
+            if (idx >= mp->count) {
+                break;
+            }
+            fn(mp->data + idx * mp->stride, arg);
+        }
+    }
+    mempool_bitmap_unlock(mp);
+}
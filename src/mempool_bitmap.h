@@ -0,0 +1,34 @@
+#ifndef MEM_POOL_BITMAP_H_
+#define MEM_POOL_BITMAP_H_
+
+#include <stdio.h>
+
+/*
+ * 位图占用的内存池
+ *   占用状态记录在池头部的位图里（1表示空闲），分配总是取地址最低的空闲单元；
+ *   单元本身没有元数据头，释放时通过地址计算下标，重复释放O(1)检测。
+ */
+typedef void (*mempool_bitmap_iter_fn)(void *ele, void *arg);
+
+/* 创建标记 */
+#define MEMPOOL_BITMAP_F_NO_LOCK    0x01 /* 只在一个线程里使用，取放不加锁 */
+
+struct mempool_bitmap_imp;
+/* 每个单元偏移head处按align对齐（至少16字节，0取默认），步长随之取整 */
+struct mempool_bitmap_imp *mempool_bitmap_create_ex_imp(int id, size_t count, size_t ele_size,
+                                                        size_t align, size_t head, int flags);
+void mempool_bitmap_free_imp(struct mempool_bitmap_imp *mp);
+void *mempool_bitmap_get_imp(struct mempool_bitmap_imp *mp);
+void mempool_bitmap_put_imp(struct mempool_bitmap_imp *mp, void *ele);
+/* zeroed返回单元是否全为0（从未取出过且池内存来自新映射的页，或归还时已清零） */
+void *mempool_bitmap_get_ex_imp(struct mempool_bitmap_imp *mp, int *zeroed);
+/* zeroed非0表示调用者已把单元清零 */
+void mempool_bitmap_put_ex_imp(struct mempool_bitmap_imp *mp, void *ele, int zeroed);
+size_t mempool_bitmap_use_count_imp(struct mempool_bitmap_imp *mp);
+size_t mempool_bitmap_avail_count_imp(struct mempool_bitmap_imp *mp);
+/* 预先触发整个池的缺页，池可以正在使用 */
+void mempool_bitmap_populate_imp(struct mempool_bitmap_imp *mp);
+/* 按地址顺序遍历所有已分配单元，用于泄漏报告，遍历期间持有池锁 */
+void mempool_bitmap_foreach_used_imp(struct mempool_bitmap_imp *mp, mempool_bitmap_iter_fn fn, void *arg);
+
+#endif
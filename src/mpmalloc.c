@@ -1,6 +1,11 @@
 
 #include "mpmalloc.h"
 #include "mpmalloc_hash_imp.h"
+#include "mpmalloc_arena_imp.h"
+#include "mpmalloc_tlsf_imp.h"
+#include "mpmalloc_buddy_imp.h"
+#include "mpmalloc_shm_imp.h"
+#include "mpmalloc_pageheap.h"
 
 
 #ifndef mp_pri_calloc
@@ -13,17 +18,45 @@
 #define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg) 
 #define MP_LOG_DEBUG(format, arg...)
 
+/* 自动生成的分配单元上限，和默认方法支持的size类型数一致 */
+#define MP_AUTO_UNIT_MAX_NUM    254
+
 struct mp_handle {
+    struct mp_handle_head head; /* 必须是第一个成员，mp_fixed_alloc 直接读取 */
     int method_id;     /* 方法id，对应g_methods数组的偏移值 */
     void *method_imp;  /* 内存管理方法句柄 */
 };
 
 /*内存分配算法实现的回调函数*/
-typedef void *(*mp_create_fn)(const struct mp_unit *arr, int arr_num);
+typedef void *(*mp_create_fn)(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr);
 typedef void *(*mp_alloc_fn)(void * mh, size_t  size);
 typedef void *(*mp_realloc_fn)(void * mh, void *mem, size_t  newsize);
 typedef void (*mp_free_fn)(void * mh, void *mem);
 typedef void (*mp_destroy_fn)(void * mh);
+typedef int (*mp_size_class_fn)(void * mh, size_t size);
+typedef void *(*mp_alloc_class_fn)(void * mh, int class_id);
+typedef int (*mp_reset_fn)(void * mh);
+typedef size_t (*mp_offset_fn)(void * mh, const void *mem);
+typedef void *(*mp_ptr_fn)(void * mh, size_t offset);
+typedef int (*mp_fd_fn)(void * mh);
+typedef int (*mp_set_root_fn)(void * mh, const void *mem);
+typedef void *(*mp_get_root_fn)(void * mh);
+typedef int (*mp_set_budget_fn)(void * mh, size_t limit);
+typedef int (*mp_add_reclaim_fn)(void * mh, mp_reclaim_fn fn, void *arg);
+typedef int (*mp_get_budget_fn)(void * mh, size_t *limit, size_t *used);
+typedef int (*mp_get_hist_fn)(void * mh, int class_id, int type, struct mp_hist *out);
+typedef int (*mp_prof_rate_fn)(void * mh, size_t rate);
+typedef int (*mp_prof_dump_fn)(void * mh, const char *path);
+typedef size_t (*mp_usable_size_fn)(void * mh, const void *mem);
+typedef int (*mp_reserve_fn)(void * mh, size_t size, size_t count, int flags);
+typedef int (*mp_regions_fn)(void * mh, struct iovec *iov, int iov_num);
+typedef int (*mp_region_index_fn)(void * mh, const void *mem, size_t *offset);
+typedef void *(*mp_calloc_fn)(void * mh, size_t size);
+typedef int (*mp_zero_on_free_fn)(void * mh, size_t size, int on);
+typedef void *(*mp_alloc_tagged_fn)(void * mh, int tag, size_t size);
+typedef int (*mp_tag_stats_fn)(void * mh, int tag, struct mp_tag_stats *out);
+typedef int (*mp_foreach_live_fn)(void * mh, mp_live_fn fn, void *arg);
+typedef void (*mp_free_sized_fn)(void * mh, void *mem, size_t size);
 
 
 struct mp_method
@@ -34,6 +67,30 @@ struct mp_method
     mp_realloc_fn realloc;
     mp_free_fn free;
     mp_destroy_fn destroy;
+    mp_size_class_fn size_class;    /* 可选，size到分配单元的映射 */
+    mp_alloc_class_fn alloc_class;  /* 可选，按分配单元直接分配 */
+    mp_reset_fn reset;              /* 可选，批量归还所有分配 */
+    mp_offset_fn offset;            /* 可选，指针到共享段偏移 */
+    mp_ptr_fn ptr;                  /* 可选，共享段偏移到指针 */
+    mp_fd_fn fd;                    /* 可选，共享段描述符 */
+    mp_set_root_fn set_root;        /* 可选，设置段内根对象 */
+    mp_get_root_fn get_root;        /* 可选，获取段内根对象 */
+    mp_set_budget_fn set_budget;    /* 可选，内存预算 */
+    mp_add_reclaim_fn add_reclaim;  /* 可选，预算回收回调 */
+    mp_get_budget_fn get_budget;    /* 可选，预算统计 */
+    mp_get_hist_fn get_hist;        /* 可选，时延直方图 */
+    mp_prof_rate_fn prof_rate;      /* 可选，堆分析采样间隔 */
+    mp_prof_dump_fn prof_dump;      /* 可选，堆分析输出 */
+    mp_usable_size_fn usable_size;  /* 可选，分配单元实际可用大小 */
+    mp_reserve_fn reserve;          /* 可选，预先扩展内存池 */
+    mp_regions_fn regions;          /* 可选，锁定区域列表 */
+    mp_region_index_fn region_index;/* 可选，指针到锁定区域下标 */
+    mp_calloc_fn calloc;            /* 可选，返回清零的内存，能跳过已知为0的单元 */
+    mp_zero_on_free_fn zero_on_free;/* 可选，分配单元释放时清零 */
+    mp_alloc_tagged_fn alloc_tagged;/* 可选，按标签分配 */
+    mp_tag_stats_fn tag_stats;      /* 可选，标签统计 */
+    mp_foreach_live_fn foreach_live;/* 可选，遍历使用中的单元 */
+    mp_free_sized_fn free_sized;    /* 可选，按申请大小释放，不支持时走free */
 };
 
 static const struct mp_method g_methods[] = 
@@ -43,11 +100,172 @@ static const struct mp_method g_methods[] =
     mp_hash_alloc_imp,
     mp_hash_realloc_imp,
     mp_hash_free_imp,
-    mp_hash_destroy_imp
+    mp_hash_destroy_imp,
+    mp_hash_size_class_imp,
+    mp_hash_alloc_class_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    mp_hash_set_budget_imp,
+    mp_hash_add_reclaim_imp,
+    mp_hash_get_budget_imp,
+    mp_hash_get_hist_imp,
+    mp_hash_prof_set_rate_imp,
+    mp_hash_prof_dump_imp,
+    mp_hash_usable_size_imp,
+    mp_hash_reserve_imp,
+    NULL,
+    NULL,
+    mp_hash_calloc_imp,
+    mp_hash_zero_on_free_imp,
+    mp_hash_alloc_tagged_imp,
+    mp_hash_tag_stats_imp,
+    mp_hash_foreach_live_imp,
+    mp_hash_free_sized_imp
     },             /* default*/
+    {MP_METHOD_E_ARENA,
+    mp_arena_create_imp,
+    mp_arena_alloc_imp,
+    mp_arena_realloc_imp,
+    mp_arena_free_imp,
+    mp_arena_destroy_imp,
+    NULL,
+    NULL,
+    mp_arena_reset_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    mp_arena_usable_size_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+    },             /* arena */
+    {MP_METHOD_E_TLSF,
+    mp_tlsf_create_imp,
+    mp_tlsf_alloc_imp,
+    mp_tlsf_realloc_imp,
+    mp_tlsf_free_imp,
+    mp_tlsf_destroy_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    mp_tlsf_usable_size_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+    },             /* tlsf */
+    {MP_METHOD_E_BUDDY,
+    mp_buddy_create_imp,
+    mp_buddy_alloc_imp,
+    mp_buddy_realloc_imp,
+    mp_buddy_free_imp,
+    mp_buddy_destroy_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    mp_buddy_usable_size_imp,
+    NULL,
+    mp_buddy_regions_imp,
+    mp_buddy_region_index_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+    },             /* buddy */
+    {MP_METHOD_E_SHM,
+    mp_shm_create_imp,
+    mp_shm_alloc_imp,
+    mp_shm_realloc_imp,
+    mp_shm_free_imp,
+    mp_shm_destroy_imp,
+    NULL,
+    NULL,
+    NULL,
+    mp_shm_offset_imp,
+    mp_shm_ptr_imp,
+    mp_shm_fd_imp,
+    mp_shm_set_root_imp,
+    mp_shm_get_root_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    mp_shm_usable_size_imp,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+    },             /* shm */
 };
 
+/* 句柄代数从1开始，0留给未初始化的固定分配缓存 */
+static unsigned long g_mp_handle_gen;
+
+static inline unsigned long mp_handle_next_gen(void)
+{
+    return __atomic_add_fetch(&g_mp_handle_gen, 1, __ATOMIC_RELAXED);
+}
+
 struct mp_handle* mp_create(const struct mp_unit *arr, int arr_num, mp_method_t m)
+{
+    return mp_create_attr(arr, arr_num, m, NULL);
+}
+
+struct mp_handle* mp_create_attr(const struct mp_unit *arr, int arr_num, mp_method_t m, const struct mp_attr *attr)
 {
     struct mp_handle* mh;
 
@@ -71,13 +289,19 @@ struct mp_handle* mp_create(const struct mp_unit *arr, int arr_num, mp_method_t
         return NULL;
     }
 
+    if (attr && (attr->flags & MP_ATTR_F_PINNED) && !g_methods[m].regions) {
+        MP_LOG_ERROR("method[%d] not support pinned.", m);
+        return NULL;
+    }
+
     mh = mp_pri_calloc(1, sizeof(struct mp_handle));
     if (!mh) {
         MP_LOG_ERROR("mp_pri_calloc fail.");
         return NULL;
     }
+    mh->head.gen = mp_handle_next_gen();
     mh->method_id = m;
-    mh->method_imp = g_methods[mh->method_id].create(arr, arr_num);
+    mh->method_imp = g_methods[mh->method_id].create(arr, arr_num, attr);
     if (!mh->method_imp) {
         MP_LOG_ERROR("create methods object fail.");
         goto fail;
@@ -89,6 +313,52 @@ fail:
     return NULL;
 }
 
+struct mp_handle* mp_create_auto(size_t min_size, size_t max_size, unsigned int max_waste_pct, int per_class_capacity)
+{
+    int num;
+    struct mp_unit *arr;
+    struct mp_handle* mh;
+
+    arr = mp_pri_calloc(MP_AUTO_UNIT_MAX_NUM, sizeof(struct mp_unit));
+    if (!arr) {
+        MP_LOG_ERROR("mp_pri_calloc fail.");
+        return NULL;
+    }
+    num = mp_hash_auto_units_imp(min_size, max_size, max_waste_pct, per_class_capacity, arr, MP_AUTO_UNIT_MAX_NUM);
+    if (num <= 0) {
+        mp_pri_free(arr);
+        return NULL;
+    }
+    mh = mp_create(arr, num, MP_METHOD_E_DEFAULT);
+    mp_pri_free(arr);
+    return mh;
+}
+
+struct mp_handle* mp_attach(const char *name, int fd)
+{
+    struct mp_handle* mh;
+
+    if (!name && fd < 0) {
+        MP_LOG_ERROR("name or fd of param invalid.");
+        return NULL;
+    }
+
+    mh = mp_pri_calloc(1, sizeof(struct mp_handle));
+    if (!mh) {
+        MP_LOG_ERROR("mp_pri_calloc fail.");
+        return NULL;
+    }
+    mh->head.gen = mp_handle_next_gen();
+    mh->method_id = MP_METHOD_E_SHM;
+    mh->method_imp = mp_shm_attach_imp(name, fd);
+    if (!mh->method_imp) {
+        MP_LOG_ERROR("attach shm[%s] fd[%d] fail.", name ? name : "", fd);
+        mp_pri_free(mh);
+        return NULL;
+    }
+    return mh;
+}
+
 void mp_destroy(struct mp_handle* mh)
 {
     if (mh) {
@@ -114,15 +384,82 @@ void *mp_malloc(struct mp_handle* mh, size_t size)
 void *mp_calloc(struct mp_handle* mh, size_t nitems, size_t size)
 {
     void *ptr;
+    size_t total;
 
-    ptr = mp_malloc(mh, nitems * size);
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return NULL;
+    }
+    if (__builtin_mul_overflow(nitems, size, &total)) {
+        MP_LOG_ERROR("nitems[%lu] * size[%lu] overflow.", nitems, size);
+        return NULL;
+    }
+    if (g_methods[mh->method_id].calloc) {
+        return g_methods[mh->method_id].calloc(mh->method_imp, total);
+    }
+    ptr = mp_malloc(mh, total);
     if (!ptr) {
         return NULL;
     }
-    memset(ptr, 0, nitems * size);
+    mp_pageheap_zero(ptr, total);
     return ptr;
 }
 
+int mp_zero_on_free(struct mp_handle* mh, size_t size, int on)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].zero_on_free) {
+        MP_LOG_ERROR("method[%d] not support zero on free.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].zero_on_free(mh->method_imp, size, on);
+}
+
+void *mp_malloc_tagged(struct mp_handle* mh, int tag, size_t size)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return NULL;
+    }
+    if (!tag) {
+        return mp_malloc(mh, size);
+    }
+    if (!g_methods[mh->method_id].alloc_tagged) {
+        MP_LOG_ERROR("method[%d] not support tagged alloc.", mh->method_id);
+        return NULL;
+    }
+    return g_methods[mh->method_id].alloc_tagged(mh->method_imp, tag, size);
+}
+
+int mp_tag_stats(struct mp_handle* mh, int tag, struct mp_tag_stats *out)
+{
+    if (!mh || !out) {
+        MP_LOG_ERROR("mh[%p] or out[%p] null.", mh, out);
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].tag_stats) {
+        MP_LOG_ERROR("method[%d] not support tag stats.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].tag_stats(mh->method_imp, tag, out);
+}
+
+int mp_foreach_live(struct mp_handle* mh, mp_live_fn fn, void *arg)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].foreach_live) {
+        MP_LOG_ERROR("method[%d] not support foreach live.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].foreach_live(mh->method_imp, fn, arg);
+}
+
 void *mp_realloc(struct mp_handle* mh, void *p, size_t size)
 {
     if (!mh) {
@@ -140,3 +477,277 @@ void mp_free(struct mp_handle* mh, void *p)
     }
     g_methods[mh->method_id].free(mh->method_imp, p);
 }
+
+void mp_free_sized(struct mp_handle* mh, void *p, size_t size)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh[%p] invalid, free pointer: %p.", mh, p);
+        return;
+    }
+    if (!g_methods[mh->method_id].free_sized) {
+        g_methods[mh->method_id].free(mh->method_imp, p);
+        return;
+    }
+    g_methods[mh->method_id].free_sized(mh->method_imp, p, size);
+}
+
+size_t mp_malloc_usable_size(struct mp_handle* mh, const void *p)
+{
+    if (!mh || !p) {
+        return 0;
+    }
+    if (!g_methods[mh->method_id].usable_size) {
+        MP_LOG_ERROR("method[%d] not support usable size.", mh->method_id);
+        return 0;
+    }
+    return g_methods[mh->method_id].usable_size(mh->method_imp, p);
+}
+
+void *mp_malloc_at_least(struct mp_handle* mh, size_t size, size_t *actual)
+{
+    void *ptr;
+
+    ptr = mp_malloc(mh, size);
+    if (ptr && actual) {
+        *actual = g_methods[mh->method_id].usable_size ? mp_malloc_usable_size(mh, ptr) : size;
+    }
+    return ptr;
+}
+
+int mp_reserve(struct mp_handle* mh, size_t size, size_t count, int flags)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].reserve) {
+        MP_LOG_ERROR("method[%d] not support reserve.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].reserve(mh->method_imp, size, count, flags);
+}
+
+int mp_reserve_profile(struct mp_handle* mh, const struct mp_unit *arr, int arr_num, int flags)
+{
+    int i;
+    int rc = MP_OK;
+
+    if (!mh || !arr || arr_num <= 0) {
+        MP_LOG_ERROR("mh[%p] arr[%p] or arr_num[%d] invalid.", mh, arr, arr_num);
+        return MP_ERR;
+    }
+    for (i = 0; i < arr_num; i++) {
+        if (arr[i].capacity < 0) {
+            MP_LOG_ERROR("unit[%d] capacity[%d] invalid.", i, arr[i].capacity);
+            rc = MP_ERR;
+            continue;
+        }
+        if (mp_reserve(mh, arr[i].size, (size_t)arr[i].capacity, flags) != MP_OK) {
+            rc = MP_ERR;
+        }
+    }
+    return rc;
+}
+
+int mp_regions(struct mp_handle* mh, struct iovec *iov, int iov_num)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].regions) {
+        MP_LOG_ERROR("method[%d] not support regions.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].regions(mh->method_imp, iov, iov_num);
+}
+
+int mp_region_index(struct mp_handle* mh, const void *p, size_t *offset)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].region_index) {
+        MP_LOG_ERROR("method[%d] not support region index.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].region_index(mh->method_imp, p, offset);
+}
+
+int mp_reset(struct mp_handle* mh)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].reset) {
+        MP_LOG_ERROR("method[%d] not support reset.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].reset(mh->method_imp);
+}
+
+int mp_fixed_class_init(struct mp_handle* mh, size_t size, struct mp_fixed_class *fc)
+{
+    const struct mp_method *method;
+    int class_id;
+
+    if (!mh || !fc) {
+        MP_LOG_ERROR("mh[%p] or fc[%p] null.", mh, fc);
+        return MP_ERR;
+    }
+    method = &g_methods[mh->method_id];
+    if (!method->size_class || !method->alloc_class) {
+        return MP_ERR;
+    }
+    class_id = method->size_class(mh->method_imp, size);
+    if (class_id < 0) {
+        return MP_ERR;
+    }
+    fc->alloc = method->alloc_class;
+    fc->imp = mh->method_imp;
+    fc->class_id = class_id;
+    fc->size = size;
+    fc->gen = mh->head.gen;
+    return MP_OK;
+}
+
+int mp_fd(struct mp_handle* mh)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return -1;
+    }
+    if (!g_methods[mh->method_id].fd) {
+        return -1;
+    }
+    return g_methods[mh->method_id].fd(mh->method_imp);
+}
+
+size_t mp_offset(struct mp_handle* mh, const void *p)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_OFFSET_INVALID;
+    }
+    if (!g_methods[mh->method_id].offset) {
+        MP_LOG_ERROR("method[%d] not support offset.", mh->method_id);
+        return MP_OFFSET_INVALID;
+    }
+    return g_methods[mh->method_id].offset(mh->method_imp, p);
+}
+
+void *mp_ptr(struct mp_handle* mh, size_t offset)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return NULL;
+    }
+    if (!g_methods[mh->method_id].ptr) {
+        MP_LOG_ERROR("method[%d] not support offset.", mh->method_id);
+        return NULL;
+    }
+    return g_methods[mh->method_id].ptr(mh->method_imp, offset);
+}
+
+int mp_set_root(struct mp_handle* mh, const void *p)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].set_root) {
+        MP_LOG_ERROR("method[%d] not support root.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].set_root(mh->method_imp, p);
+}
+
+void *mp_get_root(struct mp_handle* mh)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return NULL;
+    }
+    if (!g_methods[mh->method_id].get_root) {
+        return NULL;
+    }
+    return g_methods[mh->method_id].get_root(mh->method_imp);
+}
+
+int mp_set_budget(struct mp_handle* mh, size_t limit)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].set_budget) {
+        MP_LOG_ERROR("method[%d] not support budget.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].set_budget(mh->method_imp, limit);
+}
+
+int mp_add_reclaim(struct mp_handle* mh, mp_reclaim_fn fn, void *arg)
+{
+    if (!mh || !fn) {
+        MP_LOG_ERROR("mh[%p] or fn null.", mh);
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].add_reclaim) {
+        MP_LOG_ERROR("method[%d] not support budget.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].add_reclaim(mh->method_imp, fn, arg);
+}
+
+int mp_get_budget(struct mp_handle* mh, size_t *limit, size_t *used)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].get_budget) {
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].get_budget(mh->method_imp, limit, used);
+}
+
+int mp_heap_profile_set_rate(struct mp_handle* mh, size_t sample_bytes)
+{
+    if (!mh) {
+        MP_LOG_ERROR("mh null.");
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].prof_rate) {
+        MP_LOG_ERROR("method[%d] not support heap profile.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].prof_rate(mh->method_imp, sample_bytes);
+}
+
+int mp_heap_profile_dump(struct mp_handle* mh, const char *path)
+{
+    if (!mh || !path) {
+        MP_LOG_ERROR("mh[%p] or path null.", mh);
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].prof_dump) {
+        MP_LOG_ERROR("method[%d] not support heap profile.", mh->method_id);
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].prof_dump(mh->method_imp, path);
+}
+
+int mp_hist_get(struct mp_handle* mh, int class_id, mp_hist_type_t type, struct mp_hist *out)
+{
+    if (!mh || !out) {
+        MP_LOG_ERROR("mh[%p] or out null.", mh);
+        return MP_ERR;
+    }
+    if (!g_methods[mh->method_id].get_hist) {
+        return MP_ERR;
+    }
+    return g_methods[mh->method_id].get_hist(mh->method_imp, class_id, type, out);
+}
@@ -29,6 +29,10 @@ extern "C" {
 
 typedef enum _mp_method{
     MP_METHOD_E_DEFAULT = 0,/* 默认基于内存池和哈希表的分配方法 */
+    MP_METHOD_E_ARENA,      /* 区域分配方法，释放为空操作，通过mp_reset统一归还 */
+    MP_METHOD_E_TLSF,       /* 两级分离适配方法，预留区域内O(1)分配，最坏时延有界 */
+    MP_METHOD_E_BUDDY,      /* 伙伴分配方法，适合大小不确定的分配，realloc可原地扩展 */
+    MP_METHOD_E_SHM,        /* 进程间共享方法，内存池位于共享内存段，可由其它进程attach后释放 */
     MP_METHOD_E_MAX,
 }mp_method_t;
 
@@ -37,6 +41,39 @@ struct mp_unit{
     int    capacity;        /* 该size单元的内存池容量初始值 */
 };
 
+/*
+ * MP_METHOD_E_SHM：段映射到name指定的普通文件，内容和空闲链表在重启后保留；
+ * 文件已存在时校验段头和分配单元布局（需与创建时一致）后直接使用，同一时刻只能被一个句柄打开
+ */
+#define MP_ATTR_F_PERSIST       0x01
+/*
+ * MP_METHOD_E_BUDDY：区域创建时预先缺页并mlock（受RLIMIT_MEMLOCK限制），空闲后不归还系统，
+ * 通过 mp_regions 获取区域用于io_uring注册固定缓冲区；不退回普通分配，区域用完后分配返回NULL
+ */
+#define MP_ATTR_F_PINNED        0x02
+/*
+ * MP_METHOD_E_DEFAULT：开启线程缓存，每个线程每个分配单元缓存最多两批空闲单元，
+ * 批次整体和每个分配单元的中转缓存交换，缓存命中时不访问内存池；线程退出时归还。
+ * 调试加固级别下不生效
+ */
+#define MP_ATTR_F_THREAD_CACHE  0x04
+/*
+ * MP_METHOD_E_DEFAULT：句柄只在一个线程里使用（如事件循环），分配释放路径上不加锁、不做原子操作，
+ * 不分片，忽略 MP_ATTR_F_THREAD_CACHE；调试加固级别下校验调用线程，跨线程使用时abort
+ */
+#define MP_ATTR_F_SINGLE_THREAD 0x08
+
+/* 创建句柄的可选属性，不需要时传NULL */
+struct mp_attr{
+    unsigned int flags;     /* MP_ATTR_F_* */
+    const char *name;       /* MP_METHOD_E_SHM：shm_open的名字（以'/'开头），NULL表示使用匿名memfd；持久化时为文件路径 */
+    size_t budget;          /* 内存预算（字节），0表示不限制，见 mp_set_budget */
+    int shards;             /* 默认方法每个分配单元的分片数，0表示按CPU数，1表示不分片；每个分片至少64个单元 */
+};
+
+/* mp_offset 失败时的返回值 */
+#define MP_OFFSET_INVALID       ((size_t)-1)
+
 struct mp_handle;
 /**
  * \brief 创建一个内存管理实例.
@@ -48,6 +85,147 @@ struct mp_handle;
  */
 
 struct mp_handle* mp_create(const struct mp_unit *arr, int arr_num, mp_method_t m);
+/**
+ * \brief 带属性创建一个内存管理实例，attr为NULL时与mp_create相同.
+ */
+struct mp_handle* mp_create_attr(const struct mp_unit *arr, int arr_num, mp_method_t m, const struct mp_attr *attr);
+/**
+ * \brief 按size范围自动生成分配单元，创建默认方法的内存管理实例.
+ *  小size每16字节一级，往上每个2的幂区间等分若干级；[min_size, max_size] 内不小于 1600/max_waste_pct
+ *  的申请，落到的单元相对浪费（多出的字节/申请字节）不超过max_waste_pct，更小的申请受16字节对齐限制，
+ *  只保证浪费小于16字节（如10%时17字节落到32字节单元）；size到单元的映射直接用位运算计算，不再查找。
+ *  注意每一级都会预分配per_class_capacity个单元，范围很大时内存占用也大
+ * \param max_waste_pct 允许的最大内部碎片百分比，1~100
+ * \return 返回内存管理句柄，失败（如范围内级数超过上限）则为NULL
+ */
+struct mp_handle* mp_create_auto(size_t min_size, size_t max_size, unsigned int max_waste_pct, int per_class_capacity);
+/**
+ * \brief 连接到其它进程创建的共享句柄（MP_METHOD_E_SHM）.
+ *  对方分配的内存可以通过偏移传递过来，在本进程直接访问和mp_free
+ * \param name 创建时的shm名字；为NULL时使用fd
+ * \param fd 创建者通过 mp_fd 获取并传递（fork继承或SCM_RIGHTS）的描述符，函数内部会dup
+ * \return 返回内存管理句柄，失败则为NULL；使用完调用mp_destroy，只有创建者会删除共享段
+ */
+struct mp_handle* mp_attach(const char *name, int fd);
+/**
+ * \brief 共享句柄的段描述符，用于传递给其它进程attach；非共享句柄返回-1.
+ */
+int mp_fd(struct mp_handle* mh);
+/**
+ * \brief 共享句柄内指针和段内偏移的相互转换，偏移在所有attach的进程里都有效.
+ *  非法指针返回MP_OFFSET_INVALID，非法偏移返回NULL
+ */
+size_t mp_offset(struct mp_handle* mh, const void *p);
+void *mp_ptr(struct mp_handle* mh, size_t offset);
+struct iovec;
+/**
+ * \brief 锁定句柄（MP_ATTR_F_PINNED）的内存区域，下标即io_uring固定缓冲区的buf_index.
+ *  区域只增不减，新增区域追加在末尾，可以用IORING_REGISTER_BUFFERS_UPDATE补充注册
+ * \param iov 输出数组，最多填iov_num个，可以传NULL和0只查询个数
+ * \return 区域个数，非锁定句柄或方法不支持返回MP_ERR
+ */
+int mp_regions(struct mp_handle* mh, struct iovec *iov, int iov_num);
+/**
+ * \brief 锁定句柄内的指针（包括缓冲区内部指针）转换为区域下标和区域内偏移.
+ * \param offset 可为NULL
+ * \return 区域下标，不属于任何区域返回MP_ERR
+ */
+int mp_region_index(struct mp_handle* mh, const void *p, size_t *offset);
+
+/**
+ * \brief 设置/获取共享或持久化段的根对象，重启或attach后通过根对象找回业务数据.
+ *  p为NULL表示清除
+ */
+int mp_set_root(struct mp_handle* mh, const void *p);
+void *mp_get_root(struct mp_handle* mh);
+
+/**
+ * \brief 回收回调，预算紧张时调用，业务释放缓存等内存.
+ *  回调里可以调用 mp_free，不能调用同一句柄的 mp_malloc
+ * \param need 期望回收的字节数
+ * \return 估计回收的字节数，仅用于日志
+ */
+typedef size_t (*mp_reclaim_fn)(void *arg, size_t need);
+/**
+ * \brief 设置句柄的内存预算，统计内存池和退回glibc的内存.
+ *  超过预算的7/8时触发回收回调并释放空闲的动态内存池；
+ *  新的内存池或glibc分配会超过预算时先回收一次，仍不够则mp_malloc直接返回NULL。
+ *  目前只有默认方法支持
+ * \param limit 预算字节数，0表示不限制
+ */
+int mp_set_budget(struct mp_handle* mh, size_t limit);
+/**
+ * \brief 注册回收回调，最多8个，按注册顺序调用.
+ */
+int mp_add_reclaim(struct mp_handle* mh, mp_reclaim_fn fn, void *arg);
+/**
+ * \brief 获取预算和当前统计的内存字节数，参数可为NULL.
+ */
+int mp_get_budget(struct mp_handle* mh, size_t *limit, size_t *used);
+
+/* 时延直方图事件类型 */
+typedef enum _mp_hist_type{
+    MP_HIST_E_ALLOC_FAST = 0,   /* 固定内存池分配 */
+    MP_HIST_E_ALLOC_SLOW,       /* 动态内存池、扩展或退回glibc的分配 */
+    MP_HIST_E_FREE_FAST,        /* 归还固定内存池 */
+    MP_HIST_E_FREE_SLOW,        /* 归还动态内存池或glibc */
+    MP_HIST_E_POOL_CREATE,      /* 动态内存池创建 */
+    MP_HIST_E_LOCK_WAIT,        /* 等待内存池写锁 */
+    MP_HIST_E_MAX,
+}mp_hist_type_t;
+
+#define MP_HIST_BUCKET_NUM      252
+
+/* 对数分段的时延直方图，单位为tick（x86为tsc），通过 mp_hist_ticks_per_ns 换算 */
+struct mp_hist{
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned long long buckets[MP_HIST_BUCKET_NUM];
+};
+
+/**
+ * \brief 合并所有线程的时延直方图.
+ *  需要编译时打开 MPM_LATENCY_HIST（定义MP_LATENCY_HIST），目前只有默认方法支持
+ * \param class_id 分配单元索引（按size升序），小于0表示合并所有单元和退回glibc的分配
+ * \return 成功返回MP_OK，未开启或方法不支持返回MP_ERR
+ */
+int mp_hist_get(struct mp_handle* mh, int class_id, mp_hist_type_t type, struct mp_hist *out);
+/**
+ * \brief 直方图的百分位值（tick），p取值0~100.
+ */
+unsigned long long mp_hist_percentile(const struct mp_hist *h, double p);
+/**
+ * \brief 每纳秒的tick数，第一次调用时校准，耗时约10ms.
+ */
+double mp_hist_ticks_per_ns(void);
+/**
+ * \brief 开启/关闭采样堆分析，默认关闭.
+ *  平均每分配sample_bytes字节采样一次，记录调用栈并跟踪到释放；未采样的分配不受影响。
+ *  目前只有默认方法支持
+ * \param sample_bytes 平均采样间隔（字节），0表示关闭，已采样的内存仍在释放时注销
+ */
+int mp_heap_profile_set_rate(struct mp_handle* mh, size_t sample_bytes);
+/**
+ * \brief 把存活的采样写入文件，格式为pprof可解析的heap_v2文本（含MAPPED_LIBRARIES）.
+ *  用法：pprof --text <程序> <path>
+ */
+int mp_heap_profile_dump(struct mp_handle* mh, const char *path);
+/* 进程级页堆统计，所有句柄的内存池都从页堆申请 */
+struct mp_pageheap_stats{
+    size_t mapped;      /* 向系统映射的字节数 */
+    size_t free;        /* 空闲、可被任意句柄复用的字节数 */
+    size_t released;    /* 空闲中已交还系统（不占RSS）的字节数 */
+};
+/**
+ * \brief 获取页堆统计.
+ */
+int mp_pageheap_stats(struct mp_pageheap_stats *out);
+/**
+ * \brief 设置页堆保留的驻留空闲字节数，超过后归还的页交还系统，默认64MB.
+ *  0表示空闲页总是立即交还系统；使用大页映射的区域不归还
+ */
+void mp_pageheap_set_retain(size_t bytes);
 /**
  * \brief 销毁一个内存管理实例.
  *  注意：由于尽可能使用无锁设计，释放时，业务自己需要确保申请的内存都已经归还，否则在执行删除时，并发free会dump
@@ -55,13 +233,177 @@ struct mp_handle* mp_create(const struct mp_unit *arr, int arr_num, mp_method_t
  */
 void mp_destroy(struct mp_handle* mh); 
 
+/* 所有方法返回的地址至少按该值对齐；默认方法按16字节（max_align_t）对齐 */
+#define MP_MALLOC_MIN_ALIGN     8
+
 void *mp_malloc(struct mp_handle* mh, size_t size);
+/**
+ * \brief 申请nitems * size字节并清零，乘法溢出时返回NULL.
+ *  默认方法跟踪从未使用过的单元（内存池来自新映射的页）和释放时已清零的单元，取到这些单元时不再清零；
+ *  大块内存用非临时写清零，不污染cache
+ */
 void *mp_calloc(struct mp_handle* mh, size_t nitems, size_t size);
 void *mp_realloc(struct mp_handle* mh, void *p, size_t size);
 void mp_free(struct mp_handle* mh, void *p);
+/**
+ * \brief 带申请大小释放，size必须是分配（或最近一次mp_realloc）时的申请大小.
+ *  默认方法在加固级别不低于1时校验size和单元是否匹配，不匹配时abort；其它方法等同mp_free
+ */
+void mp_free_sized(struct mp_handle* mh, void *p, size_t size);
+/**
+ * \brief 分配单元实际可用的字节数，不小于申请大小.
+ *  超出申请大小的部分业务可以直接使用，mp_realloc到不超过该值时原地返回且保留全部内容
+ * \return p为NULL或方法不支持时返回0
+ */
+size_t mp_malloc_usable_size(struct mp_handle* mh, const void *p);
+/**
+ * \brief 申请至少size字节，并通过actual返回实际可用大小（同 mp_malloc_usable_size）.
+ *  适合可增长的缓冲区，一次拿到整个分配单元，减少mp_realloc
+ * \param actual 可为NULL
+ */
+void *mp_malloc_at_least(struct mp_handle* mh, size_t size, size_t *actual);
+/**
+ * \brief 设置size所在分配单元释放时清零，适合大部分通过mp_calloc申请的分配单元.
+ *  清零在释放时完成，之后mp_calloc取到该单元时不再清零；只有默认方法（MP_METHOD_E_DEFAULT）实现该接口
+ * \param on 非0开启，0关闭
+ * \return 成功返回MP_OK，size没有对应的分配单元或方法不支持返回MP_ERR
+ */
+int mp_zero_on_free(struct mp_handle* mh, size_t size, int on);
+
+/* 标签个数，标签0表示不打标签，业务可用 1 ~ MP_TAG_MAX-1 */
+#define MP_TAG_MAX              8
+
+/* 一个标签使用中的内存统计 */
+struct mp_tag_stats{
+    size_t used;        /* 使用中的字节数，按分配单元的实际可用大小统计 */
+    size_t count;       /* 使用中的分配个数 */
+};
+/**
+ * \brief 按标签（如按子系统）分配，同一分配单元里每个标签使用独立的子内存池，不同标签的内存不交错.
+ *  子内存池在标签第一次分配该单元时创建，初始容量为单元容量的1/4，不足时同样动态拓展和退回glibc；
+ *  释放仍用mp_free，mp_realloc保持原标签。只有默认方法（MP_METHOD_E_DEFAULT）实现该接口
+ * \param tag 0 ~ MP_TAG_MAX-1，0等同mp_malloc
+ * \return 标签非法或方法不支持时返回NULL
+ */
+void *mp_malloc_tagged(struct mp_handle* mh, int tag, size_t size);
+/**
+ * \brief 获取标签使用中的字节数和分配个数，不加锁，并发分配释放时是近似值.
+ * \param tag 1 ~ MP_TAG_MAX-1
+ */
+int mp_tag_stats(struct mp_handle* mh, int tag, struct mp_tag_stats *out);
+
+/* mp_foreach_live 的回调，size为分配单元实际可用大小 */
+typedef void (*mp_live_fn)(void *p, size_t size, void *arg);
+/**
+ * \brief 遍历所有使用中的内存池单元，用于泄漏报告，退回glibc的分配不在其中.
+ *  遍历前先把线程缓存、中转缓存和隔离区的单元还给内存池，调用者需保证期间没有其它线程使用句柄；
+ *  回调在内存池锁内执行，不能再调用本句柄的接口。加固级别不低于1时mp_destroy用它打印未释放的单元。
+ *  只有默认方法（MP_METHOD_E_DEFAULT）实现该接口
+ * \param fn 可为NULL，只统计个数
+ * \return 使用中的单元个数，方法不支持返回MP_ERR
+ */
+int mp_foreach_live(struct mp_handle* mh, mp_live_fn fn, void *arg);
+
+/* mp_reserve 标记：预先触发内存池所有页的缺页，避免首次使用时缺页 */
+#define MP_RESERVE_F_POPULATE   0x01
+
+/**
+ * \brief 预先扩展size所在分配单元的内存池，保证至少有count个空闲单元.
+ *  扩展本来发生在分配线程里并持有写锁，突发流量前调用可以让时延敏感的线程不再创建内存池；
+ *  预留的内存计入预算，空闲的动态内存池仍可能被预算回收释放。只有默认方法（MP_METHOD_E_DEFAULT）实现该接口
+ * \param flags 0或MP_RESERVE_F_POPULATE
+ * \return 成功返回MP_OK，动态内存池数量到上限、超出预算或方法不支持返回MP_ERR
+ */
+int mp_reserve(struct mp_handle* mh, size_t size, size_t count, int flags);
+/**
+ * \brief 按整个业务画像预留，arr的格式与mp_create相同，capacity表示该单元需要的空闲个数.
+ * \return 全部成功返回MP_OK，有单元失败时继续预留其它单元并返回MP_ERR
+ */
+int mp_reserve_profile(struct mp_handle* mh, const struct mp_unit *arr, int arr_num, int flags);
+
+/**
+ * \brief 一次性归还句柄上的所有分配，之前分配的指针全部失效.
+ *  只有支持批量释放的方法（MP_METHOD_E_ARENA）实现该接口
+ * \return 成功返回MP_OK，方法不支持返回MP_ERR
+ */
+int mp_reset(struct mp_handle* mh);
+
+typedef void (*mp_obj_fn)(void *obj);
+
+struct mp_objcache;
+/**
+ * \brief 创建一个对象缓存，对象在内存池单元第一次被使用时构造，归还后保持构造状态.
+ *
+ * \param size 对象大小
+ * \param align 对象对齐要求，2的幂，不超过页大小；0表示按max_align_t对齐，小于指针大小时按指针大小对齐
+ * \param ctor 构造函数，可为NULL
+ * \param dtor 析构函数，可为NULL，只在内存池缩减或销毁时调用
+ * \return 返回对象缓存句柄，失败则为NULL
+ */
+struct mp_objcache *mp_objcache_create(size_t size, size_t align, mp_obj_fn ctor, mp_obj_fn dtor);
+/**
+ * \brief 销毁对象缓存，所有对象需要已经归还，已构造的对象在这里析构.
+ */
+void mp_objcache_destroy(struct mp_objcache *oc);
+void *mp_objcache_alloc(struct mp_objcache *oc);
+void mp_objcache_free(struct mp_objcache *oc, void *obj);
+/**
+ * \brief 释放所有空闲的动态内存池，并析构其中的对象.
+ * \return 释放的内存池个数
+ */
+int mp_objcache_shrink(struct mp_objcache *oc);
+
+/**
+ * \brief 句柄的公开头部，只供内联的快速路径读取，其余字段不公开.
+ */
+struct mp_handle_head{
+    unsigned long gen;      /* 句柄代数，进程内唯一，同一地址先后创建的句柄也不相同 */
+};
+
+/**
+ * \brief 固定size分配的缓存，记录size对应的分配单元和实现方法，避免每次查找.
+ *  由 mp_fixed_class_init 填充，业务一般不直接使用，而是通过 MP_MALLOC_FIXED / mp_alloc_fixed<N>；
+ *  按句柄代数和size判断缓存是否有效，句柄销毁后在同一地址重新创建、同一缓存换了size都会重新查找
+ */
+struct mp_fixed_class{
+    unsigned long gen;                          /* 缓存对应句柄的代数，0表示未初始化 */
+    size_t size;                                /* 缓存对应的分配大小 */
+    void *(*alloc)(void *imp, int class_id);    /* 实现方法的按单元分配接口 */
+    void *imp;                                  /* 实现方法句柄 */
+    int class_id;                               /* 分配单元索引，小于0表示没有合适的单元 */
+};
+
+/**
+ * \brief 查找size对应的分配单元，填充固定分配缓存.
+ * \return 成功返回MP_OK；实现方法不支持或没有合适的单元返回MP_ERR
+ */
+int mp_fixed_class_init(struct mp_handle* mh, size_t size, struct mp_fixed_class *fc);
+
+static inline void *mp_fixed_alloc(struct mp_handle* mh, size_t size, struct mp_fixed_class *fc)
+{
+    if ((fc->gen != ((const struct mp_handle_head *)mh)->gen || fc->size != size)
+        && mp_fixed_class_init(mh, size, fc) != MP_OK) {
+        return mp_malloc(mh, size);
+    }
+    return fc->alloc(fc->imp, fc->class_id);
+}
+
+/* 编译期确定size的分配，每个调用点每个线程缓存一次查找结果，释放仍使用mp_free；size必须是编译期常量 */
+#define MP_MALLOC_FIXED(mh, size) ({                                                \
+    _Static_assert(__builtin_constant_p(size), "MP_MALLOC_FIXED size must be constant"); \
+    static __thread struct mp_fixed_class __mp_fixed_cache;                         \
+    mp_fixed_alloc((mh), (size), &__mp_fixed_cache);                                \
+})
 
 #ifdef __cplusplus
 }
+
+template <size_t N>
+static inline void *mp_alloc_fixed(struct mp_handle* mh)
+{
+    static thread_local struct mp_fixed_class cache;
+    return mp_fixed_alloc(mh, N, &cache);
+}
 #endif
 
 #endif
@@ -0,0 +1,251 @@
+/**
+ * \brief mpmalloc 的 C++ 封装（仅头文件）
+ *      mp::allocator<T>        STL 兼容分配器，绑定一个 mp_handle，可用于 vector/map/unordered_map 等容器
+ *      mp::memory_resource     std::pmr::memory_resource 实现（C++17 且存在 <memory_resource> 时提供）
+ *      mp::unique_ptr/make_unique  使用无状态删除器的智能指针，句柄通过 Tag 类型在编译期绑定
+ *  注意：
+ *      1.mp_malloc 只保证 MP_MALLOC_MIN_ALIGN（8字节）对齐，超过的对齐要求（long double、SSE类型、
+ *        alignas(16) 等）多申请一段再对齐；
+ *      2.释放时带上申请大小走 mp_free_sized，默认方法据此校验大小和指针是否匹配；
+ *      3.unique_ptr 之间转换只支持单继承（指针值不变），且派生类和基类大小、对齐相同、基类有虚析构，
+ *        否则删除器按基类释放会用错大小和对齐，编译期拒绝。
+ */
+#ifndef MPMALLOC_HPP_
+#define MPMALLOC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define MP_CXX_HAS_PMR 1
+#endif
+#endif
+
+#include "mpmalloc.h"
+
+namespace mp {
+
+namespace detail {
+
+/* 对齐要求不超过所有方法都保证的对齐时，直接使用 mp_malloc，保证容器节点落到对应 size 的内存池里 */
+constexpr bool is_over_aligned(std::size_t alignment) noexcept
+{
+    return alignment > MP_MALLOC_MIN_ALIGN;
+}
+
+inline void *allocate(struct mp_handle *mh, std::size_t bytes, std::size_t alignment) noexcept
+{
+    std::uintptr_t aligned;
+    char *raw;
+
+    if (!is_over_aligned(alignment)) {
+        return mp_malloc(mh, bytes);
+    }
+    if (bytes > SIZE_MAX - alignment - sizeof(void *)) {
+        return nullptr;
+    }
+    raw = static_cast<char *>(mp_malloc(mh, bytes + alignment + sizeof(void *)));
+    if (!raw) {
+        return nullptr;
+    }
+    /* 原始指针保存在对齐地址的前面，释放时取回 */
+    aligned = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void *) + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+    reinterpret_cast<void **>(aligned)[-1] = raw;
+    return reinterpret_cast<void *>(aligned);
+}
+
+inline void deallocate(struct mp_handle *mh, void *p, std::size_t bytes, std::size_t alignment) noexcept
+{
+    if (!p) {
+        return;
+    }
+    if (!is_over_aligned(alignment)) {
+        mp_free_sized(mh, p, bytes);
+        return;
+    }
+    mp_free_sized(mh, static_cast<void **>(p)[-1], bytes + alignment + sizeof(void *));
+}
+
+} /* namespace detail */
+
+/**
+ * \brief STL 兼容分配器，持有 mp_handle 指针，可跨线程共享.
+ */
+template <class T>
+class allocator {
+public:
+    typedef T value_type;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    template <class U>
+    struct rebind {
+        typedef allocator<U> other;
+    };
+
+    explicit allocator(struct mp_handle *mh) noexcept : mh_(mh) {}
+
+    template <class U>
+    allocator(const allocator<U> &other) noexcept : mh_(other.handle()) {}
+
+    T *allocate(std::size_t n)
+    {
+        void *p;
+
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        p = detail::allocate(mh_, n * sizeof(T), alignof(T));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept
+    {
+        detail::deallocate(mh_, p, n * sizeof(T), alignof(T));
+    }
+
+    struct mp_handle *handle() const noexcept
+    {
+        return mh_;
+    }
+
+private:
+    struct mp_handle *mh_;
+};
+
+template <class T, class U>
+inline bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.handle() == b.handle();
+}
+
+template <class T, class U>
+inline bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.handle() != b.handle();
+}
+
+#ifdef MP_CXX_HAS_PMR
+/**
+ * \brief 绑定 mp_handle 的 pmr 内存资源，同一句柄的两个实例视为相等.
+ */
+class memory_resource : public std::pmr::memory_resource {
+public:
+    explicit memory_resource(struct mp_handle *mh) noexcept : mh_(mh) {}
+
+    struct mp_handle *handle() const noexcept
+    {
+        return mh_;
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *p = detail::allocate(mh_, bytes, alignment);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+    {
+        detail::deallocate(mh_, p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const memory_resource *o = dynamic_cast<const memory_resource *>(&other);
+        return o && o->mh_ == mh_;
+    }
+
+    struct mp_handle *mh_;
+};
+#endif
+
+/**
+ * \brief 句柄槽位，每个 Tag 类型对应一个进程级 mp_handle，供无状态删除器使用.
+ *  在创建第一个对象前调用 mp::bind<Tag>(mh) 绑定，销毁句柄前需释放该 Tag 下所有对象.
+ */
+struct default_tag {};
+
+template <class Tag = default_tag>
+struct handle_slot {
+    static struct mp_handle *&get() noexcept
+    {
+        static struct mp_handle *mh = nullptr;
+        return mh;
+    }
+};
+
+template <class Tag = default_tag>
+inline void bind(struct mp_handle *mh) noexcept
+{
+    handle_slot<Tag>::get() = mh;
+}
+
+/**
+ * \brief 无状态删除器，unique_ptr 大小与裸指针一致.
+ */
+template <class T, class Tag = default_tag>
+struct deleter {
+    static_assert(!std::is_array<T>::value, "mp::deleter does not support arrays");
+
+    constexpr deleter() noexcept = default;
+
+    /* 按T释放和按U释放必须完全一致，否则需要在删除器里携带大小和对齐 */
+    template <class U, class = typename std::enable_if<std::is_convertible<U *, T *>::value &&
+                                                       sizeof(U) == sizeof(T) && alignof(U) == alignof(T) &&
+                                                       (std::is_same<typename std::remove_cv<U>::type,
+                                                                     typename std::remove_cv<T>::type>::value ||
+                                                        std::has_virtual_destructor<T>::value)>::type>
+    deleter(const deleter<U, Tag> &) noexcept {}
+
+    void operator()(T *p) const noexcept
+    {
+        if (!p) {
+            return;
+        }
+        p->~T();
+        detail::deallocate(handle_slot<Tag>::get(), const_cast<typename std::remove_cv<T>::type *>(p),
+                           sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class Tag = default_tag>
+using unique_ptr = std::unique_ptr<T, deleter<T, Tag> >;
+
+template <class T, class Tag = default_tag, class... Args>
+inline unique_ptr<T, Tag> make_unique(Args &&...args)
+{
+    void *p;
+
+    static_assert(!std::is_array<T>::value, "mp::make_unique does not support arrays");
+    p = detail::allocate(handle_slot<Tag>::get(), sizeof(T), alignof(T));
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    try {
+        return unique_ptr<T, Tag>(::new (p) T(std::forward<Args>(args)...));
+    } catch (...) {
+        detail::deallocate(handle_slot<Tag>::get(), p, sizeof(T), alignof(T));
+        throw;
+    }
+}
+
+} /* namespace mp */
+
+#endif
@@ -0,0 +1,291 @@
+#include "mpmalloc.h"
+#include "mpmalloc_arena_imp.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_arena_calloc
+#define mp_arena_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_arena_malloc
+#define mp_arena_malloc(Z) malloc(Z)
+#endif
+#ifndef mp_arena_free
+#define mp_arena_free(P) free(P)
+#endif
+
+/*
+ * 区域（bump-pointer）分配方法
+ *   分配只移动当前块的游标，释放为空操作，mp_reset 一次性归还所有分配；
+ *   适用于生命周期一致的大量小内存分配（例如单个请求的解析过程）。
+ *   块大小取分配单元描述的总容量，限制在[MIN, MAX]之间。
+ */
+#define MP_ARENA_ALIGN          sizeof(void *)
+#define MP_ARENA_MIN_CHUNK      (64 * 1024)
+#define MP_ARENA_MAX_CHUNK      (64 * 1024 * 1024)
+
+/* 超过块大小的该比例时单独分配一个块，不打断当前块的游标 */
+#define MP_ARENA_LARGE_DIV      4
+
+#define MP_ARENA_ALIGN_UP(x)    (((x) + MP_ARENA_ALIGN - 1) & ~(MP_ARENA_ALIGN - 1))
+
+struct mp_arena_chunk
+{
+    struct mp_arena_chunk   *next;
+    char                    *pos;
+    char                    *end;
+    char                    *last;      /* 最近一次分配的元数据头，用于原地realloc */
+    char                    data[0];
+};
+
+/* 每次分配的元数据头，记录申请大小，realloc时拷贝使用 */
+struct mp_arena_head
+{
+    size_t                  size;
+};
+
+struct mp_arena_imp
+{
+    pthread_mutex_t         lck;
+    size_t                  chunk_size;
+    struct mp_arena_chunk   *first;     /* 第一个块在reset后保留 */
+    struct mp_arena_chunk   *cur;
+};
+
+static struct mp_arena_chunk *mp_arena_chunk_new(size_t data_size)
+{
+    struct mp_arena_chunk *chunk;
+
+    chunk = mp_arena_malloc(sizeof(struct mp_arena_chunk) + data_size);
+    if (!chunk) {
+        MP_LOG_ERROR("mp_arena_malloc fail, size[%lu].", data_size);
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->pos = chunk->data;
+    chunk->end = chunk->data + data_size;
+    chunk->last = NULL;
+    return chunk;
+}
+
+void *mp_arena_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr)
+{
+    int i;
+    size_t total = 0;
+    struct mp_arena_imp *imp;
+
+    if (!arr) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    (void)attr;
+
+    imp = mp_arena_calloc(1, sizeof(struct mp_arena_imp));
+    if (!imp) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    if (pthread_mutex_init(&imp->lck, NULL) != 0) {
+        MP_LOG_ERROR("pthread_mutex_init fail.");
+        mp_arena_free(imp);
+        return NULL;
+    }
+
+    for (i = 0; i < arr_num; i++) {
+        total += (MP_ARENA_ALIGN_UP(arr[i].size) + sizeof(struct mp_arena_head)) * (arr[i].capacity > 0 ? arr[i].capacity : 1);
+    }
+    if (total < MP_ARENA_MIN_CHUNK) {
+        total = MP_ARENA_MIN_CHUNK;
+    } else if (total > MP_ARENA_MAX_CHUNK) {
+        total = MP_ARENA_MAX_CHUNK;
+    }
+    imp->chunk_size = total;
+
+    imp->first = mp_arena_chunk_new(imp->chunk_size);
+    if (!imp->first) {
+        mp_arena_destroy_imp(imp);
+        return NULL;
+    }
+    imp->cur = imp->first;
+    MP_LOG_DEBUG("arena chunk size [%luKB].", imp->chunk_size/1024);
+    return imp;
+}
+
+static void mp_arena_release(struct mp_arena_imp *imp, struct mp_arena_chunk *chunk)
+{
+    struct mp_arena_chunk *next;
+
+    /* 内部接口，避免重复校验，入参由调用者校验 */
+    while (chunk) {
+        next = chunk->next;
+        mp_arena_free(chunk);
+        chunk = next;
+    }
+    (void)imp;
+}
+
+void mp_arena_destroy_imp(void* mh)
+{
+    struct mp_arena_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_arena_imp *)mh;
+    mp_arena_release(imp, imp->first);
+    pthread_mutex_destroy(&imp->lck);
+    mp_arena_free(imp);
+}
+
+int mp_arena_reset_imp(void* mh)
+{
+    struct mp_arena_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_arena_imp *)mh;
+    pthread_mutex_lock(&imp->lck);
+    mp_arena_release(imp, imp->first->next);
+    imp->first->next = NULL;
+    imp->first->pos = imp->first->data;
+    imp->first->last = NULL;
+    imp->cur = imp->first;
+    pthread_mutex_unlock(&imp->lck);
+    return MP_OK;
+}
+
+static void *mp_arena_bump(struct mp_arena_chunk *chunk, size_t need)
+{
+    struct mp_arena_head *head;
+
+    /* 内部接口，避免重复校验，入参由调用者校验 */
+    /* 记录对齐后的大小，对齐补齐的部分业务也可以使用 */
+    head = (struct mp_arena_head *)chunk->pos;
+    head->size = need - sizeof(struct mp_arena_head);
+    chunk->last = chunk->pos;
+    chunk->pos += need;
+    return head + 1;
+}
+
+void *mp_arena_alloc_imp(void* mh, size_t size)
+{
+    size_t need;
+    void *ptr;
+    struct mp_arena_imp *imp;
+    struct mp_arena_chunk *chunk;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (size > SIZE_MAX - sizeof(struct mp_arena_head) - MP_ARENA_ALIGN) {
+        MP_LOG_ERROR("size[%lu] too large.", size);
+        return NULL;
+    }
+    imp = (struct mp_arena_imp *)mh;
+    need = sizeof(struct mp_arena_head) + MP_ARENA_ALIGN_UP(size);
+
+    pthread_mutex_lock(&imp->lck);
+    chunk = imp->cur;
+    if ((size_t)(chunk->end - chunk->pos) >= need) {
+        ptr = mp_arena_bump(chunk, need);
+        pthread_mutex_unlock(&imp->lck);
+        return ptr;
+    }
+
+    if (need > imp->chunk_size / MP_ARENA_LARGE_DIV) {
+        /* 大块单独分配，挂在当前块后面，当前块继续使用 */
+        chunk = mp_arena_chunk_new(need);
+        if (chunk) {
+            chunk->next = imp->cur->next;
+            imp->cur->next = chunk;
+        }
+    } else {
+        chunk = mp_arena_chunk_new(imp->chunk_size);
+        if (chunk) {
+            chunk->next = imp->cur->next;
+            imp->cur->next = chunk;
+            imp->cur = chunk;
+        }
+    }
+    if (!chunk) {
+        pthread_mutex_unlock(&imp->lck);
+        return NULL;
+    }
+    ptr = mp_arena_bump(chunk, need);
+    pthread_mutex_unlock(&imp->lck);
+    return ptr;
+}
+
+void *mp_arena_realloc_imp(void* mh, void *mem, size_t newsize)
+{
+    size_t need;
+    struct mp_arena_imp *imp;
+    struct mp_arena_head *head;
+    struct mp_arena_chunk *chunk;
+    void *new_mem;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (!mem) {
+        return mp_arena_alloc_imp(mh, newsize);
+    }
+    if (newsize == 0) {
+        return NULL;
+    }
+
+    imp = (struct mp_arena_imp *)mh;
+    head = (struct mp_arena_head *)mem - 1;
+    if (newsize <= head->size) {
+        return mem;
+    }
+
+    /* 最近一次分配且块内剩余空间足够，则原地扩展 */
+    pthread_mutex_lock(&imp->lck);
+    chunk = imp->cur;
+    if (chunk->last == (char *)head && newsize <= SIZE_MAX - sizeof(struct mp_arena_head) - MP_ARENA_ALIGN) {
+        need = sizeof(struct mp_arena_head) + MP_ARENA_ALIGN_UP(newsize);
+        if ((size_t)(chunk->end - chunk->last) >= need) {
+            chunk->pos = chunk->last + need;
+            head->size = need - sizeof(struct mp_arena_head);
+            pthread_mutex_unlock(&imp->lck);
+            return mem;
+        }
+    }
+    pthread_mutex_unlock(&imp->lck);
+
+    new_mem = mp_arena_alloc_imp(mh, newsize);
+    if (!new_mem) {
+        return NULL;
+    }
+    memcpy(new_mem, mem, head->size);
+    return new_mem;
+}
+
+void mp_arena_free_imp(void* mh, void *mem)
+{
+    /* 单个释放为空操作，统一由 mp_reset 归还 */
+    (void)mh;
+    (void)mem;
+}
+
+size_t mp_arena_usable_size_imp(void* mh, const void *mem)
+{
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return 0;
+    }
+    return ((const struct mp_arena_head *)mem - 1)->size;
+}
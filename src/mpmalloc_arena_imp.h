@@ -0,0 +1,22 @@
+#ifndef MPMALLOC_ARENA_IMP_H_
+#define MPMALLOC_ARENA_IMP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mp_unit;
+struct mp_attr;
+void *mp_arena_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr);
+void *mp_arena_alloc_imp(void* mh, size_t size);
+void *mp_arena_realloc_imp(void* mh, void *mem, size_t newsize);
+void mp_arena_free_imp(void* mh, void *mem);
+void mp_arena_destroy_imp(void* mh);
+int mp_arena_reset_imp(void* mh);
+size_t mp_arena_usable_size_imp(void* mh, const void *mem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,561 @@
+#include "mpmalloc.h"
+#include "mpmalloc_buddy_imp.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_buddy_calloc
+#define mp_buddy_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_buddy_malloc
+#define mp_buddy_malloc(Z) malloc(Z)
+#endif
+#ifndef mp_buddy_free
+#define mp_buddy_free(P) free(P)
+#endif
+
+/*
+ * 伙伴分配方法
+ *   每个区域是2的幂大小的连续内存，按阶拆分和合并，块大小为 MIN_BLOCK << order；
+ *   每阶一个空闲链表，区域内用阶位图记录非空链表，用每阶的块位图记录空闲块，合并时O(1)判断伙伴；
+ *   区域耗尽时新增区域，超过区域大小的请求走普通分配。
+ *   锁定模式（MP_ATTR_F_PINNED）下区域预先缺页并mlock，空闲后也不归还，区域下标在句柄生命周期内不变，
+ *   可以直接作为io_uring的固定缓冲区注册；不退回普通分配，区域不够时返回NULL。
+ */
+#define MP_BUDDY_MIN_BLOCK_LOG2     5
+#define MP_BUDDY_MIN_BLOCK          (1UL << MP_BUDDY_MIN_BLOCK_LOG2)
+#define MP_BUDDY_MAX_ORDER          30
+
+/* 区域大小：分配单元总容量的两倍向上取2的幂 */
+#define MP_BUDDY_REGION_FACTOR      2
+#define MP_BUDDY_REGION_MIN         (1UL << 20)
+#define MP_BUDDY_REGION_MAX         (1UL << 28)
+#define MP_BUDDY_MAX_REGION_NUM     16
+
+/* 超过区域大小的分配标记 */
+#define MP_BUDDY_LARGE_ORDER        0xff
+#define MP_BUDDY_MAGIC              0x5a5b5c5d
+
+#define MP_BUDDY_BITS_PER_WORD      (sizeof(unsigned long) * 8)
+
+struct mp_buddy_head
+{
+    unsigned int        magic;
+    unsigned char       order;
+    unsigned char       region_id;
+    unsigned short      reserved;
+    size_t              size;       /* 普通分配时记录大小 */
+};
+
+struct mp_buddy_block
+{
+    struct mp_buddy_head    head;
+    struct mp_buddy_block   *next;  /* 以下两项只在空闲时有效 */
+    struct mp_buddy_block   *prev;
+};
+
+struct mp_buddy_region
+{
+    char                    *base;
+    size_t                  size;
+    size_t                  avail;
+    int                     id;
+    unsigned long           order_map;                          /* 非空空闲链表的阶位图 */
+    struct mp_buddy_block   *free_list[MP_BUDDY_MAX_ORDER + 1];
+    unsigned long           *free_map[MP_BUDDY_MAX_ORDER + 1];  /* 每阶的空闲块位图 */
+};
+
+struct mp_buddy_imp
+{
+    pthread_mutex_t         lck;
+    size_t                  region_size;
+    int                     max_order;
+    int                     pinned;
+    struct mp_buddy_region  *regions[MP_BUDDY_MAX_REGION_NUM];
+};
+
+static inline size_t mp_buddy_block_size(int order)
+{
+    return MP_BUDDY_MIN_BLOCK << order;
+}
+
+static inline size_t mp_buddy_index(const struct mp_buddy_region *region, const void *block, int order)
+{
+    return (size_t)((const char *)block - region->base) >> (order + MP_BUDDY_MIN_BLOCK_LOG2);
+}
+
+static inline int mp_buddy_test_free(const struct mp_buddy_region *region, size_t idx, int order)
+{
+    return (int)((region->free_map[order][idx / MP_BUDDY_BITS_PER_WORD] >> (idx % MP_BUDDY_BITS_PER_WORD)) & 1UL);
+}
+
+static void mp_buddy_list_add(struct mp_buddy_region *region, struct mp_buddy_block *block, int order)
+{
+    size_t idx = mp_buddy_index(region, block, order);
+
+    block->head.magic = MP_BUDDY_MAGIC;
+    block->head.order = (unsigned char)order;
+    block->head.region_id = (unsigned char)region->id;
+    block->prev = NULL;
+    block->next = region->free_list[order];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    region->free_list[order] = block;
+    region->order_map |= (1UL << order);
+    region->free_map[order][idx / MP_BUDDY_BITS_PER_WORD] |= (1UL << (idx % MP_BUDDY_BITS_PER_WORD));
+}
+
+static void mp_buddy_list_del(struct mp_buddy_region *region, struct mp_buddy_block *block, int order)
+{
+    size_t idx = mp_buddy_index(region, block, order);
+
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        region->free_list[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    if (!region->free_list[order]) {
+        region->order_map &= ~(1UL << order);
+    }
+    region->free_map[order][idx / MP_BUDDY_BITS_PER_WORD] &= ~(1UL << (idx % MP_BUDDY_BITS_PER_WORD));
+}
+
+static void mp_buddy_region_destroy(struct mp_buddy_region *region)
+{
+    int i;
+
+    if (!region) {
+        return;
+    }
+    for (i = 0; i <= MP_BUDDY_MAX_ORDER; i++) {
+        if (region->free_map[i]) {
+            mp_buddy_free(region->free_map[i]);
+        }
+    }
+    if (region->base) {
+        munmap(region->base, region->size);
+    }
+    mp_buddy_free(region);
+}
+
+static struct mp_buddy_region *mp_buddy_region_create(int id, size_t size, int max_order, int pinned)
+{
+    int i;
+    size_t blocks;
+    struct mp_buddy_region *region;
+
+    region = mp_buddy_calloc(1, sizeof(struct mp_buddy_region));
+    if (!region) {
+        MP_LOG_ERROR("calloc region fail.");
+        return NULL;
+    }
+    region->id = id;
+    region->size = size;
+    for (i = 0; i <= max_order; i++) {
+        blocks = size >> (i + MP_BUDDY_MIN_BLOCK_LOG2);
+        region->free_map[i] = mp_buddy_calloc((blocks + MP_BUDDY_BITS_PER_WORD - 1) / MP_BUDDY_BITS_PER_WORD,
+                                                sizeof(unsigned long));
+        if (!region->free_map[i]) {
+            MP_LOG_ERROR("calloc free map fail, order[%d].", i);
+            goto fail;
+        }
+    }
+    region->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region->base == MAP_FAILED) {
+        MP_LOG_ERROR("mmap region fail, size[%lu].", size);
+        region->base = NULL;
+        goto fail;
+    }
+    if (pinned && mlock(region->base, size) != 0) {
+        /* 通常是RLIMIT_MEMLOCK不够，锁定模式下不能退化成普通内存 */
+        MP_LOG_ERROR("mlock region fail, size[%lu], check RLIMIT_MEMLOCK.", size);
+        goto fail;
+    }
+    region->avail = size;
+    mp_buddy_list_add(region, (struct mp_buddy_block *)region->base, max_order);
+    return region;
+fail:
+    mp_buddy_region_destroy(region);
+    return NULL;
+}
+
+void *mp_buddy_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr)
+{
+    int i;
+    size_t total = 0;
+    struct mp_buddy_imp *imp;
+
+    if (!arr) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    imp = mp_buddy_calloc(1, sizeof(struct mp_buddy_imp));
+    if (!imp) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    imp->pinned = (attr && (attr->flags & MP_ATTR_F_PINNED)) ? 1 : 0;
+    if (pthread_mutex_init(&imp->lck, NULL) != 0) {
+        MP_LOG_ERROR("pthread_mutex_init fail.");
+        mp_buddy_free(imp);
+        return NULL;
+    }
+
+    for (i = 0; i < arr_num; i++) {
+        total += (arr[i].size + sizeof(struct mp_buddy_head)) * (arr[i].capacity > 0 ? arr[i].capacity : 1);
+    }
+    total *= MP_BUDDY_REGION_FACTOR;
+    imp->region_size = MP_BUDDY_REGION_MIN;
+    while (imp->region_size < total && imp->region_size < MP_BUDDY_REGION_MAX) {
+        imp->region_size <<= 1;
+    }
+    imp->max_order = __builtin_ctzl(imp->region_size) - MP_BUDDY_MIN_BLOCK_LOG2;
+
+    imp->regions[0] = mp_buddy_region_create(0, imp->region_size, imp->max_order, imp->pinned);
+    if (!imp->regions[0]) {
+        mp_buddy_destroy_imp(imp);
+        return NULL;
+    }
+    MP_LOG_DEBUG("buddy region size [%luKB], max order [%d].", imp->region_size/1024, imp->max_order);
+    return imp;
+}
+
+void mp_buddy_destroy_imp(void* mh)
+{
+    int i;
+    struct mp_buddy_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_buddy_imp *)mh;
+    for (i = 0; i < MP_BUDDY_MAX_REGION_NUM; i++) {
+        mp_buddy_region_destroy(imp->regions[i]);
+        imp->regions[i] = NULL;
+    }
+    pthread_mutex_destroy(&imp->lck);
+    mp_buddy_free(imp);
+}
+
+static inline int mp_buddy_size_order(size_t total_size)
+{
+    int order = 0;
+
+    if (total_size > MP_BUDDY_MIN_BLOCK) {
+        order = (int)(sizeof(size_t) * 8) - __builtin_clzl(total_size - 1) - MP_BUDDY_MIN_BLOCK_LOG2;
+    }
+    return order;
+}
+
+/* 从区域中取出order阶的块，必要时拆分高阶块；调用者持有锁 */
+static struct mp_buddy_block *mp_buddy_region_get(struct mp_buddy_region *region, int order)
+{
+    int cur;
+    unsigned long map;
+    struct mp_buddy_block *block;
+
+    map = region->order_map & (~0UL << order);
+    if (!map) {
+        return NULL;
+    }
+    cur = __builtin_ctzl(map);
+    block = region->free_list[cur];
+    mp_buddy_list_del(region, block, cur);
+    while (cur > order) {
+        cur--;
+        mp_buddy_list_add(region, (struct mp_buddy_block *)((char *)block + mp_buddy_block_size(cur)), cur);
+    }
+    block->head.magic = MP_BUDDY_MAGIC;
+    block->head.order = (unsigned char)order;
+    block->head.region_id = (unsigned char)region->id;
+    region->avail -= mp_buddy_block_size(order);
+    return block;
+}
+
+/* 归还order阶的块并和空闲伙伴逐级合并；调用者持有锁 */
+static void mp_buddy_region_put(struct mp_buddy_region *region, struct mp_buddy_block *block, int order, int max_order)
+{
+    size_t idx;
+    struct mp_buddy_block *buddy;
+
+    region->avail += mp_buddy_block_size(order);
+    while (order < max_order) {
+        idx = mp_buddy_index(region, block, order);
+        if (!mp_buddy_test_free(region, idx ^ 1, order)) {
+            break;
+        }
+        buddy = (struct mp_buddy_block *)(region->base + ((idx ^ 1) << (order + MP_BUDDY_MIN_BLOCK_LOG2)));
+        mp_buddy_list_del(region, buddy, order);
+        if (buddy < block) {
+            block = buddy;
+        }
+        order++;
+    }
+    mp_buddy_list_add(region, block, order);
+}
+
+static void *mp_buddy_large_alloc(size_t size)
+{
+    struct mp_buddy_head *head;
+
+    head = mp_buddy_malloc(sizeof(struct mp_buddy_head) + size);
+    if (!head) {
+        MP_LOG_ERROR("mp_buddy_malloc fail, size[%lu].", size);
+        return NULL;
+    }
+    head->magic = MP_BUDDY_MAGIC;
+    head->order = MP_BUDDY_LARGE_ORDER;
+    head->region_id = 0;
+    head->size = size;
+    return head + 1;
+}
+
+void *mp_buddy_alloc_imp(void* mh, size_t size)
+{
+    int i;
+    int order;
+    struct mp_buddy_imp *imp;
+    struct mp_buddy_block *block = NULL;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    imp = (struct mp_buddy_imp *)mh;
+    if (size > imp->region_size - sizeof(struct mp_buddy_head)) {
+        return imp->pinned ? NULL : mp_buddy_large_alloc(size);
+    }
+    order = mp_buddy_size_order(size + sizeof(struct mp_buddy_head));
+
+    pthread_mutex_lock(&imp->lck);
+    for (i = 0; i < MP_BUDDY_MAX_REGION_NUM && !block; i++) {
+        if (imp->regions[i]) {
+            block = mp_buddy_region_get(imp->regions[i], order);
+        }
+    }
+    /* 所有区域都不满足，新增区域 */
+    for (i = 0; i < MP_BUDDY_MAX_REGION_NUM && !block; i++) {
+        if (imp->regions[i]) {
+            continue;
+        }
+        imp->regions[i] = mp_buddy_region_create(i, imp->region_size, imp->max_order, imp->pinned);
+        if (!imp->regions[i]) {
+            break;
+        }
+        block = mp_buddy_region_get(imp->regions[i], order);
+    }
+    pthread_mutex_unlock(&imp->lck);
+
+    if (!block) {
+        return imp->pinned ? NULL : mp_buddy_large_alloc(size);
+    }
+    return &block->head + 1;
+}
+
+static struct mp_buddy_head *mp_buddy_head_get(void *mem)
+{
+    struct mp_buddy_head *head = (struct mp_buddy_head *)mem - 1;
+
+    if (head->magic != MP_BUDDY_MAGIC) {
+        MP_LOG_ERROR("ptr[%p] magic invalid, maybe not valid memery for mp.", mem);
+        abort();
+    }
+    return head;
+}
+
+void mp_buddy_free_imp(void* mh, void *mem)
+{
+    int id;
+    struct mp_buddy_imp *imp;
+    struct mp_buddy_head *head;
+    struct mp_buddy_region *region;
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_buddy_imp *)mh;
+    head = mp_buddy_head_get(mem);
+    if (head->order == MP_BUDDY_LARGE_ORDER) {
+        mp_buddy_free(head);
+        return;
+    }
+
+    pthread_mutex_lock(&imp->lck);
+    id = head->region_id;
+    region = imp->regions[id];
+    mp_buddy_region_put(region, (struct mp_buddy_block *)head, head->order, imp->max_order);
+    /* 动态区域完全空闲则归还系统，锁定模式下保留，已注册的缓冲区下标不能失效 */
+    if (id != 0 && !imp->pinned && region->avail == region->size) {
+        imp->regions[id] = NULL;
+        mp_buddy_region_destroy(region);
+    }
+    pthread_mutex_unlock(&imp->lck);
+}
+
+/* 原地调整块大小：缩小时拆出右半部分，扩大时吸收空闲的右伙伴；调用者持有锁 */
+static int mp_buddy_resize(struct mp_buddy_imp *imp, struct mp_buddy_head *head, int order)
+{
+    int cur;
+    size_t idx;
+    int need;
+    struct mp_buddy_region *region = imp->regions[head->region_id];
+
+    cur = head->order;
+    while (cur > order) {
+        cur--;
+        region->avail += mp_buddy_block_size(cur);
+        mp_buddy_list_add(region, (struct mp_buddy_block *)((char *)head + mp_buddy_block_size(cur)), cur);
+    }
+    /* 先确认每一级的右伙伴都空闲，避免吸收一半后失败 */
+    for (need = cur; need < order; need++) {
+        idx = mp_buddy_index(region, head, need);
+        if ((idx & 1) || !mp_buddy_test_free(region, idx ^ 1, need)) {
+            return MP_ERR;
+        }
+    }
+    while (cur < order) {
+        idx = mp_buddy_index(region, head, cur);
+        mp_buddy_list_del(region, (struct mp_buddy_block *)(region->base + ((idx ^ 1) << (cur + MP_BUDDY_MIN_BLOCK_LOG2))), cur);
+        region->avail -= mp_buddy_block_size(cur);
+        cur++;
+    }
+    head->magic = MP_BUDDY_MAGIC;
+    head->order = (unsigned char)order;
+    return MP_OK;
+}
+
+void *mp_buddy_realloc_imp(void* mh, void *mem, size_t newsize)
+{
+    int rc;
+    int order;
+    size_t old_size;
+    struct mp_buddy_imp *imp;
+    struct mp_buddy_head *head;
+    void *new_mem;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (!mem) {
+        return mp_buddy_alloc_imp(mh, newsize);
+    }
+    if (newsize == 0) {
+        mp_buddy_free_imp(mh, mem);
+        return NULL;
+    }
+
+    imp = (struct mp_buddy_imp *)mh;
+    head = mp_buddy_head_get(mem);
+    if (head->order == MP_BUDDY_LARGE_ORDER) {
+        old_size = head->size;
+    } else {
+        old_size = mp_buddy_block_size(head->order) - sizeof(struct mp_buddy_head);
+        if (newsize <= imp->region_size - sizeof(struct mp_buddy_head)) {
+            order = mp_buddy_size_order(newsize + sizeof(struct mp_buddy_head));
+            pthread_mutex_lock(&imp->lck);
+            rc = mp_buddy_resize(imp, head, order);
+            pthread_mutex_unlock(&imp->lck);
+            if (rc == MP_OK) {
+                return mem;
+            }
+        }
+    }
+
+    new_mem = mp_buddy_alloc_imp(mh, newsize);
+    if (!new_mem) {
+        return NULL;
+    }
+    memcpy(new_mem, mem, old_size < newsize ? old_size : newsize);
+    mp_buddy_free_imp(mh, mem);
+    return new_mem;
+}
+
+size_t mp_buddy_usable_size_imp(void* mh, const void *mem)
+{
+    struct mp_buddy_head *head;
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return 0;
+    }
+    head = mp_buddy_head_get((void *)mem);
+    if (head->order == MP_BUDDY_LARGE_ORDER) {
+        return head->size;
+    }
+    return mp_buddy_block_size(head->order) - sizeof(struct mp_buddy_head);
+}
+
+int mp_buddy_regions_imp(void* mh, struct iovec *iov, int iov_num)
+{
+    int i;
+    int num = 0;
+    struct mp_buddy_imp *imp;
+
+    if (!mh || (!iov && iov_num > 0)) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_buddy_imp *)mh;
+    if (!imp->pinned) {
+        MP_LOG_ERROR("handle not pinned.");
+        return MP_ERR;
+    }
+    /* 锁定模式下区域只增不减且总是占用第一个空位，下标连续 */
+    pthread_mutex_lock(&imp->lck);
+    for (i = 0; i < MP_BUDDY_MAX_REGION_NUM && imp->regions[i]; i++) {
+        if (num < iov_num) {
+            iov[num].iov_base = imp->regions[i]->base;
+            iov[num].iov_len = imp->regions[i]->size;
+        }
+        num++;
+    }
+    pthread_mutex_unlock(&imp->lck);
+    return num;
+}
+
+int mp_buddy_region_index_imp(void* mh, const void *mem, size_t *offset)
+{
+    int i;
+    struct mp_buddy_imp *imp;
+    struct mp_buddy_region *region;
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_buddy_imp *)mh;
+    if (!imp->pinned) {
+        MP_LOG_ERROR("handle not pinned.");
+        return MP_ERR;
+    }
+    /* 按地址范围查找，缓冲区内部的指针也可以转换 */
+    pthread_mutex_lock(&imp->lck);
+    for (i = 0; i < MP_BUDDY_MAX_REGION_NUM && imp->regions[i]; i++) {
+        region = imp->regions[i];
+        if ((const char *)mem >= region->base && (const char *)mem < region->base + region->size) {
+            if (offset) {
+                *offset = (size_t)((const char *)mem - region->base);
+            }
+            pthread_mutex_unlock(&imp->lck);
+            return i;
+        }
+    }
+    pthread_mutex_unlock(&imp->lck);
+    return MP_ERR;
+}
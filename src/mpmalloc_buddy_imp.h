@@ -0,0 +1,24 @@
+#ifndef MPMALLOC_BUDDY_IMP_H_
+#define MPMALLOC_BUDDY_IMP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mp_unit;
+struct mp_attr;
+struct iovec;
+void *mp_buddy_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr);
+void *mp_buddy_alloc_imp(void* mh, size_t size);
+void *mp_buddy_realloc_imp(void* mh, void *mem, size_t newsize);
+void mp_buddy_free_imp(void* mh, void *mem);
+void mp_buddy_destroy_imp(void* mh);
+size_t mp_buddy_usable_size_imp(void* mh, const void *mem);
+int mp_buddy_regions_imp(void* mh, struct iovec *iov, int iov_num);
+int mp_buddy_region_index_imp(void* mh, const void *mem, size_t *offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef MPMALLOC_HARDEN_H_
+#define MPMALLOC_HARDEN_H_
+
+#include <stdlib.h>
+#include <assert.h>
+
+/*
+ * 加固级别，编译时通过 MPM_HARDEN_LEVEL 选择（定义MP_HARDEN_LEVEL）
+ *   0：发布，分配和释放路径上不做任何逐次校验（magic、空指针、断言）
+ *   1：默认，校验元数据magic，非法指针abort
+ *   2：调试，在1的基础上增加前后保护字节、释放投毒、重复释放检测和释放隔离区，
+ *      隔离区满时才真正归还，并检查投毒是否被改写（释放后写）
+ */
+#ifndef MP_HARDEN_LEVEL
+#define MP_HARDEN_LEVEL         1
+#endif
+
+#if MP_HARDEN_LEVEL >= 1
+#define MP_HARDEN_ASSERT(cond)  assert(cond)
+/* 校验失败直接abort，不返回 */
+#define MP_HARDEN_CHECK(cond)   do { if (!(cond)) { abort(); } } while (0)
+#else
+#define MP_HARDEN_ASSERT(cond)  ((void)0)
+#define MP_HARDEN_CHECK(cond)   ((void)0)
+#endif
+
+#define MP_HARDEN_DEBUG         (MP_HARDEN_LEVEL >= 2)
+
+/* 调试级别使用的填充值 */
+#define MP_HARDEN_GUARD_BYTE    0xfd    /* 保护字节 */
+#define MP_HARDEN_POISON_BYTE   0xdd    /* 释放后投毒 */
+#define MP_HARDEN_GUARD_SIZE    8
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* sched_getcpu */
+#endif
 #include "mpmalloc.h"
 #include "mpmalloc_hash_imp.h"
 
@@ -5,12 +8,25 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <malloc.h>
 
 #include <pthread.h>
-
+#include <sched.h>
+#include <unistd.h>
+
+#include "mpmalloc_hist.h"
+#include "queue.h"
+#include "mpmalloc_prof.h"
+#include "mpmalloc_trace.h"
+#include "mpmalloc_harden.h"
+#include "mpmalloc_pageheap.h"
+
+#ifdef MP_HASH_MEMPOOL_BITMAP
+#include "mempool_bitmap.h"
+#else
 #include "mempool.h"
+#endif
 
-#define MP_HASH_ASSERT   assert
 #define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
 #define MP_LOG_WARN(format, arg...) printf("WARN [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
 //#define MP_LOG_DEBUG(format, arg...) printf("DEBUG [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
@@ -49,35 +65,157 @@ struct mp_hash_slice
     int             mempool_id;
     void            *mempool_ptr;
     void            *alloc_mem;
+    int             zero;           /* 业务数据区全为0 */
+    int             tag;            /* 0表示未打标签 */
 };
 
 PACKED_MEMORY(struct mp_mem_head
 {
     unsigned char node_id;
     unsigned char mempool_id;
-    unsigned char reserved;
+    unsigned char flags;
     unsigned char magic;
 });
 
+#define MP_MEM_F_SAMPLED    0x01    /* 被堆分析采样，释放时注销 */
+#define MP_MEM_TAG_SHIFT    1       /* flags的1~3位记录标签 */
+#define MP_MEM_TAG_MASK     0x0e
+
+#if MP_HARDEN_DEBUG
+/* 调试级别：元数据头前面再加一个调试头，数据后面加保护字节 */
+#define MP_MEM_S_USED       0x5a
+#define MP_MEM_S_FREE       0xf5
+
+PACKED_MEMORY(struct mp_mem_debug
+{
+    size_t          size;       /* 申请大小，定位尾部保护字节和投毒范围 */
+    unsigned char   state;
+    unsigned char   guard[7];   /* 前保护字节 */
+});
+#define MP_MEM_DEBUG_HEAD_SIZE  sizeof(struct mp_mem_debug)
+#define MP_MEM_DEBUG_TAIL_SIZE  MP_HARDEN_GUARD_SIZE
+#else
+#define MP_MEM_DEBUG_HEAD_SIZE  0
+#define MP_MEM_DEBUG_TAIL_SIZE  0
+#endif
+
+/* 每次分配的额外开销 */
+#define MP_MEM_OVERHEAD     (sizeof(struct mp_mem_head) + MP_MEM_DEBUG_HEAD_SIZE + MP_MEM_DEBUG_TAIL_SIZE)
+/* 业务数据区相对单元起始的偏移，内存池按该位置对齐 */
+#define MP_MEM_DATA_OFFSET  (sizeof(struct mp_mem_head) + MP_MEM_DEBUG_HEAD_SIZE)
+#define MP_MEM_DATA_ALIGN   16  /* 返回地址按max_align_t对齐 */
+/* 退回glibc的单元在malloc返回地址后留出的填充，业务数据区同样按MP_MEM_DATA_ALIGN对齐 */
+#define MP_MEM_ANY_PAD      (((MP_MEM_DATA_OFFSET + MP_MEM_DATA_ALIGN - 1) & ~(size_t)(MP_MEM_DATA_ALIGN - 1)) \
+                                - MP_MEM_DATA_OFFSET)
+
 static  inline void *mp_pack(const struct mp_hash_slice *slice)
 {
-    ((struct mp_mem_head *)slice->alloc_mem)->node_id = (unsigned char)slice->node_id;
-    ((struct mp_mem_head *)slice->alloc_mem)->mempool_id = (unsigned char)slice->mempool_id;
-    ((struct mp_mem_head *)slice->alloc_mem)->magic = MP_UNIT_MAGIC;
-    return (char*)slice->alloc_mem + sizeof(struct mp_mem_head);
+    struct mp_mem_head *head = (struct mp_mem_head *)((char *)slice->alloc_mem + MP_MEM_DEBUG_HEAD_SIZE);
+
+    head->node_id = (unsigned char)slice->node_id;
+    head->mempool_id = (unsigned char)slice->mempool_id;
+    head->flags = (unsigned char)(slice->tag << MP_MEM_TAG_SHIFT);
+    head->magic = MP_UNIT_MAGIC;
+    return (char*)head + sizeof(struct mp_mem_head);
 }
 
 static  inline struct mp_mem_head *mp_unpack(char *mem, struct mp_hash_slice *slice)
 {
-    slice->alloc_mem = (struct mp_mem_head *)(mem - sizeof(struct mp_mem_head));
-    if (((struct mp_mem_head *)slice->alloc_mem)->magic ^ MP_UNIT_MAGIC) {
+    struct mp_mem_head *head = (struct mp_mem_head *)(mem - sizeof(struct mp_mem_head));
+
+    MP_HARDEN_CHECK(!(head->magic ^ MP_UNIT_MAGIC));
+    slice->alloc_mem = (char *)head - MP_MEM_DEBUG_HEAD_SIZE;
+    slice->node_id = head->node_id;
+    slice->mempool_id = head->mempool_id;
+    slice->tag = (head->flags & MP_MEM_TAG_MASK) >> MP_MEM_TAG_SHIFT;
+    return head;
+}
+
+/* 退回glibc的单元：malloc返回的原始地址 */
+static inline void *mp_any_base(const struct mp_hash_slice *slice)
+{
+    return (char *)slice->alloc_mem - MP_MEM_ANY_PAD;
+}
+
+/* 退回glibc的单元：从alloc_mem起可用的字节数 */
+static inline size_t mp_any_usable(const struct mp_hash_slice *slice)
+{
+    return malloc_usable_size(mp_any_base(slice)) - MP_MEM_ANY_PAD;
+}
+
+#if MP_HARDEN_DEBUG
+static inline struct mp_mem_debug *mp_debug_head(void *mem)
+{
+    return (struct mp_mem_debug *)((char *)mem - sizeof(struct mp_mem_head) - sizeof(struct mp_mem_debug));
+}
+
+static void mp_debug_arm(void *mem, size_t size)
+{
+    struct mp_mem_debug *dbg = mp_debug_head(mem);
+
+    dbg->size = size;
+    dbg->state = MP_MEM_S_USED;
+    memset(dbg->guard, MP_HARDEN_GUARD_BYTE, sizeof(dbg->guard));
+    memset((char *)mem + size, MP_HARDEN_GUARD_BYTE, MP_HARDEN_GUARD_SIZE);
+}
+
+static int mp_debug_bytes_equal(const void *mem, unsigned char c, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (((const unsigned char *)mem)[i] != c) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* 指针必须处于使用状态，且前后保护字节完整 */
+static void mp_debug_check(void *mem)
+{
+    struct mp_mem_debug *dbg = mp_debug_head(mem);
+
+    if (dbg->state == MP_MEM_S_FREE) {
+        MP_LOG_ERROR("double free ptr[%p].", mem);
+        abort();
+    }
+    if (dbg->state != MP_MEM_S_USED || !mp_debug_bytes_equal(dbg->guard, MP_HARDEN_GUARD_BYTE, sizeof(dbg->guard))) {
+        MP_LOG_ERROR("ptr[%p] head corrupted, buffer underflow or invalid ptr.", mem);
+        abort();
+    }
+    if (!mp_debug_bytes_equal((char *)mem + dbg->size, MP_HARDEN_GUARD_BYTE, MP_HARDEN_GUARD_SIZE)) {
+        MP_LOG_ERROR("ptr[%p] size[%lu] tail guard corrupted, buffer overflow.", mem, dbg->size);
+        abort();
+    }
+}
+
+static void mp_debug_poison(void *mem)
+{
+    struct mp_mem_debug *dbg = mp_debug_head(mem);
+
+    memset(mem, MP_HARDEN_POISON_BYTE, dbg->size);
+    dbg->state = MP_MEM_S_FREE;
+}
+
+/* 隔离期间投毒被改写，说明释放后仍有写入 */
+static void mp_debug_check_poison(void *mem)
+{
+    struct mp_mem_debug *dbg = mp_debug_head(mem);
+
+    if (!mp_debug_bytes_equal(mem, MP_HARDEN_POISON_BYTE, dbg->size)) {
+        MP_LOG_ERROR("ptr[%p] size[%lu] written after free.", mem, dbg->size);
         abort();
-        return NULL;
     }
-    slice->node_id = ((struct mp_mem_head *)slice->alloc_mem)->node_id;
-    slice->mempool_id = ((struct mp_mem_head *)slice->alloc_mem)->mempool_id;
-    return slice->alloc_mem;
 }
+#define MP_HASH_DEBUG_ARM(mem, size)    mp_debug_arm((mem), (size))
+#define MP_HASH_DEBUG_CHECK(mem)        mp_debug_check(mem)
+#define MP_HASH_OWNER_CHECK(imp)        mp_hash_owner_check(imp)
+#else
+#define MP_HASH_DEBUG_ARM(mem, size)    ((void)0)
+#define MP_HASH_DEBUG_CHECK(mem)        ((void)0)
+#define MP_HASH_OWNER_CHECK(imp)        ((void)0)
+#endif
 
 /*默认使用哈希算法查找内存池*/
 
@@ -96,6 +234,10 @@ static inline int mp_rwlock_wrlock(mp_rwlock_t *rwlock)
 {
     return pthread_rwlock_wrlock(rwlock);
 }
+static inline int mp_rwlock_trywrlock(mp_rwlock_t *rwlock)
+{
+    return pthread_rwlock_trywrlock(rwlock);
+}
 static inline int mp_rwlock_unlock(mp_rwlock_t *rwlock)
 {
     return pthread_rwlock_unlock(rwlock);
@@ -109,11 +251,57 @@ static inline int mp_rwlock_destroy(mp_rwlock_t *rwlock)
 #define MP_HASH_IMP_NAME            "zkc_pool"
 #define MP_HASH_POOL_CACHE_SIZE     0 /* cache数量，大小等于前端scsi task的pool cache数量? */
 
+#ifdef MP_HASH_MEMPOOL_BITMAP
+/* 位图占用的内存池，按地址顺序复用 */
+typedef struct mempool_bitmap_imp  mp_mempool_t;
+
+static inline mp_mempool_t *mp_hash_mempool_create_imp(int id, size_t count, size_t ele_size, int single)
+{
+    return mempool_bitmap_create_ex_imp(id, count, ele_size, MP_MEM_DATA_ALIGN, MP_MEM_DATA_OFFSET,
+                                        single ? MEMPOOL_BITMAP_F_NO_LOCK : 0);
+}
+
+static inline void mp_hash_mempool_free_imp(mp_mempool_t *mp)
+{
+    mempool_bitmap_free_imp(mp);
+}
+
+static inline void *mp_hash_mempool_get_imp(mp_mempool_t *mp, int *zeroed)
+{
+    return mempool_bitmap_get_ex_imp(mp, zeroed);
+}
+
+static inline void mp_hash_mempool_put_imp(mp_mempool_t *mp, void *ele, int zeroed)
+{
+    mempool_bitmap_put_ex_imp(mp, ele, zeroed);
+}
+
+static inline size_t mp_hash_mempool_use_count_imp(mp_mempool_t *mp)
+{
+    return mempool_bitmap_use_count_imp(mp);
+}
+
+static inline size_t mp_hash_mempool_avail_count_imp(mp_mempool_t *mp)
+{
+    return mempool_bitmap_avail_count_imp(mp);
+}
+
+static inline void mp_hash_mempool_populate_imp(mp_mempool_t *mp)
+{
+    mempool_bitmap_populate_imp(mp);
+}
+
+static inline void mp_hash_mempool_foreach_used_imp(mp_mempool_t *mp, void (*fn)(void *ele, void *arg), void *arg)
+{
+    mempool_bitmap_foreach_used_imp(mp, fn, arg);
+}
+#else
 typedef struct mempool_imp  mp_mempool_t;
 
-static inline mp_mempool_t *mp_hash_mempool_create_imp(int id, size_t count, size_t ele_size)
+static inline mp_mempool_t *mp_hash_mempool_create_imp(int id, size_t count, size_t ele_size, int single)
 {
-    return mempool_create_imp(id, count, ele_size);
+    return mempool_create_ex_imp(id, count, ele_size, MP_MEM_DATA_ALIGN, MP_MEM_DATA_OFFSET,
+                                 single ? MEMPOOL_F_NO_LOCK : 0);
 }
 
 static inline void mp_hash_mempool_free_imp(mp_mempool_t *mp)
@@ -121,14 +309,14 @@ static inline void mp_hash_mempool_free_imp(mp_mempool_t *mp)
     mempool_free_imp(mp);
 }
 
-static inline void *mp_hash_mempool_get_imp(mp_mempool_t *mp)
+static inline void *mp_hash_mempool_get_imp(mp_mempool_t *mp, int *zeroed)
 {
-    return mempool_get_imp(mp);
+    return mempool_get_ex_imp(mp, zeroed);
 }
 
-static inline void mp_hash_mempool_put_imp(mp_mempool_t *mp, void *ele)
+static inline void mp_hash_mempool_put_imp(mp_mempool_t *mp, void *ele, int zeroed)
 {
-    mempool_put_imp(mp, ele);
+    mempool_put_ex_imp(mp, ele, zeroed);
 }
 
 static inline size_t mp_hash_mempool_use_count_imp(mp_mempool_t *mp)
@@ -141,28 +329,70 @@ static inline size_t mp_hash_mempool_avail_count_imp(mp_mempool_t *mp)
     return mempool_avail_count_imp(mp);
 }
 
+static inline void mp_hash_mempool_populate_imp(mp_mempool_t *mp)
+{
+    mempool_populate_imp(mp);
+}
+
+static inline void mp_hash_mempool_foreach_used_imp(mp_mempool_t *mp, void (*fn)(void *ele, void *arg), void *arg)
+{
+    mempool_foreach_used_imp(mp, fn, arg);
+}
+#endif
+
 
 /*内存分配实现方法*/
 
-/*size类型最大数量 不超过254种类型，再多类型，不适合这种方式了*/
-#define MP_HASH_SIZE_TYPE_MAX_NUM           64
+/*size类型最大数量 不超过254种类型（元数据头里node_id只有一个字节），再多类型，不适合这种方式了*/
+#define MP_HASH_SIZE_TYPE_MAX_NUM           254
 
-/*每个size类型，支持动态拓展的最大内存池个数, 不超过254*/
-#define MP_HASH_MAX_MEMPOOL_NUM             4
+/*每个size类型，支持动态拓展的最大内存池个数，加上分片数不超过254*/
+#define MP_HASH_MAX_DYNAMIC_MEMPOOL_NUM     3
 
-/*每个size类型，固定内存池个数，声明周期里不会被释放*/
-#define MP_HASH_MAX_ACTIVE_MEMPOOL_NUM      1
+/*每个size类型的最大分片数，每个分片一个固定内存池，声明周期里不会被释放，按调用者所在CPU选择*/
+#define MP_HASH_MAX_SHARD_NUM               16
+
+/*每个分片至少分到的容量，容量太小时减少分片数，避免分片总是空着去偷*/
+#define MP_HASH_SHARD_MIN_CAPACITY          64
 
 /* 哈希表的NODE最小值，小于该值，则不需要哈希表查找*/
 #define MP_HASH_NODE_MIN_NUM                128
 
-#define MP_HASH_INVALID_MEMPOOL_ID          (MP_HASH_MAX_MEMPOOL_NUM + 1)
+/* 内存池下标和分片数有关，取一个字节的最大值 */
+#define MP_HASH_INVALID_MEMPOOL_ID          0xff
 
 #define MP_HAHS_INVALID_NODE_ID             (MP_HASH_SIZE_TYPE_MAX_NUM + 1)
 
 /*每个存储池默认元素最大个数*/
 #define MP_HASH_MEMPOOL_CAPACITY            512
 
+/*
+ * 自动生成的size阶梯：不超过 16<<s 的部分按16字节一级，
+ * 之上每个2的幂区间等分为 1<<s 级，相对浪费小于 1/(1<<s)
+ */
+#define MP_HASH_LADDER_QUANTUM_SHIFT        4
+#define MP_HASH_LADDER_MAX_SHIFT            7
+
+/*调试级别释放隔离区大小，隔离区满时才真正归还最早释放的内存*/
+#define MP_HASH_QUARANTINE_NUM              256
+
+/*预算回收回调最大个数*/
+#define MP_HASH_RECLAIM_MAX_NUM             8
+
+/*超过预算的该比例（limit - limit/DIV）开始回收*/
+#define MP_HASH_BUDGET_SOFT_DIV             8
+
+/*线程缓存和中转缓存之间一次交换一批，每批单元数上限，按单元大小缩小到不超过 MP_HASH_MAG_BYTES*/
+#define MP_HASH_MAG_MAX_NUM                 32
+#define MP_HASH_MAG_MIN_NUM                 2
+#define MP_HASH_MAG_BYTES                   (64UL << 10)
+
+/*每个size类型中转缓存保存的满批次和空批次个数上限*/
+#define MP_HASH_DEPOT_MAX_NUM               8
+
+/*标签子节点的初始容量为所属size类型初始容量的 1/DIV，不足时同样按动态内存池拓展*/
+#define MP_HASH_TAG_CAPACITY_DIV            4
+
 
 /* 结构体定义 */
 
@@ -172,6 +402,42 @@ struct mp_hash_mempool
     mp_mempool_t    *handle;
 };
 
+/* 一批空闲单元，线程缓存和中转缓存之间整体交换 */
+struct mp_hash_mag
+{
+    int                     count;
+    void                    *mem[MP_HASH_MAG_MAX_NUM];
+    unsigned char           pool[MP_HASH_MAG_MAX_NUM];  /* 所属内存池下标 */
+    unsigned char           zero[MP_HASH_MAG_MAX_NUM];  /* 业务数据区全为0 */
+};
+
+/* 中转缓存，只有批次指针进出，持锁时间和批次大小无关 */
+struct mp_hash_depot
+{
+    pthread_mutex_t         lck;
+    int                     full_num;
+    int                     empty_num;
+    struct mp_hash_mag      *full[MP_HASH_DEPOT_MAX_NUM];
+    struct mp_hash_mag      *empty[MP_HASH_DEPOT_MAX_NUM];
+};
+
+/*
+ * 线程缓存的一个size类型：loaded为当前使用的批次，prev总是全满或全空，
+ * 两个批次来回切换，只有两个都用尽（或都满）时才访问中转缓存
+ */
+struct mp_hash_tcache_bin
+{
+    struct mp_hash_mag      *loaded;
+    struct mp_hash_mag      *prev;
+};
+
+struct mp_hash_tcache
+{
+    QUEUE                       q;
+    struct mp_hash_imp          *imp;
+    struct mp_hash_tcache_bin   bins[0];
+};
+
 struct mp_hash_node
 {
     int                     id;
@@ -181,266 +447,1145 @@ struct mp_hash_node
     struct mp_hash_mempool  *mempools;
     unsigned char           mempool_max_num;
     unsigned char           mempool_active;
-    char                    padding[2];
+    unsigned char           shard_num;      /* 前shard_num个是固定内存池，之后是动态内存池 */
+    unsigned char           zero_on_free;   /* 释放时清零，calloc取到时不用再清零 */
+    int                     mag_num;        /* 线程缓存每批单元数 */
+    struct mp_hash_depot    *depot;         /* 未开启线程缓存时为NULL */
+    struct mp_hash_node     *tags[MP_TAG_MAX];  /* 每个标签的子节点，第一次分配时创建，下标0不用 */
 };
 
 KHASH_MAP_INIT_INT(hash_32, struct mp_hash_node*)
 
+struct mp_hash_reclaim
+{
+    size_t          (*fn)(void *arg, size_t need);
+    void            *arg;
+};
+
+/* 内存预算，统计内存池和退回glibc的内存 */
+struct mp_hash_budget
+{
+    size_t                  limit;          /* 0表示不限制 */
+    size_t                  soft;           /* 超过后触发回收 */
+    size_t                  used;           /* 原子更新 */
+    pthread_mutex_t         reclaim_lck;    /* 同一时刻只有一个线程回收，其它线程不等待 */
+    int                     reclaim_num;
+    struct mp_hash_reclaim  reclaims[MP_HASH_RECLAIM_MAX_NUM];
+};
+
 struct mp_hash_imp
 {
     khash_t(hash_32) *h;
     int node_num;
     struct mp_hash_node *nodes;
+    struct mp_hash_budget budget;
+    struct mp_hist_ctx *hist;   /* 时延直方图，最后一个单元统计退回glibc的分配 */
+    size_t prof_rate;           /* 堆分析平均采样间隔（字节），0表示关闭 */
+    struct mp_prof_ctx *prof;   /* 第一次开启时创建，关闭后保留以注销存活样本 */
+    int ladder;                 /* 分配单元恰好是阶梯上连续的一段时，按位运算直接定位node */
+    int ladder_shift;
+    int ladder_first;           /* 第一个node在阶梯上的序号 */
+    int shard_num;              /* 期望的分片数，0表示按CPU数 */
+    size_t tag_used[MP_TAG_MAX];    /* 每个标签使用中的字节数（按单元可用大小） */
+    size_t tag_count[MP_TAG_MAX];   /* 每个标签使用中的分配个数 */
+    int tcache;                 /* 开启线程缓存 */
+    int single;                 /* 单线程句柄，内存池和节点都不加锁 */
+    pthread_key_t tcache_key;
+    pthread_mutex_t tcache_lck; /* 保护tcache_list，只在线程第一次使用和退出时加锁 */
+    QUEUE tcache_list;
+#if MP_HARDEN_DEBUG
+    int owner_set;              /* 单线程句柄第一次分配或释放时记录调用线程 */
+    pthread_t owner;
+    pthread_mutex_t quarantine_lck;
+    unsigned int quarantine_pos;
+    void *quarantine[MP_HASH_QUARANTINE_NUM];
+#endif
 };
 
-/* 函数声明 */
-static int mp_hash_node_init(struct mp_hash_node *node, size_t size, int capacity);
-static void mp_hash_node_finish(struct mp_hash_node *node);
-
-static int mp_hash_node_get_slice(struct mp_hash_node *node, struct mp_hash_slice *slice);
-static void mp_hash_node_put_slice(struct mp_hash_node *node, const struct mp_hash_slice *slice);
-
-static int mp_hash_any_alloc_imp(size_t alloc_size, struct mp_hash_slice *slice);
-static void mp_hash_any_realloc_imp(size_t new_size, struct mp_hash_slice *slice);
-static void mp_hash_any_free_imp(const struct mp_hash_slice *slice);
-
-static void mp_hash_sort(struct mp_hash_node *nodes, int nodes_num);
-static int mp_hash_mem_skip_search(struct mp_hash_node *nodes, int nodes_num, size_t key);
-
-void *mp_hash_create_imp(const struct mp_unit *arr, int arr_num)
+#define MP_HASH_HIST_CLASS(imp, node_id) \
+    (((node_id) >= 0 && (node_id) < (imp)->node_num) ? (node_id) : (imp)->node_num)
+#define MP_HASH_SLICE_FIXED(imp, slice) \
+    ((slice)->node_id < (imp)->node_num && (slice)->mempool_id < (imp)->nodes[(slice)->node_id].shard_num)
+#define MP_HASH_HIST_ALLOC_TYPE(imp, slice) \
+    (MP_HASH_SLICE_FIXED(imp, slice) ? MP_HIST_E_ALLOC_FAST : MP_HIST_E_ALLOC_SLOW)
+#define MP_HASH_HIST_FREE_TYPE(imp, slice) \
+    (MP_HASH_SLICE_FIXED(imp, slice) ? MP_HIST_E_FREE_FAST : MP_HIST_E_FREE_SLOW)
+
+/* 采样命中时登记调用栈，未开启时只读一次prof_rate */
+static inline void mp_hash_prof_sample(struct mp_hash_imp *imp, void *ptr, size_t size)
 {
-    int i;
-    int rc;
-    khiter_t k;
-    int ret;
-    size_t min_mem_size = 0;
-    size_t max_mem_size = 0;
-    struct mp_hash_imp *imp;
+    size_t rate = __atomic_load_n(&imp->prof_rate, __ATOMIC_RELAXED);
 
-    if (!arr) {
-        MP_LOG_ERROR("null ptr.");
-        return NULL;
+    if (__builtin_expect(!rate, 1) || !mp_prof_tick(rate, size)) {
+        return;
     }
-
-    imp = mp_hash_calloc(1, sizeof(struct mp_hash_imp));
-    if (!imp) {
-        MP_LOG_ERROR("calloc fail.");
-        return NULL;
+    if (mp_prof_track(imp->prof, ptr, size) == MP_OK) {
+        ((struct mp_mem_head *)ptr - 1)->flags |= MP_MEM_F_SAMPLED;
     }
+}
 
-    imp->node_num = arr_num;
-    imp->nodes = mp_hash_calloc(1, imp->node_num * sizeof(struct mp_hash_node));
-    if (!imp->nodes) {
-        MP_LOG_ERROR("calloc nodes fail.");
-        goto fail;
+#if MP_HARDEN_DEBUG
+/* 单线程句柄绑定第一次分配或释放的线程，之后其它线程调用说明句柄被跨线程使用 */
+static void mp_hash_owner_check(struct mp_hash_imp *imp)
+{
+    if (!imp->single) {
+        return;
     }
+    if (!imp->owner_set) {
+        imp->owner = pthread_self();
+        imp->owner_set = 1;
+        return;
+    }
+    if (!pthread_equal(imp->owner, pthread_self())) {
+        MP_LOG_ERROR("single thread handle[%p] used by another thread.", imp);
+        abort();
+    }
+}
+#endif
 
-    if (imp->node_num <= MP_HASH_NODE_MIN_NUM) {
-        imp->h = kh_init(hash_32);
-        if (!imp->h) {
-            MP_LOG_ERROR("kh_init fail.");
-            goto fail;
-        }
-    } else {
-        imp->h = NULL;
+/* 函数声明 */
+static int mp_hash_node_init(struct mp_hash_imp *imp, struct mp_hash_node *node, size_t size, int capacity, int sub);
+static void mp_hash_node_finish(struct mp_hash_imp *imp, struct mp_hash_node *node);
+
+static int mp_hash_node_get_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_slice *slice);
+static void mp_hash_node_put_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, const struct mp_hash_slice *slice);
+static int mp_hash_tcache_get_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_slice *slice);
+static int mp_hash_tcache_put_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, const struct mp_hash_slice *slice);
+static void mp_hash_tcache_init(struct mp_hash_imp *imp);
+static void mp_hash_tcache_finish(struct mp_hash_imp *imp);
+static void mp_hash_depot_flush(struct mp_hash_imp *imp, struct mp_hash_node *node);
+static void mp_hash_mag_drain(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_mag *mag);
+#if MP_HARDEN_LEVEL >= 1
+static void mp_hash_leak_report(struct mp_hash_imp *imp);
+#endif
+
+/* 开启线程缓存时先走线程缓存 */
+static inline int mp_hash_node_alloc(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_slice *slice)
+{
+    if (node->depot) {
+        return mp_hash_tcache_get_slice(imp, node, slice);
     }
+    return mp_hash_node_get_slice(imp, node, slice);
+}
 
-    for (i = 0; i < imp->node_num; i++) {
-        if (arr[i].size <= 0) {
-            MP_LOG_ERROR("unit[%d] size[%ld] is invalid.", i, arr[i].size);
-            goto fail;
-        }
-        rc = mp_hash_node_init(&imp->nodes[i], arr[i].size, arr[i].capacity);
-        if (rc != MP_OK) {
-            MP_LOG_ERROR("mp_hash_node_init fail.");
-            goto fail;
-        }
-        min_mem_size += (arr[i].size *arr[i].capacity);
-        max_mem_size += (arr[i].size *arr[i].capacity * imp->nodes[i].mempool_max_num);
-        imp->nodes[i].id = i;
-        if (!imp->h) {
-            continue;
-        }
-        k = kh_put(hash_32, imp->h, imp->nodes[i].size, &ret);
-        if (ret < 0) {
-            MP_LOG_ERROR("kh_put fail, key[%ld], ret[%d].", imp->nodes[i].size, ret);
-            goto fail;
-        }
-        MP_LOG_DEBUG("hash table[%p] map node[%d] on key[%lu].", imp->h, i, imp->nodes[i].size);
-        kh_value(imp->h, k) = &(imp->nodes[i]);
+static inline void mp_hash_node_release(struct mp_hash_imp *imp, struct mp_hash_node *node, const struct mp_hash_slice *slice)
+{
+    if (node->depot && mp_hash_tcache_put_slice(imp, node, slice) == MP_OK) {
+        return;
     }
-    mp_hash_sort(imp->nodes, imp->node_num); // 排个序
-    MP_LOG_DEBUG("Register mempool size: Min [%luKB],  Max [%luKB].", min_mem_size/1024 + 1, max_mem_size/1024 + 1);
-    return imp;
-fail:
-    mp_hash_destroy_imp(imp);
-    return NULL;
+    mp_hash_node_put_slice(imp, node, slice);
 }
 
-void mp_hash_destroy_imp(void* mh)
+static int mp_hash_any_alloc_imp(struct mp_hash_imp *imp, size_t alloc_size, int zero, struct mp_hash_slice *slice);
+static void mp_hash_any_realloc_imp(struct mp_hash_imp *imp, size_t new_size, struct mp_hash_slice *slice);
+static void mp_hash_any_free_imp(struct mp_hash_imp *imp, const struct mp_hash_slice *slice);
+
+static inline size_t mp_hash_pool_bytes(const struct mp_hash_node *node, size_t capacity)
 {
-    int i;
-    struct mp_hash_imp *imp;
+    return capacity * node->size;
+}
 
-    if (!mh) {
-        MP_LOG_ERROR("null ptr.");
+/* 当前启用的内存池个数，不加锁读取，只作为是否扩展、收缩的提示，加写锁后再确认 */
+static inline int mp_hash_active_num(const struct mp_hash_node *node)
+{
+    return __atomic_load_n(&node->mempool_active, __ATOMIC_RELAXED);
+}
+
+/* 启用的内存池个数增减，持有节点写锁；单线程句柄不用原子操作 */
+static inline void mp_hash_active_add(const struct mp_hash_imp *imp, struct mp_hash_node *node, int delta)
+{
+    if (imp->single) {
+        node->mempool_active += delta;
         return;
     }
+    __atomic_add_fetch(&node->mempool_active, delta, __ATOMIC_RELAXED);
+}
 
-    imp = (struct mp_hash_imp *)mh;
-    if (imp) {
-        if (imp->h) {
-            kh_destroy(hash_32, imp->h);
-        }
-        if (imp->nodes) {
-            for (i = 0; i < imp->node_num; i++) {
-                mp_hash_node_finish(&imp->nodes[i]);
-            }
-            mp_hash_free(imp->nodes);
+/* 下一个动态内存池的容量，第n个动态内存池为 (n + 1) 倍初始容量 */
+static inline size_t mp_hash_grow_capacity(const struct mp_hash_node *node)
+{
+    return (mp_hash_active_num(node) - node->shard_num + 2) * node->init_capacity;
+}
+
+static __thread int g_mp_hash_thread_shard = -1;
+static int g_mp_hash_thread_seq;
+
+/* 按当前CPU选择分片，拿不到CPU号时按线程轮转分配的序号 */
+static inline int mp_hash_shard_id(const struct mp_hash_node *node)
+{
+    int cpu;
+
+    if (node->shard_num == 1) {
+        return 0;
+    }
+    cpu = sched_getcpu();
+    if (__builtin_expect(cpu < 0, 0)) {
+        if (g_mp_hash_thread_shard < 0) {
+            g_mp_hash_thread_shard = __atomic_fetch_add(&g_mp_hash_thread_seq, 1, __ATOMIC_RELAXED) & 0x7fffffff;
         }
-        mp_hash_free(imp);
+        cpu = g_mp_hash_thread_shard;
     }
-    return;
+    return cpu % node->shard_num;
 }
 
-void *mp_hash_alloc_imp(void* mh, size_t size)
+/* 分片数：attr指定或按在线CPU数，受容量限制，每个分片至少 MP_HASH_SHARD_MIN_CAPACITY */
+static int mp_hash_shard_num(int want, size_t capacity)
 {
-    int rc;
-    int find_index;
-    khiter_t k;
-    struct mp_hash_imp *imp;
-    struct mp_hash_node *node;
-    struct mp_hash_slice slice = {0};
-    size_t total_size;
+    long cpus;
 
-    if (!mh) {
-        MP_LOG_ERROR("null ptr.");
-        return NULL;
+    if (want <= 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        want = cpus > 0 ? (int)cpus : 1;
     }
-
-    total_size = size + sizeof(struct mp_mem_head);
-    imp = (struct mp_hash_imp *)mh;
-    node = NULL;
-    if (imp->h) {
-         k = kh_get(hash_32, imp->h, total_size);
-         if (k != kh_end(imp->h)) {
-             node = kh_value(imp->h, k);
-         }
+    if (want > MP_HASH_MAX_SHARD_NUM) {
+        want = MP_HASH_MAX_SHARD_NUM;
     }
-
-    if (!node) {
-        find_index = mp_hash_mem_skip_search(imp->nodes, imp->node_num, total_size);
-        if (imp->nodes[find_index].size >= total_size) {
-            node = &imp->nodes[find_index];
-        }
+    if ((size_t)want > capacity / MP_HASH_SHARD_MIN_CAPACITY) {
+        want = (int)(capacity / MP_HASH_SHARD_MIN_CAPACITY);
     }
+    return want > 0 ? want : 1;
+}
 
-    if (node){
-        rc = mp_hash_node_get_slice(node, &slice);
+/* 节点读锁，单线程句柄不加锁 */
+static inline int mp_hash_node_rdlock(const struct mp_hash_imp *imp, struct mp_hash_node *node)
+{
+    if (imp->single) {
+        return MP_OK;
     }
+    return mp_rwlock_rdlock(&node->mempools_rwlock);
+}
 
-    /*池分配失败，则尝试直接分配*/
-    if (!slice.alloc_mem) {
-        rc = mp_hash_any_alloc_imp(total_size, &slice);
-        if (rc != MP_OK || !slice.alloc_mem) {
-            MP_LOG_ERROR("get mem slice fail, size[%ld].", size);
-            return NULL;
-        }
+static inline void mp_hash_node_unlock(const struct mp_hash_imp *imp, struct mp_hash_node *node)
+{
+    if (!imp->single) {
+        mp_rwlock_unlock(&node->mempools_rwlock);
+    }
+}
+
+/* 节点写锁，先尝试加锁，有竞争时打跟踪点，统计等待时延 */
+static inline int mp_hash_node_wrlock(struct mp_hash_imp *imp, struct mp_hash_node *node)
+{
+    int rc;
+#ifdef MP_HAVE_USDT
+    uint64_t start;
+#endif
+
+    if (imp->single) {
+        return MP_OK;
+    }
+    MP_HIST_START(lock_start);
+    if (mp_rwlock_trywrlock(&node->mempools_rwlock) == 0) {
+        MP_HIST_RECORD(imp->hist, node->id, MP_HIST_E_LOCK_WAIT, lock_start);
+        return MP_OK;
+    }
+    MP_TRACE2(lock_contend, node->id, node->size);
+#ifdef MP_HAVE_USDT
+    /* 等待时延只给跟踪点用，没有USDT时不读时间戳 */
+    start = mp_hist_now();
+    rc = mp_rwlock_wrlock(&node->mempools_rwlock);
+    MP_TRACE2(lock_acquire, node->id, mp_hist_now() - start);
+#else
+    rc = mp_rwlock_wrlock(&node->mempools_rwlock);
+#endif
+    MP_HIST_RECORD(imp->hist, node->id, MP_HIST_E_LOCK_WAIT, lock_start);
+    (void)imp;
+    return rc;
+}
+
+/* 预算使用量增减，返回增加后的值；单线程句柄不用原子操作 */
+static inline size_t mp_hash_budget_add(struct mp_hash_imp *imp, size_t bytes)
+{
+    if (imp->single) {
+        imp->budget.used += bytes;
+        return imp->budget.used;
+    }
+    return __atomic_add_fetch(&imp->budget.used, bytes, __ATOMIC_RELAXED);
+}
+
+static inline void mp_hash_budget_uncharge(struct mp_hash_imp *imp, size_t bytes)
+{
+    if (imp->single) {
+        imp->budget.used -= bytes;
+        return;
+    }
+    __atomic_sub_fetch(&imp->budget.used, bytes, __ATOMIC_RELAXED);
+}
+
+/* 释放所有空闲的动态内存池，调用者不能持有节点锁 */
+static size_t mp_hash_node_trim(struct mp_hash_imp *imp, struct mp_hash_node *node)
+{
+    int j;
+    size_t released = 0;
+
+    /* 中转缓存里的批次先还给内存池，空闲的动态内存池才能释放 */
+    mp_hash_depot_flush(imp, node);
+    if (mp_hash_active_num(node) <= node->shard_num) {
+        return 0;
+    }
+    mp_hash_node_wrlock(imp, node);
+    for (j = node->shard_num; j < node->mempool_max_num; j++) {
+        if (!node->mempools[j].handle || mp_hash_mempool_use_count_imp(node->mempools[j].handle) != 0) {
+            continue;
+        }
+        MP_TRACE4(pool_shrink, node->id, node->size, j, node->mempools[j].capacity);
+        mp_hash_mempool_free_imp(node->mempools[j].handle);
+        released += mp_hash_pool_bytes(node, node->mempools[j].capacity);
+        node->mempools[j].handle = NULL;
+        node->mempools[j].capacity = 0;
+        mp_hash_active_add(imp, node, -1);
+    }
+    mp_hash_node_unlock(imp, node);
+    return released;
+}
+
+static size_t mp_hash_trim(struct mp_hash_imp *imp)
+{
+    int i, t;
+    size_t released = 0;
+    struct mp_hash_node *sub;
+
+    for (i = 0; i < imp->node_num; i++) {
+        released += mp_hash_node_trim(imp, &imp->nodes[i]);
+        for (t = 1; t < MP_TAG_MAX; t++) {
+            sub = __atomic_load_n(&imp->nodes[i].tags[t], __ATOMIC_ACQUIRE);
+            if (sub) {
+                released += mp_hash_node_trim(imp, sub);
+            }
+        }
+    }
+    mp_hash_budget_uncharge(imp, released);
+    return released;
+}
+
+/* 调用回收回调并释放空闲内存池；已有线程在回收时直接返回，不等待 */
+static void mp_hash_reclaim(struct mp_hash_imp *imp, size_t need)
+{
+    int i;
+    size_t reclaimed = 0;
+    struct mp_hash_budget *budget = &imp->budget;
+
+    if (pthread_mutex_trylock(&budget->reclaim_lck) != 0) {
+        return;
+    }
+    for (i = 0; i < budget->reclaim_num; i++) {
+        reclaimed += budget->reclaims[i].fn(budget->reclaims[i].arg, need);
+    }
+    reclaimed += mp_hash_trim(imp);
+    pthread_mutex_unlock(&budget->reclaim_lck);
+    MP_TRACE2(budget_reclaim, need, reclaimed);
+    MP_LOG_DEBUG("reclaim need[%lu], reclaimed[%lu].", need, reclaimed);
+}
+
+/*
+ * 预算记账，调用者不能持有节点锁（回收会释放内存池）。
+ * force不检查上限，用于不能失败的场景（创建固定内存池、realloc缩小等）
+ */
+static int mp_hash_budget_charge(struct mp_hash_imp *imp, size_t bytes, int force)
+{
+    size_t used;
+    struct mp_hash_budget *budget = &imp->budget;
+
+    used = mp_hash_budget_add(imp, bytes);
+    if (!budget->limit || force) {
+        return MP_OK;
+    }
+    if (used > budget->limit) {
+        /* 达到上限，回收一次后重试，仍不够则失败，避免反复回收 */
+        mp_hash_budget_uncharge(imp, bytes);
+        mp_hash_reclaim(imp, used - budget->limit);
+        used = mp_hash_budget_add(imp, bytes);
+        if (used > budget->limit) {
+            mp_hash_budget_uncharge(imp, bytes);
+            MP_TRACE2(budget_fail, used - bytes, bytes);
+            MP_LOG_DEBUG("budget exceed, limit[%lu], used[%lu], need[%lu].", budget->limit, used - bytes, bytes);
+            return MP_ERR;
+        }
+    } else if (used > budget->soft && used - bytes <= budget->soft) {
+        /* 刚越过软上限时回收，避免每次分配都触发 */
+        mp_hash_reclaim(imp, used - budget->soft);
+    }
+    return MP_OK;
+}
+
+static void mp_hash_sort(struct mp_hash_node *nodes, int nodes_num);
+static int mp_hash_node_grow(struct mp_hash_imp *imp, struct mp_hash_node *node, size_t capacity);
+#if MP_HARDEN_DEBUG
+static void mp_hash_quarantine_drain(struct mp_hash_imp *imp);
+#endif
+static int mp_hash_mem_skip_search(struct mp_hash_node *nodes, int nodes_num, size_t key);
+
+/* size在阶梯上的序号，即不小于size的最小一级 */
+static inline int mp_hash_ladder_index(size_t size, int shift)
+{
+    int k;
+    int small = MP_HASH_LADDER_QUANTUM_SHIFT + shift;
+
+    /* 小于 16<<s 时k取small，两段公式一致 */
+    k = 63 - __builtin_clzll((unsigned long long)(size - 1) | (1ull << small));
+    return ((k - small) << shift) + (int)((size - 1) >> (k - shift));
+}
+
+/* 阶梯上第idx级的size */
+static inline size_t mp_hash_ladder_size(int idx, int shift)
+{
+    int group = idx >> shift;
+    size_t sub = (size_t)(idx & ((1 << shift) - 1));
+
+    if (!group) {
+        return (sub + 1) << MP_HASH_LADDER_QUANTUM_SHIFT;
+    }
+    return (((size_t)1 << shift) + sub + 1) << (MP_HASH_LADDER_QUANTUM_SHIFT + group - 1);
+}
+
+/* 排序后的node（不含元数据头）是否恰好是某个阶梯上连续的一段 */
+static void mp_hash_ladder_detect(struct mp_hash_imp *imp)
+{
+    int i;
+    int shift;
+    int first;
+
+    for (shift = 0; shift <= MP_HASH_LADDER_MAX_SHIFT; shift++) {
+        first = mp_hash_ladder_index(imp->nodes[0].size - MP_MEM_OVERHEAD, shift);
+        for (i = 0; i < imp->node_num; i++) {
+            if (imp->nodes[i].size - MP_MEM_OVERHEAD != mp_hash_ladder_size(first + i, shift)) {
+                break;
+            }
+        }
+        if (i == imp->node_num) {
+            imp->ladder = 1;
+            imp->ladder_shift = shift;
+            imp->ladder_first = first;
+            MP_LOG_DEBUG("nodes match size ladder, shift[%d] first[%d].", shift, first);
+            return;
+        }
+    }
+}
+
+static inline struct mp_hash_node *mp_hash_find_node(struct mp_hash_imp *imp, size_t total_size)
+{
+    int find_index;
+    size_t size;
+    khiter_t k;
+
+    /* 内部接口，避免重复校验，入参由调用者校验 */
+    if (imp->ladder) {
+        size = total_size - MP_MEM_OVERHEAD;
+        find_index = mp_hash_ladder_index(size ? size : 1, imp->ladder_shift) - imp->ladder_first;
+        if (find_index < 0) {
+            find_index = 0;
+        }
+        return find_index < imp->node_num ? &imp->nodes[find_index] : NULL;
+    }
+    if (imp->h) {
+         k = kh_get(hash_32, imp->h, total_size);
+         if (k != kh_end(imp->h)) {
+             return kh_value(imp->h, k);
+         }
+    }
+
+    find_index = mp_hash_mem_skip_search(imp->nodes, imp->node_num, total_size);
+    if (imp->nodes[find_index].size >= total_size) {
+        return &imp->nodes[find_index];
+    }
+    return NULL;
+}
+
+void *mp_hash_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr)
+{
+    int i;
+    int rc;
+    khiter_t k;
+    int ret;
+    size_t min_mem_size = 0;
+    size_t max_mem_size = 0;
+    struct mp_hash_imp *imp;
+
+    if (!arr) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (arr_num > MP_HASH_SIZE_TYPE_MAX_NUM) {
+        MP_LOG_ERROR("unit num[%d] exceed max[%d].", arr_num, MP_HASH_SIZE_TYPE_MAX_NUM);
+        return NULL;
+    }
+
+    imp = mp_hash_calloc(1, sizeof(struct mp_hash_imp));
+    if (!imp) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    if (pthread_mutex_init(&imp->budget.reclaim_lck, NULL) != 0) {
+        MP_LOG_ERROR("pthread_mutex_init fail.");
+        mp_hash_free(imp);
+        return NULL;
+    }
+    if (attr && attr->budget) {
+        mp_hash_set_budget_imp(imp, attr->budget);
+    }
+    imp->shard_num = attr ? attr->shards : 0;
+    imp->single = (attr && (attr->flags & MP_ATTR_F_SINGLE_THREAD)) ? 1 : 0;
+    if (imp->single) {
+        /* 只有一个线程访问，分片和线程缓存都没有意义 */
+        imp->shard_num = 1;
+    }
+#if !MP_HARDEN_DEBUG
+    /* 调试级别需要每次释放都经过隔离区和重复释放检测，不使用线程缓存 */
+    imp->tcache = (attr && (attr->flags & MP_ATTR_F_THREAD_CACHE) && !imp->single) ? 1 : 0;
+#endif
+    mp_hash_tcache_init(imp);
+#if MP_HARDEN_DEBUG
+    pthread_mutex_init(&imp->quarantine_lck, NULL);
+#endif
+
+    imp->node_num = arr_num;
+    imp->nodes = mp_hash_calloc(1, imp->node_num * sizeof(struct mp_hash_node));
+    if (!imp->nodes) {
+        MP_LOG_ERROR("calloc nodes fail.");
+        goto fail;
+    }
+
+    if (imp->node_num <= MP_HASH_NODE_MIN_NUM) {
+        imp->h = kh_init(hash_32);
+        if (!imp->h) {
+            MP_LOG_ERROR("kh_init fail.");
+            goto fail;
+        }
+    } else {
+        imp->h = NULL;
+    }
+
+    for (i = 0; i < imp->node_num; i++) {
+        if (arr[i].size <= 0) {
+            MP_LOG_ERROR("unit[%d] size[%ld] is invalid.", i, arr[i].size);
+            goto fail;
+        }
+        rc = mp_hash_node_init(imp, &imp->nodes[i], arr[i].size, arr[i].capacity, 0);
+        if (rc != MP_OK) {
+            MP_LOG_ERROR("mp_hash_node_init fail.");
+            goto fail;
+        }
+        min_mem_size += (arr[i].size *arr[i].capacity);
+        max_mem_size += (arr[i].size *arr[i].capacity * imp->nodes[i].mempool_max_num);
+        imp->nodes[i].id = i;
+        if (!imp->h) {
+            continue;
+        }
+        k = kh_put(hash_32, imp->h, imp->nodes[i].size, &ret);
+        if (ret < 0) {
+            MP_LOG_ERROR("kh_put fail, key[%ld], ret[%d].", imp->nodes[i].size, ret);
+            goto fail;
+        }
+        MP_LOG_DEBUG("hash table[%p] map node[%d] on key[%lu].", imp->h, i, imp->nodes[i].size);
+        kh_value(imp->h, k) = &(imp->nodes[i]);
+    }
+    mp_hash_sort(imp->nodes, imp->node_num); // 排个序
+    mp_hash_ladder_detect(imp);
+#ifdef MP_LATENCY_HIST
+    imp->hist = mp_hist_ctx_create(imp->node_num + 1);
+    if (!imp->hist) {
+        goto fail;
+    }
+#endif
+    MP_LOG_DEBUG("Register mempool size: Min [%luKB],  Max [%luKB].", min_mem_size/1024 + 1, max_mem_size/1024 + 1);
+    return imp;
+fail:
+    mp_hash_destroy_imp(imp);
+    return NULL;
+}
+
+void mp_hash_destroy_imp(void* mh)
+{
+    int i;
+    struct mp_hash_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+
+    imp = (struct mp_hash_imp *)mh;
+    if (imp) {
+#if MP_HARDEN_LEVEL >= 1
+        mp_hash_leak_report(imp);
+#endif
+#if MP_HARDEN_DEBUG
+        mp_hash_quarantine_drain(imp);
+        pthread_mutex_destroy(&imp->quarantine_lck);
+#endif
+        if (imp->h) {
+            kh_destroy(hash_32, imp->h);
+        }
+        mp_hash_tcache_finish(imp);
+        if (imp->nodes) {
+            for (i = 0; i < imp->node_num; i++) {
+                mp_hash_node_finish(imp, &imp->nodes[i]);
+            }
+            mp_hash_free(imp->nodes);
+        }
+        mp_hist_ctx_destroy(imp->hist);
+        mp_prof_ctx_destroy(imp->prof);
+        pthread_mutex_destroy(&imp->budget.reclaim_lck);
+        mp_hash_free(imp);
+    }
+    return;
+}
+
+/* 标签子节点，第一次使用时创建；并发创建时只有一个发布成功，其它的销毁，创建失败返回NULL */
+static struct mp_hash_node *mp_hash_tag_node(struct mp_hash_imp *imp, struct mp_hash_node *node, int tag)
+{
+    int capacity;
+    struct mp_hash_node *sub;
+    struct mp_hash_node *expected = NULL;
+
+    sub = __atomic_load_n(&node->tags[tag], __ATOMIC_ACQUIRE);
+    if (__builtin_expect(sub != NULL, 1)) {
+        return sub;
+    }
+    sub = mp_hash_calloc(1, sizeof(struct mp_hash_node));
+    if (!sub) {
+        MP_LOG_ERROR("calloc tag node fail.");
+        return NULL;
+    }
+    capacity = (int)(node->init_capacity / MP_HASH_TAG_CAPACITY_DIV);
+    if (mp_hash_node_init(imp, sub, node->size - MP_MEM_OVERHEAD, capacity > 0 ? capacity : 1, 1) != MP_OK) {
+        MP_LOG_ERROR("init tag[%d] node of size[%lu] fail.", tag, node->size);
+        mp_hash_free(sub);
+        return NULL;
+    }
+    sub->id = node->id;
+    if (!__atomic_compare_exchange_n(&node->tags[tag], &expected, sub, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        mp_hash_node_finish(imp, sub);
+        mp_hash_free(sub);
+        sub = expected;
+    }
+    return sub;
+}
+
+/* 单元可用大小，标签统计按它记账，分配和释放时结果一致 */
+static inline size_t mp_hash_slice_usable(const struct mp_hash_imp *imp, const struct mp_hash_slice *slice)
+{
+    if (slice->node_id < imp->node_num) {
+        return imp->nodes[slice->node_id].size - MP_MEM_OVERHEAD;
+    }
+    return mp_any_usable(slice) - MP_MEM_OVERHEAD;
+}
+
+/* 标签统计，单线程句柄不用原子操作 */
+static inline void mp_hash_tag_account(struct mp_hash_imp *imp, int tag, size_t bytes, int add)
+{
+    if (imp->single) {
+        imp->tag_used[tag] = add ? imp->tag_used[tag] + bytes : imp->tag_used[tag] - bytes;
+        imp->tag_count[tag] = add ? imp->tag_count[tag] + 1 : imp->tag_count[tag] - 1;
+        return;
+    }
+    if (add) {
+        __atomic_add_fetch(&imp->tag_used[tag], bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&imp->tag_count[tag], 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_sub_fetch(&imp->tag_used[tag], bytes, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&imp->tag_count[tag], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * zero非0时返回的内存已清零：内存池单元已知为0时跳过清零，退回glibc时用calloc；
+ * tag非0时从该标签的子节点分配，子节点不足时和未打标签的分配一样退回glibc
+ */
+static inline void *mp_hash_alloc(struct mp_hash_imp *imp, size_t size, int zero, int tag)
+{
+    int rc;
+    void *ptr;
+    struct mp_hash_node *node;
+    struct mp_hash_slice slice = {0};
+    size_t total_size;
+
+    MP_HIST_START(hist_start);
+    total_size = size + MP_MEM_OVERHEAD;
+    MP_HASH_OWNER_CHECK(imp);
+    node = mp_hash_find_node(imp, total_size);
+    if (node && tag) {
+        node = mp_hash_tag_node(imp, node, tag);
+    }
+    if (node){
+        rc = mp_hash_node_alloc(imp, node, &slice);
+    }
+
+    /*池分配失败，则尝试直接分配*/
+    if (!slice.alloc_mem) {
+        rc = mp_hash_any_alloc_imp(imp, total_size, zero, &slice);
+        if (rc != MP_OK || !slice.alloc_mem) {
+            MP_LOG_ERROR("get mem slice fail, size[%ld].", size);
+            return NULL;
+        }
     }
 
     MP_LOG_DEBUG("alloc ptr[%p] node_id[%d],mempool_id[%d].", slice.alloc_mem, slice.node_id, slice.mempool_id);
-    return mp_pack(&slice);
+    MP_HIST_RECORD(imp->hist, MP_HASH_HIST_CLASS(imp, slice.node_id), MP_HASH_HIST_ALLOC_TYPE(imp, &slice), hist_start);
+    if (tag) {
+        slice.tag = tag;
+        mp_hash_tag_account(imp, tag, mp_hash_slice_usable(imp, &slice), 1);
+    }
+    ptr = mp_pack(&slice);
+    if (zero && !slice.zero) {
+        MP_TRACE2(calloc_zero, slice.node_id, size);
+        mp_pageheap_zero(ptr, size);
+    }
+    MP_HASH_DEBUG_ARM(ptr, size);
+    mp_hash_prof_sample(imp, ptr, size);
+    return ptr;
+}
+
+void *mp_hash_alloc_imp(void* mh, size_t size)
+{
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    return mp_hash_alloc((struct mp_hash_imp *)mh, size, 0, 0);
+}
+
+void *mp_hash_calloc_imp(void* mh, size_t size)
+{
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    return mp_hash_alloc((struct mp_hash_imp *)mh, size, 1, 0);
+}
+
+void *mp_hash_alloc_tagged_imp(void* mh, int tag, size_t size)
+{
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (tag < 0 || tag >= MP_TAG_MAX) {
+        MP_LOG_ERROR("tag[%d] invalid.", tag);
+        return NULL;
+    }
+    return mp_hash_alloc((struct mp_hash_imp *)mh, size, 0, tag);
+}
+
+int mp_hash_tag_stats_imp(void* mh, int tag, struct mp_tag_stats *out)
+{
+    struct mp_hash_imp *imp;
+
+    if (!mh || !out) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    if (tag <= 0 || tag >= MP_TAG_MAX) {
+        MP_LOG_ERROR("tag[%d] invalid.", tag);
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    out->used = __atomic_load_n(&imp->tag_used[tag], __ATOMIC_RELAXED);
+    out->count = __atomic_load_n(&imp->tag_count[tag], __ATOMIC_RELAXED);
+    return MP_OK;
+}
+
+void *mp_hash_realloc_imp(void* mh, void *mem, size_t newsize)
+{
+    struct mp_hash_imp *imp;
+    size_t total_size;
+    struct mp_hash_slice slice = {};
+    struct mp_mem_head *mem_head;
+    void *new_mem;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+
+    if (!mem) {
+        return mp_hash_alloc_imp(mh, newsize);
+    }
+
+    if (newsize == 0) {
+        mp_hash_free_imp(mh, mem);
+        return NULL;
+    }
+
+    MP_HASH_DEBUG_CHECK(mem);
+    mem_head = mp_unpack((char *)mem, &slice);
+    if (!mem_head) {
+        MP_LOG_ERROR("mp_unpack ptr[%p] fail, maybe not valid memery for mp.", mem);
+        return NULL;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    total_size = newsize + MP_MEM_OVERHEAD;
+    if (slice.node_id < imp->node_num) {
+        if (total_size <= imp->nodes[slice.node_id].size) {
+            MP_HASH_DEBUG_ARM(mem, newsize);
+            return mem;
+        } 
+        /* 新内存保持原来的标签 */
+        new_mem = mp_hash_alloc(imp, newsize, 0, slice.tag);
+        if (!new_mem) {
+            return NULL;
+        }
+        /* 拷贝数据 */
+        memcpy(new_mem, mem, imp->nodes[slice.node_id].size - MP_MEM_OVERHEAD);
+        /* 新内存分配成功 需要释放旧的*/
+        mp_hash_free_imp(mh, mem);
+        return new_mem;
+    } else {
+        if (total_size <= mp_any_usable(&slice)) {
+            MP_HASH_DEBUG_ARM(mem, newsize);
+            return mem;
+        }
+        if (mem_head->flags & MP_MEM_F_SAMPLED) {
+            /* 地址会变化，旧样本注销，新地址不再采样 */
+            mp_prof_untrack(imp->prof, mem);
+        }
+        if (slice.tag) {
+            mp_hash_tag_account(imp, slice.tag, mp_hash_slice_usable(imp, &slice), 0);
+        }
+        mp_hash_any_realloc_imp(imp, total_size, &slice);
+        if (!slice.alloc_mem) {
+            if (slice.tag) {
+                /* 原内存保持不变，重新记上 */
+                mp_unpack((char *)mem, &slice);
+                mp_hash_tag_account(imp, slice.tag, mp_hash_slice_usable(imp, &slice), 1);
+            }
+            return NULL;
+        }
+        if (slice.tag) {
+            mp_hash_tag_account(imp, slice.tag, mp_hash_slice_usable(imp, &slice), 1);
+        }
+        new_mem = mp_pack(&slice);
+        MP_HASH_DEBUG_ARM(new_mem, newsize);
+        return new_mem;
+    } 
+}
+
+
+/* 真正归还内存 */
+static void mp_hash_release(struct mp_hash_imp *imp, void *mem)
+{
+    struct mp_mem_head *mem_head;
+    struct mp_hash_slice slice = {};
+
+    MP_HIST_START(hist_start);
+    mem_head = mp_unpack((char *)mem, &slice);
+    if (!mem_head) {
+        MP_LOG_ERROR("mp_unpack ptr[%p] fail, maybe not valid memery for mp.", mem);
+        return;
+    }
+
+    MP_LOG_DEBUG("free ptr[%p] node_id[%d],mempool_id[%d].", slice.alloc_mem, slice.node_id, slice.mempool_id);
+    if (mem_head->flags & MP_MEM_F_SAMPLED) {
+        mp_prof_untrack(imp->prof, mem);
+    }
+    if (slice.node_id != MP_HAHS_INVALID_NODE_ID && slice.node_id < imp->node_num) {
+        if (__atomic_load_n(&imp->nodes[slice.node_id].zero_on_free, __ATOMIC_RELAXED)) {
+            mp_pageheap_zero(mem, imp->nodes[slice.node_id].size - MP_MEM_OVERHEAD);
+            slice.zero = 1;
+        }
+        if (slice.tag) {
+            /* 标签子节点在有分配时已经创建 */
+            mp_hash_node_put_slice(imp, imp->nodes[slice.node_id].tags[slice.tag], &slice);
+        } else {
+            mp_hash_node_release(imp, &imp->nodes[slice.node_id], &slice);
+        }
+    }else{
+        /* 非hash表node，则采用独立方法实现 */
+        mp_hash_any_free_imp(imp, &slice);
+    }
+    MP_HIST_RECORD(imp->hist, MP_HASH_HIST_CLASS(imp, slice.node_id), MP_HASH_HIST_FREE_TYPE(imp, &slice), hist_start);
+    return;
+}
+
+#if MP_HARDEN_DEBUG
+/* 校验并投毒后放入隔离区，返回被挤出的最早释放的内存，隔离区未满时返回NULL */
+static void *mp_hash_quarantine(struct mp_hash_imp *imp, void *mem)
+{
+    void *evicted;
+    unsigned int pos;
+
+    mp_debug_check(mem);
+    mp_debug_poison(mem);
+    pthread_mutex_lock(&imp->quarantine_lck);
+    pos = imp->quarantine_pos++ % MP_HASH_QUARANTINE_NUM;
+    evicted = imp->quarantine[pos];
+    imp->quarantine[pos] = mem;
+    pthread_mutex_unlock(&imp->quarantine_lck);
+    if (evicted) {
+        mp_debug_check_poison(evicted);
+    }
+    return evicted;
+}
+
+static void mp_hash_quarantine_drain(struct mp_hash_imp *imp)
+{
+    int i;
+
+    for (i = 0; i < MP_HASH_QUARANTINE_NUM; i++) {
+        if (imp->quarantine[i]) {
+            mp_debug_check_poison(imp->quarantine[i]);
+            mp_hash_release(imp, imp->quarantine[i]);
+            imp->quarantine[i] = NULL;
+        }
+    }
+}
+#endif
+
+/* 已解析元数据头的释放 */
+static inline void mp_hash_free_slice(struct mp_hash_imp *imp, void *mem, const struct mp_hash_slice *slice)
+{
+    /* 标签统计在业务释放时扣减，不等隔离区真正归还 */
+    if (slice->tag) {
+        mp_hash_tag_account(imp, slice->tag, mp_hash_slice_usable(imp, slice), 0);
+    }
+#if MP_HARDEN_DEBUG
+    mem = mp_hash_quarantine(imp, mem);
+    if (!mem) {
+        return;
+    }
+#endif
+    mp_hash_release(imp, mem);
+}
+
+void mp_hash_free_imp(void* mh, void *mem)
+{
+    struct mp_hash_imp *imp;
+    struct mp_hash_slice slice = {};
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    MP_HASH_OWNER_CHECK(imp);
+    mp_unpack((char *)mem, &slice);
+    mp_hash_free_slice(imp, mem, &slice);
+}
+
+/*
+ * 按申请大小释放：内存池id只记录在元数据头里，仍按头部释放；size按分配时的方式找到node做校验，
+ * size对应的node不大于单元所在的node（realloc原地缩小后单元可能更大），否则说明size或指针有误；
+ * 退回glibc的单元不校验
+ */
+void mp_hash_free_sized_imp(void* mh, void *mem, size_t size)
+{
+    struct mp_hash_imp *imp;
+    struct mp_hash_slice slice = {};
+#if MP_HARDEN_LEVEL >= 1
+    struct mp_hash_node *node;
+#endif
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    MP_HASH_OWNER_CHECK(imp);
+    mp_unpack((char *)mem, &slice);
+#if MP_HARDEN_LEVEL >= 1
+    node = mp_hash_find_node(imp, size + MP_MEM_OVERHEAD);
+    MP_HARDEN_CHECK(slice.node_id >= imp->node_num || (node && slice.node_id >= node->id));
+#else
+    (void)size;
+#endif
+    mp_hash_free_slice(imp, mem, &slice);
+}
+
+size_t mp_hash_usable_size_imp(void* mh, const void *mem)
+{
+    size_t size;
+    struct mp_hash_imp *imp;
+    struct mp_hash_slice slice = {};
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return 0;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    MP_HASH_DEBUG_CHECK((void *)mem);
+    mp_unpack((char *)mem, &slice);
+    if (slice.node_id < imp->node_num) {
+        size = imp->nodes[slice.node_id].size - MP_MEM_OVERHEAD;
+    } else {
+        size = mp_any_usable(&slice) - MP_MEM_OVERHEAD;
+    }
+    /* 调试级别：业务可以使用整个单元，尾部保护字节移到单元末尾 */
+    MP_HASH_DEBUG_ARM((void *)mem, size);
+    return size;
+}
+
+/* 扩展动态内存池直到空闲单元不少于count，动态内存池数已到上限或超出预算时失败 */
+static int mp_hash_node_reserve(struct mp_hash_imp *imp, struct mp_hash_node *node, size_t count, int flags)
+{
+    int i;
+    int full;
+    int rc = MP_OK;
+    size_t idle;
+    size_t capacity;
+
+    for (;;) {
+        if (mp_hash_node_rdlock(imp, node) != MP_OK) {
+            MP_LOG_ERROR("mp_rwlock_rdlock fail");
+            return MP_ERR;
+        }
+        idle = 0;
+        for (i = 0; i < node->mempool_max_num; i++) {
+            if (node->mempools[i].handle) {
+                idle += mp_hash_mempool_avail_count_imp(node->mempools[i].handle);
+            }
+        }
+        full = (node->mempool_active >= node->mempool_max_num);
+        mp_hash_node_unlock(imp, node);
+        if (idle >= count) {
+            break;
+        }
+        if (full) {
+            MP_LOG_ERROR("node[%d] size[%lu] idle[%lu] less than reserve count[%lu].",
+                         node->id, node->size, idle, count);
+            rc = MP_ERR;
+            break;
+        }
+
+        /* 和分配路径的扩展一致：先记账再加写锁 */
+        capacity = mp_hash_grow_capacity(node);
+        if (mp_hash_budget_charge(imp, mp_hash_pool_bytes(node, capacity), 0) != MP_OK) {
+            rc = MP_ERR;
+            break;
+        }
+        if (mp_hash_node_wrlock(imp, node) != MP_OK) {
+            MP_LOG_ERROR("mp_rwlock_wrlock fail");
+            mp_hash_budget_uncharge(imp, mp_hash_pool_bytes(node, capacity));
+            return MP_ERR;
+        }
+        /* 只有最后一个空位被其它线程占用时才重试，有空位仍创建失败说明内存不足 */
+        full = (node->mempool_active >= node->mempool_max_num);
+        i = full ? -1 : mp_hash_node_grow(imp, node, capacity);
+        mp_hash_node_unlock(imp, node);
+        if (i < 0) {
+            mp_hash_budget_uncharge(imp, mp_hash_pool_bytes(node, capacity));
+            if (!full) {
+                MP_LOG_ERROR("node[%d] size[%lu] grow fail, reserve count[%lu].", node->id, node->size, count);
+                rc = MP_ERR;
+                break;
+            }
+        }
+    }
+
+    if (flags & MP_RESERVE_F_POPULATE) {
+        /* 读锁下内存池不会被释放，预取不改变内容，不影响并发分配 */
+        if (mp_hash_node_rdlock(imp, node) != MP_OK) {
+            MP_LOG_ERROR("mp_rwlock_rdlock fail");
+            return MP_ERR;
+        }
+        for (i = 0; i < node->mempool_max_num; i++) {
+            if (node->mempools[i].handle) {
+                mp_hash_mempool_populate_imp(node->mempools[i].handle);
+            }
+        }
+        mp_hash_node_unlock(imp, node);
+    }
+    return rc;
 }
 
-void *mp_hash_realloc_imp(void* mh, void *mem, size_t newsize)
+int mp_hash_reserve_imp(void* mh, size_t size, size_t count, int flags)
 {
-    struct mp_hash_imp *imp;
-    size_t total_size;
-    struct mp_hash_slice slice = {};
-    struct mp_mem_head *mem_head;
-    void *new_mem;
+    struct mp_hash_node *node;
 
     if (!mh) {
         MP_LOG_ERROR("null ptr.");
-        return NULL;
+        return MP_ERR;
     }
-
-    if (!mem) {
-        return mp_hash_alloc_imp(mh, newsize);
+    node = mp_hash_find_node((struct mp_hash_imp *)mh, size + MP_MEM_OVERHEAD);
+    if (!node) {
+        MP_LOG_ERROR("size[%lu] match no unit.", size);
+        return MP_ERR;
     }
+    return mp_hash_node_reserve((struct mp_hash_imp *)mh, node, count, flags);
+}
 
-    if (newsize == 0) {
-        mp_hash_free_imp(mh, mem);
-        return NULL;
-    }
+int mp_hash_zero_on_free_imp(void* mh, size_t size, int on)
+{
+    struct mp_hash_node *node;
 
-    mem_head = mp_unpack((char *)mem, &slice);
-    if (!mem_head) {
-        MP_LOG_ERROR("mp_unpack ptr[%p] fail, maybe not valid memery for mp.", mem);
-        return NULL;
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
     }
-    imp = (struct mp_hash_imp *)mh;
-    total_size = newsize + sizeof(struct mp_mem_head);
-    if (slice.node_id < imp->node_num) {
-        if (total_size <= imp->nodes[slice.node_id].size) {
-            return mem;
-        } 
-        new_mem = mp_hash_alloc_imp(mh, total_size);
-        if (!new_mem) {
-            return NULL;
-        }
-        /* 拷贝数据 */
-        memcpy(new_mem, mem, imp->nodes[slice.node_id].size - sizeof(struct mp_mem_head));
-        /* 新内存分配成功 需要释放旧的*/
-        mp_hash_node_put_slice(&imp->nodes[slice.node_id], &slice);
-        return new_mem;
-    } else {
-        mp_hash_any_realloc_imp(total_size, &slice);
-        if (!slice.alloc_mem) {
-            return NULL;
-        }
-        return mp_pack(&slice);
-    } 
+    node = mp_hash_find_node((struct mp_hash_imp *)mh, size + MP_MEM_OVERHEAD);
+    if (!node) {
+        MP_LOG_ERROR("size[%lu] match no unit.", size);
+        return MP_ERR;
+    }
+    __atomic_store_n(&node->zero_on_free, on ? 1 : 0, __ATOMIC_RELAXED);
+    return MP_OK;
 }
 
-
-void mp_hash_free_imp(void* mh, void *mem)
+int mp_hash_size_class_imp(void* mh, size_t size)
 {
-    struct mp_hash_imp *imp;
-    struct mp_mem_head *mem_head;
-    struct mp_hash_slice slice = {};
+    struct mp_hash_node *node;
 
-    if (!mh || !mem) {
+    if (!mh) {
         MP_LOG_ERROR("null ptr.");
-        return;
-    }
-    imp = (struct mp_hash_imp *)mh;
-    mem_head = mp_unpack((char *)mem, &slice);
-    if (!mem_head) {
-        MP_LOG_ERROR("mp_unpack ptr[%p] fail, maybe not valid memery for mp.", mem);
-        return;
+        return -1;
     }
+    node = mp_hash_find_node((struct mp_hash_imp *)mh, size + MP_MEM_OVERHEAD);
+    return node ? node->id : -1;
+}
 
-    MP_LOG_DEBUG("free ptr[%p] node_id[%d],mempool_id[%d].", slice.alloc_mem, slice.node_id, slice.mempool_id);
-    if (slice.node_id != MP_HAHS_INVALID_NODE_ID && slice.node_id < imp->node_num) {
-        mp_hash_node_put_slice(&imp->nodes[slice.node_id], &slice);
-    }else{
-        /* 非hash表node，则采用独立方法实现 */
-        mp_hash_any_free_imp(&slice);
+void *mp_hash_alloc_class_imp(void* mh, int class_id)
+{
+    int rc;
+    void *ptr;
+    struct mp_hash_node *node;
+    struct mp_hash_slice slice = {0};
+
+    /* 快速路径，class_id 由 mp_hash_size_class_imp 得到，不再校验 */
+    MP_HIST_START(hist_start);
+    MP_HASH_OWNER_CHECK((struct mp_hash_imp *)mh);
+    node = &((struct mp_hash_imp *)mh)->nodes[class_id];
+    rc = mp_hash_node_alloc((struct mp_hash_imp *)mh, node, &slice);
+    if (rc != MP_OK || !slice.alloc_mem) {
+        rc = mp_hash_any_alloc_imp((struct mp_hash_imp *)mh, node->size, 0, &slice);
+        if (rc != MP_OK || !slice.alloc_mem) {
+            MP_LOG_ERROR("get mem slice fail, size[%ld].", node->size);
+            return NULL;
+        }
     }
-    
-    return;
+    MP_HIST_RECORD(((struct mp_hash_imp *)mh)->hist, class_id, MP_HASH_HIST_ALLOC_TYPE((struct mp_hash_imp *)mh, &slice), hist_start);
+    ptr = mp_pack(&slice);
+    MP_HASH_DEBUG_ARM(ptr, node->size - MP_MEM_OVERHEAD);
+    mp_hash_prof_sample((struct mp_hash_imp *)mh, ptr, node->size - MP_MEM_OVERHEAD);
+    return ptr;
 }
 
-static void mp_hash_node_finish(struct mp_hash_node *node)
+static void mp_hash_node_finish(struct mp_hash_imp *imp, struct mp_hash_node *node)
 {
     int i;
     int rc;
 
     /* 内部接口，避免重复校验，入参由调用者校验 */
-    if (!node->mempools || node->size) {
+    if (!node->mempools) {
         return;
     }
+    for (i = 1; i < MP_TAG_MAX; i++) {
+        if (node->tags[i]) {
+            mp_hash_node_finish(imp, node->tags[i]);
+            mp_hash_free(node->tags[i]);
+            node->tags[i] = NULL;
+        }
+    }
+    if (node->depot) {
+        /* 内存池销毁前要求单元都已归还 */
+        for (i = 0; i < node->depot->full_num; i++) {
+            mp_hash_mag_drain(imp, node, node->depot->full[i]);
+            mp_hash_free(node->depot->full[i]);
+        }
+        for (i = 0; i < node->depot->empty_num; i++) {
+            mp_hash_free(node->depot->empty[i]);
+        }
+        pthread_mutex_destroy(&node->depot->lck);
+        mp_hash_free(node->depot);
+        node->depot = NULL;
+    }
     rc = mp_rwlock_wrlock(&node->mempools_rwlock);
     if (rc != MP_OK) {
         MP_LOG_ERROR("mp_rwlock_wrlock fail");
@@ -449,6 +1594,7 @@ static void mp_hash_node_finish(struct mp_hash_node *node)
     for (i = 0; i < node->mempool_max_num; i++) {
         if (node->mempools[i].handle) {
             mp_hash_mempool_free_imp(node->mempools[i].handle);
+            mp_hash_budget_uncharge(imp, mp_hash_pool_bytes(node, node->mempools[i].capacity));
             node->mempools[i].handle = NULL;
         }
     }
@@ -465,7 +1611,8 @@ static void mp_hash_node_finish(struct mp_hash_node *node)
     node->size = 0;
 }
 
-static int mp_hash_node_init(struct mp_hash_node *node, size_t size, int capacity)
+/* sub非0时初始化标签子节点：不分片，不使用线程缓存 */
+static int mp_hash_node_init(struct mp_hash_imp *imp, struct mp_hash_node *node, size_t size, int capacity, int sub)
 {
     int i;
     int rc;
@@ -477,44 +1624,94 @@ static int mp_hash_node_init(struct mp_hash_node *node, size_t size, int capacit
         MP_LOG_ERROR("mp_rwlock_init fail");
         return MP_ERR;
     }
-    node->size = sizeof(struct mp_mem_head) + size; /* 增加元数据头 */
-    node->mempool_max_num = MP_HASH_MAX_MEMPOOL_NUM;
-    node->mempool_active = MP_HASH_MAX_ACTIVE_MEMPOOL_NUM; /* 默认只启用一个池 */
+    node->size = MP_MEM_OVERHEAD + size; /* 增加元数据头 */
+    node->init_capacity = (capacity > 0) ? capacity: MP_HASH_MEMPOOL_CAPACITY;
+    node->shard_num = sub ? 1 : (unsigned char)mp_hash_shard_num(imp->shard_num, node->init_capacity);
+    node->mempool_max_num = node->shard_num + MP_HASH_MAX_DYNAMIC_MEMPOOL_NUM;
+    node->mempool_active = node->shard_num; /* 默认只启用固定内存池 */
     node->mempools = mp_hash_calloc(1, node->mempool_max_num * sizeof(struct mp_hash_mempool));
     if (!node->mempools) {
         MP_LOG_ERROR("calloc mempools fail");
         return MP_ERR;
     }
-    node->init_capacity = (capacity > 0) ? capacity: MP_HASH_MEMPOOL_CAPACITY;
-    /* 这里只申请一个内存池，后续按需要拓展 */
+    node->mag_num = (int)(MP_HASH_MAG_BYTES / node->size);
+    if (node->mag_num > MP_HASH_MAG_MAX_NUM) {
+        node->mag_num = MP_HASH_MAG_MAX_NUM;
+    } else if (node->mag_num < MP_HASH_MAG_MIN_NUM) {
+        node->mag_num = MP_HASH_MAG_MIN_NUM;
+    }
+    if (imp->tcache && !sub) {
+        node->depot = mp_hash_calloc(1, sizeof(struct mp_hash_depot));
+        if (!node->depot) {
+            MP_LOG_ERROR("calloc depot fail");
+            goto fail;
+        }
+        pthread_mutex_init(&node->depot->lck, NULL);
+    }
+    /* 初始容量平分到各个分片，后续按需要拓展 */
     for (i = 0; i < node->mempool_active; i++) {
-        node->mempools[i].capacity = node->init_capacity;
-        node->mempools[i].handle = mp_hash_mempool_create_imp(i, node->mempools[i].capacity, node->size);
+        node->mempools[i].capacity = (node->init_capacity + node->shard_num - 1) / node->shard_num;
+        node->mempools[i].handle = mp_hash_mempool_create_imp(i, node->mempools[i].capacity, node->size, imp->single);
         if (!node->mempools[i].handle) {
             MP_LOG_ERROR("p_mempool_create fail, pool capacity[%ld], size[%ld].", 
                         node->mempools[i].capacity, node->size);
             goto fail;
         }
+        /* 固定内存池总是创建，预算只记账 */
+        mp_hash_budget_charge(imp, mp_hash_pool_bytes(node, node->mempools[i].capacity), 1);
     }
     
     return MP_OK;
 fail:
-    mp_hash_node_finish(node);
+    mp_hash_node_finish(imp, node);
     return MP_ERR;
 }
 
-static int mp_hash_node_get_slice(struct mp_hash_node *node, struct mp_hash_slice *slice)
+/* 在第一个空闲位置创建动态内存池，调用者持有节点写锁并已完成预算记账，返回位置，失败返回-1 */
+static int mp_hash_node_grow(struct mp_hash_imp *imp, struct mp_hash_node *node, size_t capacity)
+{
+    int i;
+
+    (void)imp;
+    for (i = node->shard_num; i < node->mempool_max_num; i++) {
+        if (node->mempools[i].handle) {
+            continue;
+        }
+        node->mempools[i].capacity = capacity;
+        MP_HIST_START(create_start);
+        node->mempools[i].handle = mp_hash_mempool_create_imp(i, node->mempools[i].capacity, node->size, imp->single);
+        if (!node->mempools[i].handle) {
+            MP_LOG_ERROR("mempool[%d] create fail, pool addr:%p", i, node->mempools[i].handle);
+            node->mempools[i].capacity = 0;
+            return -1;
+        }
+        MP_HIST_RECORD(imp->hist, node->id, MP_HIST_E_POOL_CREATE, create_start);
+        MP_TRACE4(pool_grow, node->id, node->size, i, capacity);
+        mp_hash_active_add(imp, node, 1);
+        return i;
+    }
+    return -1;
+}
+
+static int mp_hash_node_get_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_slice *slice)
 {
     int i;
+    int n;
     int rc;
+    int shard;
+    size_t capacity;
+    int created = 0;
 
     /* 内部接口，避免重复校验，入参由调用者校验 */
 
     slice->node_id = node->id;
     /* 为了避免锁性能，这里固定内存池是不会删减，只有这些内存池不足，才使用动态内存池 */
-    for (i = 0; i < MP_HASH_MAX_ACTIVE_MEMPOOL_NUM; i++) {
-        MP_HASH_ASSERT(node->mempools[i].handle != NULL);
-        slice->alloc_mem = mp_hash_mempool_get_imp(node->mempools[i].handle);
+    /* 先取本CPU的分片，空了再依次从相邻分片偷，都空了才去动态部分 */
+    shard = mp_hash_shard_id(node);
+    for (n = 0; n < node->shard_num; n++) {
+        i = shard + n < node->shard_num ? shard + n : shard + n - node->shard_num;
+        MP_HARDEN_ASSERT(node->mempools[i].handle != NULL);
+        slice->alloc_mem = mp_hash_mempool_get_imp(node->mempools[i].handle, &slice->zero);
         if (slice->alloc_mem) {
             slice->mempool_id = i;
             slice->mempool_ptr = node->mempools[i].handle;
@@ -527,159 +1724,560 @@ static int mp_hash_node_get_slice(struct mp_hash_node *node, struct mp_hash_slic
     }
 
     /* 这里查找动态部分 读锁 性能影响还好*/
-    rc = mp_rwlock_rdlock(&node->mempools_rwlock);
+    rc = mp_hash_node_rdlock(imp, node);
     if (rc != MP_OK) {
         MP_LOG_ERROR("mp_rwlock_rdlock fail");
         return MP_ERR;
     }
 
-    for (i = MP_HASH_MAX_ACTIVE_MEMPOOL_NUM ; i < node->mempool_active; i++) {
+    for (i = node->shard_num; i < node->mempool_max_num; i++) {
         if (!node->mempools[i].handle) {
             continue;
         }
-        slice->alloc_mem = mp_hash_mempool_get_imp(node->mempools[i].handle);
+        slice->alloc_mem = mp_hash_mempool_get_imp(node->mempools[i].handle, &slice->zero);
+        if (slice->alloc_mem) {
+            slice->mempool_id = i;
+            slice->mempool_ptr = node->mempools[i].handle;
+            break;
+        }
+    }
+    mp_hash_node_unlock(imp, node);
+
+    if (slice->alloc_mem) {
+        return MP_OK;
+    }
+
+    if (mp_hash_active_num(node) >= node->mempool_max_num) {
+        return MP_ERR;
+    }
+
+    /* 预算在加锁前记账，回收回调可能会释放本节点的内存 */
+    capacity = mp_hash_grow_capacity(node);
+    if (mp_hash_budget_charge(imp, mp_hash_pool_bytes(node, capacity), 0) != MP_OK) {
+        return MP_ERR;
+    }
+
+    /* 这里需要考虑加写锁 需要动态拓展 性能影响较大*/
+    rc = mp_hash_node_wrlock(imp, node);
+    if (rc != MP_OK) {
+        MP_LOG_ERROR("mp_rwlock_wrlock fail");
+        mp_hash_budget_uncharge(imp, mp_hash_pool_bytes(node, capacity));
+        return MP_ERR;
+    }
+
+    i = mp_hash_node_grow(imp, node, capacity);
+    if (i >= 0) {
+        created = 1;
+        slice->alloc_mem = mp_hash_mempool_get_imp(node->mempools[i].handle, &slice->zero);
         if (slice->alloc_mem) {
             slice->mempool_id = i;
             slice->mempool_ptr = node->mempools[i].handle;
+            MP_LOG_WARN("increase mempool id[%d], mempool_active[%d], mempool addr[%p], size[%lu]", 
+                        slice->mempool_id, (int)node->mempool_active, node->mempools[i].handle, node->size);
+        } else {
+            MP_LOG_ERROR("mempool[%d] get fail, pool addr:%p", i, node->mempools[i].handle);
+        }
+    }
+    mp_hash_node_unlock(imp, node);
+    if (!created) {
+        mp_hash_budget_uncharge(imp, mp_hash_pool_bytes(node, capacity));
+    }
+
+    return slice->alloc_mem ? MP_OK: MP_ERR;
+}
+
+static void mp_hash_node_put_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, const struct mp_hash_slice *slice)
+{
+    int rc;
+    int i;
+    size_t left_capacity = 0;
+
+    /* 内部接口，避免重复校验，入参由调用者校验 */
+    if (!slice->alloc_mem) {
+        MP_LOG_ERROR("alloc_mem is null");
+        return;
+    }
+
+    if (slice->mempool_id >= node->mempool_max_num) {
+        MP_LOG_ERROR("mempool_id[%d] is invalid, maybe this mem[%p] over write", slice->mempool_id, slice->alloc_mem);
+        return;
+    }
+    MP_HARDEN_ASSERT(node->mempools[slice->mempool_id].handle != NULL);
+
+    if (slice->mempool_id < node->shard_num) {
+        mp_hash_mempool_put_imp(node->mempools[slice->mempool_id].handle, slice->alloc_mem, slice->zero);
+        return;
+    }
+
+    /* 这里需要加锁 */
+    rc = mp_hash_node_rdlock(imp, node);
+    if (rc != MP_OK) {
+        MP_LOG_ERROR("mp_rwlock_rdlock fail");
+        return;
+    }
+    mp_hash_mempool_put_imp(node->mempools[slice->mempool_id].handle, slice->alloc_mem, slice->zero);
+
+    /* 缩减内存池 */
+    if (mp_hash_mempool_use_count_imp(node->mempools[slice->mempool_id].handle) == 0) {
+        for (i = 0 ; i < node->mempool_max_num; i++) {
+            if (i == slice->mempool_id) {
+                continue;
+            }
+            if (!node->mempools[i].handle) {
+                continue;
+            }
+            left_capacity += mp_hash_mempool_avail_count_imp(node->mempools[i].handle);
+        }
+        MP_LOG_WARN("node[%d] total mempools avail capacity: %ld.", node->id, left_capacity);
+        MP_LOG_WARN("mempool_id[%d] capacity: %ld", slice->mempool_id, node->mempools[slice->mempool_id].capacity);
+        if (left_capacity > node->mempools[slice->mempool_id].capacity/4) {
+            mp_hash_node_unlock(imp, node);
+            mp_hash_node_wrlock(imp, node);
+            /* 换锁期间其它线程可能又从该内存池分配了 */
+            if (node->mempools[slice->mempool_id].handle
+                && mp_hash_mempool_use_count_imp(node->mempools[slice->mempool_id].handle) == 0) {
+                MP_TRACE4(pool_shrink, node->id, node->size, slice->mempool_id,
+                          node->mempools[slice->mempool_id].capacity);
+                mp_hash_mempool_free_imp(node->mempools[slice->mempool_id].handle);
+                mp_hash_budget_uncharge(imp, mp_hash_pool_bytes(node, node->mempools[slice->mempool_id].capacity));
+                node->mempools[slice->mempool_id].capacity = 0;
+                mp_hash_active_add(imp, node, -1);
+                MP_LOG_WARN("decrease mempool id[%d], mempool active[%d], mempool addr [%p]", 
+                            slice->mempool_id, (int)node->mempool_active, node->mempools[slice->mempool_id].handle);
+                node->mempools[slice->mempool_id].handle = NULL;
+            }
+        }
+    }
+    mp_hash_node_unlock(imp, node);
+    return;
+}
+
+/* 从内存池逐个装满一批，返回装入个数 */
+static int mp_hash_mag_fill(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_mag *mag)
+{
+    struct mp_hash_slice slice;
+
+    while (mag->count < node->mag_num) {
+        if (mp_hash_node_get_slice(imp, node, &slice) != MP_OK || !slice.alloc_mem) {
             break;
         }
+        mag->mem[mag->count] = slice.alloc_mem;
+        mag->pool[mag->count] = (unsigned char)slice.mempool_id;
+        mag->zero[mag->count] = (unsigned char)slice.zero;
+        mag->count++;
+    }
+    return mag->count;
+}
+
+/* 批次里的单元逐个还给内存池 */
+static void mp_hash_mag_drain(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_mag *mag)
+{
+    struct mp_hash_slice slice;
+
+    slice.node_id = node->id;
+    while (mag->count > 0) {
+        mag->count--;
+        slice.mempool_id = mag->pool[mag->count];
+        slice.zero = mag->zero[mag->count];
+        slice.mempool_ptr = node->mempools[slice.mempool_id].handle;
+        slice.alloc_mem = mag->mem[mag->count];
+        mp_hash_node_put_slice(imp, node, &slice);
+    }
+}
+
+/* 从中转缓存取一个批次，full为0时取空批次，没有时返回NULL */
+static struct mp_hash_mag *mp_hash_depot_pop(struct mp_hash_depot *depot, int full)
+{
+    struct mp_hash_mag *mag = NULL;
+
+    pthread_mutex_lock(&depot->lck);
+    if (full && depot->full_num > 0) {
+        mag = depot->full[--depot->full_num];
+    } else if (!full && depot->empty_num > 0) {
+        mag = depot->empty[--depot->empty_num];
+    }
+    pthread_mutex_unlock(&depot->lck);
+    return mag;
+}
+
+/* 批次放回中转缓存，按count区分满和空，已满时返回MP_ERR */
+static int mp_hash_depot_push(struct mp_hash_depot *depot, struct mp_hash_mag *mag)
+{
+    int rc = MP_ERR;
+
+    pthread_mutex_lock(&depot->lck);
+    if (mag->count && depot->full_num < MP_HASH_DEPOT_MAX_NUM) {
+        depot->full[depot->full_num++] = mag;
+        rc = MP_OK;
+    } else if (!mag->count && depot->empty_num < MP_HASH_DEPOT_MAX_NUM) {
+        depot->empty[depot->empty_num++] = mag;
+        rc = MP_OK;
+    }
+    pthread_mutex_unlock(&depot->lck);
+    return rc;
+}
+
+static struct mp_hash_mag *mp_hash_depot_get_empty(struct mp_hash_depot *depot)
+{
+    struct mp_hash_mag *mag;
+
+    mag = mp_hash_depot_pop(depot, 0);
+    if (!mag) {
+        mag = mp_hash_calloc(1, sizeof(struct mp_hash_mag));
+    }
+    return mag;
+}
+
+static void mp_hash_depot_put_empty(struct mp_hash_depot *depot, struct mp_hash_mag *mag)
+{
+    if (mp_hash_depot_push(depot, mag) != MP_OK) {
+        mp_hash_free(mag);
+    }
+}
+
+/* 中转缓存的满批次全部还给内存池，空批次保留 */
+static void mp_hash_depot_flush(struct mp_hash_imp *imp, struct mp_hash_node *node)
+{
+    struct mp_hash_mag *mag;
+
+    if (!node->depot) {
+        return;
+    }
+    while ((mag = mp_hash_depot_pop(node->depot, 1)) != NULL) {
+        MP_TRACE2(tcache_drain, node->id, mag->count);
+        mp_hash_mag_drain(imp, node, mag);
+        mp_hash_depot_put_empty(node->depot, mag);
+    }
+}
+
+/* 线程缓存的单元全部还给内存池，释放批次 */
+static void mp_hash_tcache_drain(struct mp_hash_imp *imp, struct mp_hash_tcache *tc)
+{
+    int i;
+
+    for (i = 0; i < imp->node_num; i++) {
+        if (tc->bins[i].loaded) {
+            mp_hash_mag_drain(imp, &imp->nodes[i], tc->bins[i].loaded);
+            mp_hash_free(tc->bins[i].loaded);
+        }
+        if (tc->bins[i].prev) {
+            mp_hash_mag_drain(imp, &imp->nodes[i], tc->bins[i].prev);
+            mp_hash_free(tc->bins[i].prev);
+        }
+    }
+}
+
+/* 线程退出时把缓存的单元还给内存池 */
+static void mp_hash_tcache_destroy(void *arg)
+{
+    struct mp_hash_tcache *tc = (struct mp_hash_tcache *)arg;
+    struct mp_hash_imp *imp = tc->imp;
+
+    pthread_mutex_lock(&imp->tcache_lck);
+    QUEUE_REMOVE(&tc->q);
+    pthread_mutex_unlock(&imp->tcache_lck);
+    mp_hash_tcache_drain(imp, tc);
+    mp_hash_free(tc);
+}
+
+static void mp_hash_tcache_init(struct mp_hash_imp *imp)
+{
+    QUEUE_INIT(&imp->tcache_list);
+    if (!imp->tcache) {
+        return;
+    }
+    if (pthread_key_create(&imp->tcache_key, mp_hash_tcache_destroy) != 0) {
+        MP_LOG_ERROR("pthread_key_create fail, thread cache disabled.");
+        imp->tcache = 0;
+        return;
+    }
+    pthread_mutex_init(&imp->tcache_lck, NULL);
+}
+
+/* 句柄销毁，调用者保证没有线程还在使用；在内存池销毁前把所有线程缓存的单元还回去 */
+static void mp_hash_tcache_finish(struct mp_hash_imp *imp)
+{
+    QUEUE *q;
+    struct mp_hash_tcache *tc;
+
+    if (!imp->tcache) {
+        return;
+    }
+    pthread_key_delete(imp->tcache_key);
+    while (!QUEUE_EMPTY(&imp->tcache_list)) {
+        q = QUEUE_HEAD(&imp->tcache_list);
+        QUEUE_REMOVE(q);
+        tc = QUEUE_DATA(q, struct mp_hash_tcache, q);
+        mp_hash_tcache_drain(imp, tc);
+        mp_hash_free(tc);
     }
-    mp_rwlock_unlock(&node->mempools_rwlock);
+    pthread_mutex_destroy(&imp->tcache_lck);
+    imp->tcache = 0;
+}
 
-    if (slice->alloc_mem) {
-        return MP_OK;
-    }
+static struct mp_hash_tcache *mp_hash_tcache_get(struct mp_hash_imp *imp)
+{
+    struct mp_hash_tcache *tc;
 
-    /* 这里需要考虑加写锁 需要动态拓展 性能影响较大*/
-    rc = mp_rwlock_wrlock(&node->mempools_rwlock);
-    if (rc != MP_OK) {
-        MP_LOG_ERROR("mp_rwlock_wrlock fail");
-        return MP_ERR;
+    tc = pthread_getspecific(imp->tcache_key);
+    if (__builtin_expect(tc != NULL, 1)) {
+        return tc;
+    }
+    tc = mp_hash_calloc(1, sizeof(struct mp_hash_tcache) + imp->node_num * sizeof(struct mp_hash_tcache_bin));
+    if (!tc) {
+        return NULL;
+    }
+    tc->imp = imp;
+    if (pthread_setspecific(imp->tcache_key, tc) != 0) {
+        mp_hash_free(tc);
+        return NULL;
     }
+    pthread_mutex_lock(&imp->tcache_lck);
+    QUEUE_INSERT_TAIL(&imp->tcache_list, &tc->q);
+    pthread_mutex_unlock(&imp->tcache_lck);
+    return tc;
+}
 
-    for (i = MP_HASH_MAX_ACTIVE_MEMPOOL_NUM; i < node->mempool_max_num; i++) {
-        if (node->mempools[i].handle) {
-            continue;
+/* loaded和prev都空了：从中转缓存换一个满批次，没有时直接从内存池装 */
+static int mp_hash_tcache_refill(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_tcache_bin *bin)
+{
+    struct mp_hash_mag *mag;
+
+    mag = mp_hash_depot_pop(node->depot, 1);
+    if (mag) {
+        MP_TRACE2(tcache_refill, node->id, mag->count);
+        if (bin->prev) {
+            mp_hash_depot_put_empty(node->depot, bin->prev);
         }
-        node->mempools[i].capacity = (node->mempool_active + 1) * node->init_capacity;
-        node->mempools[i].handle = mp_hash_mempool_create_imp(i, node->mempools[i].capacity, node->size);
-        if (!node->mempools[i].handle) {
-            MP_LOG_ERROR("mempool[%d] create fail, pool addr:%p", i, node->mempools[i].handle);
-            break;
+        bin->prev = bin->loaded;
+        bin->loaded = mag;
+        return MP_OK;
+    }
+    if (!bin->loaded) {
+        bin->loaded = mp_hash_depot_get_empty(node->depot);
+        if (!bin->loaded) {
+            return MP_ERR;
         }
-        node->mempool_active++;
-        slice->alloc_mem = mp_hash_mempool_get_imp(node->mempools[i].handle);
-        if (slice->alloc_mem) {
-            slice->mempool_id = i;
-            slice->mempool_ptr = node->mempools[i].handle;
-            MP_LOG_WARN("increase mempool id[%d], mempool_active[%d], mempool addr[%p], size[%lu]", 
-                        slice->mempool_id, (int)node->mempool_active, node->mempools[i].handle, node->size);
+    }
+    MP_TRACE2(tcache_fill, node->id, node->mag_num);
+    return mp_hash_mag_fill(imp, node, bin->loaded) ? MP_OK : MP_ERR;
+}
+
+/* loaded和prev都满了：prev整批交给中转缓存，中转缓存满时还给内存池 */
+static int mp_hash_tcache_flush(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_tcache_bin *bin)
+{
+    struct mp_hash_mag *mag = bin->prev;
+
+    if (mag) {
+        if (mp_hash_depot_push(node->depot, mag) == MP_OK) {
+            MP_TRACE2(tcache_flush, node->id, mag->count);
+            mag = NULL;
         } else {
-            MP_LOG_ERROR("mempool[%d] get fail, pool addr:%p", i, node->mempools[i].handle);
+            MP_TRACE2(tcache_drain, node->id, mag->count);
+            mp_hash_mag_drain(imp, node, mag);
         }
-        break;
     }
-    mp_rwlock_unlock(&node->mempools_rwlock);
-
-    return slice->alloc_mem ? MP_OK: MP_ERR;
+    if (!mag) {
+        mag = mp_hash_depot_get_empty(node->depot);
+        if (!mag) {
+            return MP_ERR;
+        }
+    }
+    bin->prev = bin->loaded;
+    bin->loaded = mag;
+    return MP_OK;
 }
 
-static void mp_hash_node_put_slice(struct mp_hash_node *node, const struct mp_hash_slice *slice)
+static int mp_hash_tcache_get_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, struct mp_hash_slice *slice)
 {
-    int rc;
-    int i;
-    size_t left_capacity = 0;
+    struct mp_hash_mag *mag;
+    struct mp_hash_tcache *tc;
+    struct mp_hash_tcache_bin *bin;
 
-    /* 内部接口，避免重复校验，入参由调用者校验 */
-    if (!slice->alloc_mem) {
-        MP_LOG_ERROR("alloc_mem is null");
-        return;
+    tc = mp_hash_tcache_get(imp);
+    if (!tc) {
+        return mp_hash_node_get_slice(imp, node, slice);
     }
-
-    if (slice->mempool_id >= node->mempool_max_num) {
-        MP_LOG_ERROR("mempool_id[%d] is invalid, maybe this mem[%p] over write", slice->mempool_id, slice->alloc_mem);
-        return;
+    bin = &tc->bins[node->id];
+    if (!bin->loaded || !bin->loaded->count) {
+        if (bin->prev && bin->prev->count) {
+            mag = bin->prev;
+            bin->prev = bin->loaded;
+            bin->loaded = mag;
+        } else if (mp_hash_tcache_refill(imp, node, bin) != MP_OK) {
+            slice->alloc_mem = NULL;
+            return MP_ERR;
+        }
     }
-    MP_HASH_ASSERT(node->mempools[slice->mempool_id].handle != NULL);
+    mag = bin->loaded;
+    mag->count--;
+    slice->node_id = node->id;
+    slice->mempool_id = mag->pool[mag->count];
+    slice->zero = mag->zero[mag->count];
+    slice->mempool_ptr = node->mempools[slice->mempool_id].handle;
+    slice->alloc_mem = mag->mem[mag->count];
+    return MP_OK;
+}
 
-    if (slice->mempool_id < MP_HASH_MAX_ACTIVE_MEMPOOL_NUM) {
-        mp_hash_mempool_put_imp(node->mempools[slice->mempool_id].handle, slice->alloc_mem);
-        return;
-    }
+/* 返回MP_ERR时由调用者直接还给内存池 */
+static int mp_hash_tcache_put_slice(struct mp_hash_imp *imp, struct mp_hash_node *node, const struct mp_hash_slice *slice)
+{
+    struct mp_hash_mag *mag;
+    struct mp_hash_tcache *tc;
+    struct mp_hash_tcache_bin *bin;
 
-    /* 这里需要加锁 */
-    rc = mp_rwlock_rdlock(&node->mempools_rwlock);
-    if (rc != MP_OK) {
-        MP_LOG_ERROR("mp_rwlock_rdlock fail");
-        return;
+    if (slice->mempool_id >= node->mempool_max_num) {
+        return MP_ERR;
     }
-    mp_hash_mempool_put_imp(node->mempools[slice->mempool_id].handle, slice->alloc_mem);
-
-    /* 缩减内存池 */
-    if (mp_hash_mempool_use_count_imp(node->mempools[slice->mempool_id].handle) == 0) {
-        for (i = 0 ; i < node->mempool_active; i++) {
-            if (i == slice->mempool_id) {
-                continue;
-            }
-            if (!node->mempools[i].handle) {
-                continue;
-            }
-            left_capacity += mp_hash_mempool_avail_count_imp(node->mempools[i].handle);
-        }
-        MP_LOG_WARN("node[%d] total mempools avail capacity: %ld.", node->id, left_capacity);
-        MP_LOG_WARN("mempool_id[%d] capacity: %ld", slice->mempool_id, node->mempools[slice->mempool_id].capacity);
-        if (left_capacity > node->mempools[slice->mempool_id].capacity/4) {
-            mp_rwlock_unlock(&node->mempools_rwlock);
-            mp_rwlock_wrlock(&node->mempools_rwlock);
-            if (node->mempools[slice->mempool_id].handle) {
-                mp_hash_mempool_free_imp(node->mempools[slice->mempool_id].handle);
-                node->mempools[slice->mempool_id].capacity = 0;
-                node->mempool_active--;
-                MP_LOG_WARN("decrease mempool id[%d], mempool active[%d], mempool addr [%p]", 
-                            slice->mempool_id, (int)node->mempool_active, node->mempools[slice->mempool_id].handle);
-                node->mempools[slice->mempool_id].handle = NULL;
-            }
+    tc = mp_hash_tcache_get(imp);
+    if (!tc) {
+        return MP_ERR;
+    }
+    bin = &tc->bins[node->id];
+    if (!bin->loaded || bin->loaded->count == node->mag_num) {
+        if (bin->prev && !bin->prev->count) {
+            mag = bin->prev;
+            bin->prev = bin->loaded;
+            bin->loaded = mag;
+        } else if (mp_hash_tcache_flush(imp, node, bin) != MP_OK) {
+            return MP_ERR;
         }
     }
-    mp_rwlock_unlock(&node->mempools_rwlock);
-    return;
+    mag = bin->loaded;
+    mag->mem[mag->count] = slice->alloc_mem;
+    mag->pool[mag->count] = (unsigned char)slice->mempool_id;
+    mag->zero[mag->count] = (unsigned char)slice->zero;
+    mag->count++;
+    return MP_OK;
 }
 
-static inline void mp_hash_any_realloc_imp(size_t new_size, struct mp_hash_slice *slice)
+/* 退回glibc的内存按实际可用大小记账，释放时才能对上 */
+static inline void mp_hash_any_realloc_imp(struct mp_hash_imp *imp, size_t new_size, struct mp_hash_slice *slice)
 {
+    size_t old_bytes;
+    void *new_mem;
+
     /* 内部接口，避免重复校验，入参由调用者校验 */
     if (!slice->alloc_mem) {
         MP_LOG_ERROR("free memery null");
     }
-    slice->alloc_mem =  mp_hash_realloc(slice->alloc_mem, new_size);
+    new_size += MP_MEM_ANY_PAD;
+    old_bytes = malloc_usable_size(mp_any_base(slice));
+    if (new_size > old_bytes && mp_hash_budget_charge(imp, new_size - old_bytes, 0) != MP_OK) {
+        slice->alloc_mem = NULL;
+        return;
+    }
+    new_mem = mp_hash_realloc(mp_any_base(slice), new_size);
+    if (!new_mem) {
+        if (new_size > old_bytes) {
+            mp_hash_budget_uncharge(imp, new_size - old_bytes);
+        }
+        slice->alloc_mem = NULL;
+        return;
+    }
+    /* 修正为实际大小 */
+    mp_hash_budget_charge(imp, malloc_usable_size(new_mem), 1);
+    mp_hash_budget_uncharge(imp, new_size > old_bytes ? new_size : old_bytes);
+    slice->alloc_mem = (char *)new_mem + MP_MEM_ANY_PAD;
 }
 
-static inline int mp_hash_any_alloc_imp(size_t alloc_size, struct mp_hash_slice *slice)
+static inline int mp_hash_any_alloc_imp(struct mp_hash_imp *imp, size_t alloc_size, int zero, struct mp_hash_slice *slice)
 {
+    void *raw;
+
     /* 内部接口，避免重复校验，入参由调用者校验 */
-    slice->alloc_mem = mp_hash_malloc(alloc_size);
-    MP_LOG_DEBUG("alloc memery [%p] by (default malloc)", slice->alloc_mem);
+    alloc_size += MP_MEM_ANY_PAD;
     slice->mempool_id = MP_HASH_INVALID_MEMPOOL_ID;
     slice->mempool_ptr = NULL;
     slice->node_id = MP_HAHS_INVALID_NODE_ID;
-    if (!slice->alloc_mem) {
+    if (mp_hash_budget_charge(imp, alloc_size, 0) != MP_OK) {
+        slice->alloc_mem = NULL;
+        MP_LOG_DEBUG("budget exceed, size[%lu]", alloc_size);
+        return MP_ERR;
+    }
+    /* glibc对新映射的大块calloc不再清零 */
+    raw = zero ? mp_hash_calloc(1, alloc_size) : mp_hash_malloc(alloc_size);
+    slice->zero = zero;
+    MP_LOG_DEBUG("alloc memery [%p] by (default malloc)", raw);
+    MP_TRACE2(fallback_alloc, alloc_size, raw);
+    if (!raw) {
+        slice->alloc_mem = NULL;
+        mp_hash_budget_uncharge(imp, alloc_size);
         MP_LOG_ERROR("mp_hash_malloc memery fail, size[%ld]", alloc_size);
         return MP_ERR;
     }
+    slice->alloc_mem = (char *)raw + MP_MEM_ANY_PAD;
+    mp_hash_budget_charge(imp, malloc_usable_size(raw) - alloc_size, 1);
     return MP_OK;
 }
 
-static inline void mp_hash_any_free_imp(const struct mp_hash_slice *slice)
+static inline void mp_hash_any_free_imp(struct mp_hash_imp *imp, const struct mp_hash_slice *slice)
 {
     /* 内部接口，避免重复校验，入参由调用者校验 */
-    MP_HASH_ASSERT(slice->mempool_id == MP_HASH_INVALID_MEMPOOL_ID);
+    MP_HARDEN_ASSERT(slice->mempool_id == MP_HASH_INVALID_MEMPOOL_ID);
     if (slice->alloc_mem) {
-        MP_LOG_DEBUG("free memery [%p] by (default free)", slice->alloc_mem);
-        mp_hash_free(slice->alloc_mem);
+        MP_LOG_DEBUG("free memery [%p] by (default free)", mp_any_base(slice));
+        MP_TRACE1(fallback_free, mp_any_base(slice));
+        mp_hash_budget_uncharge(imp, malloc_usable_size(mp_any_base(slice)));
+        mp_hash_free(mp_any_base(slice));
     }
     return;
 }
 
+int mp_hash_set_budget_imp(void* mh, size_t limit)
+{
+    struct mp_hash_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    imp->budget.soft = limit - limit / MP_HASH_BUDGET_SOFT_DIV;
+    imp->budget.limit = limit;
+    return MP_OK;
+}
+
+int mp_hash_add_reclaim_imp(void* mh, size_t (*fn)(void *arg, size_t need), void *arg)
+{
+    struct mp_hash_imp *imp;
+
+    if (!mh || !fn) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    pthread_mutex_lock(&imp->budget.reclaim_lck);
+    if (imp->budget.reclaim_num >= MP_HASH_RECLAIM_MAX_NUM) {
+        pthread_mutex_unlock(&imp->budget.reclaim_lck);
+        MP_LOG_ERROR("reclaim callbacks exceed max[%d].", MP_HASH_RECLAIM_MAX_NUM);
+        return MP_ERR;
+    }
+    imp->budget.reclaims[imp->budget.reclaim_num].fn = fn;
+    imp->budget.reclaims[imp->budget.reclaim_num].arg = arg;
+    imp->budget.reclaim_num++;
+    pthread_mutex_unlock(&imp->budget.reclaim_lck);
+    return MP_OK;
+}
+
+int mp_hash_get_budget_imp(void* mh, size_t *limit, size_t *used)
+{
+    struct mp_hash_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    if (limit) {
+        *limit = imp->budget.limit;
+    }
+    if (used) {
+        *used = __atomic_load_n(&imp->budget.used, __ATOMIC_RELAXED);
+    }
+    return MP_OK;
+}
+
 static inline void mp_hash_swap(struct mp_hash_node *a, struct mp_hash_node *b)
 {
     struct mp_hash_node tmp;
@@ -769,4 +2367,230 @@ static int mp_hash_mem_skip_search(struct mp_hash_node *nodes, int nodes_num, si
         }
 	}
 	return index;
-}
\ No newline at end of file
+}
+int mp_hash_get_hist_imp(void* mh, int class_id, int type, struct mp_hist *out)
+{
+    struct mp_hash_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    if (!imp->hist) {
+        return MP_ERR;
+    }
+    return mp_hist_ctx_merge(imp->hist, class_id, type, out);
+}
+
+int mp_hash_prof_set_rate_imp(void* mh, size_t rate)
+{
+    struct mp_hash_imp *imp;
+    struct mp_prof_ctx *prof;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    if (rate && !__atomic_load_n(&imp->prof, __ATOMIC_ACQUIRE)) {
+        prof = mp_prof_ctx_create();
+        if (!prof) {
+            return MP_ERR;
+        }
+        if (!__sync_bool_compare_and_swap(&imp->prof, NULL, prof)) {
+            mp_prof_ctx_destroy(prof);
+        }
+    }
+    if (rate) {
+        mp_prof_set_rate(imp->prof, rate);
+    }
+    __atomic_store_n(&imp->prof_rate, rate, __ATOMIC_RELEASE);
+    return MP_OK;
+}
+
+int mp_hash_prof_dump_imp(void* mh, const char *path)
+{
+    struct mp_hash_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    if (!imp->prof) {
+        MP_LOG_ERROR("heap profile not started.");
+        return MP_ERR;
+    }
+    return mp_prof_dump(imp->prof, path);
+}
+
+/* 线程缓存、中转缓存和隔离区的单元还给内存池，之后内存池里已取出的单元都在业务手里；调用者保证没有其它线程使用句柄 */
+static void mp_hash_cache_flush(struct mp_hash_imp *imp)
+{
+    int i;
+    QUEUE *q;
+    struct mp_hash_tcache *tc;
+
+#if MP_HARDEN_DEBUG
+    pthread_mutex_lock(&imp->quarantine_lck);
+    mp_hash_quarantine_drain(imp);
+    pthread_mutex_unlock(&imp->quarantine_lck);
+#endif
+    if (imp->tcache) {
+        /* 线程仍持有缓存，批次只清空不释放 */
+        pthread_mutex_lock(&imp->tcache_lck);
+        QUEUE_FOREACH(q, &imp->tcache_list) {
+            tc = QUEUE_DATA(q, struct mp_hash_tcache, q);
+            for (i = 0; i < imp->node_num; i++) {
+                if (tc->bins[i].loaded) {
+                    mp_hash_mag_drain(imp, &imp->nodes[i], tc->bins[i].loaded);
+                }
+                if (tc->bins[i].prev) {
+                    mp_hash_mag_drain(imp, &imp->nodes[i], tc->bins[i].prev);
+                }
+            }
+        }
+        pthread_mutex_unlock(&imp->tcache_lck);
+    }
+    for (i = 0; i < imp->node_num; i++) {
+        mp_hash_depot_flush(imp, &imp->nodes[i]);
+    }
+}
+
+struct mp_hash_live_ctx
+{
+    size_t  size;
+    int     count;
+    void    (*fn)(void *mem, size_t size, void *arg);
+    void    *arg;
+};
+
+static void mp_hash_live_slot(void *ele, void *arg)
+{
+    struct mp_hash_live_ctx *ctx = (struct mp_hash_live_ctx *)arg;
+
+    ctx->count++;
+    if (ctx->fn) {
+        ctx->fn((char *)ele + MP_MEM_DATA_OFFSET, ctx->size, ctx->arg);
+    }
+}
+
+static void mp_hash_node_foreach_live(struct mp_hash_node *node, struct mp_hash_live_ctx *ctx)
+{
+    int i;
+
+    if (!node->mempools) {
+        return;
+    }
+    ctx->size = node->size - MP_MEM_OVERHEAD;
+    mp_rwlock_rdlock(&node->mempools_rwlock);
+    for (i = 0; i < node->mempool_max_num; i++) {
+        if (node->mempools[i].handle) {
+            mp_hash_mempool_foreach_used_imp(node->mempools[i].handle, mp_hash_live_slot, ctx);
+        }
+    }
+    mp_rwlock_unlock(&node->mempools_rwlock);
+    for (i = 1; i < MP_TAG_MAX; i++) {
+        if (node->tags[i]) {
+            mp_hash_node_foreach_live(node->tags[i], ctx);
+        }
+    }
+}
+
+int mp_hash_foreach_live_imp(void* mh, void (*fn)(void *mem, size_t size, void *arg), void *arg)
+{
+    int i;
+    struct mp_hash_imp *imp;
+    struct mp_hash_live_ctx ctx = {};
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return MP_ERR;
+    }
+    imp = (struct mp_hash_imp *)mh;
+    MP_HASH_OWNER_CHECK(imp);
+    mp_hash_cache_flush(imp);
+    ctx.fn = fn;
+    ctx.arg = arg;
+    for (i = 0; i < imp->node_num; i++) {
+        mp_hash_node_foreach_live(&imp->nodes[i], &ctx);
+    }
+    return ctx.count;
+}
+
+#if MP_HARDEN_LEVEL >= 1
+/* 泄漏报告最多逐个打印的单元数 */
+#define MP_HASH_LEAK_PRINT_NUM  16
+
+static void mp_hash_leak_print(void *mem, size_t size, void *arg)
+{
+    int *printed = (int *)arg;
+
+    if ((*printed)++ < MP_HASH_LEAK_PRINT_NUM) {
+        MP_LOG_WARN("leak ptr[%p] size[%lu].", mem, size);
+    }
+}
+
+/* 句柄销毁时报告仍在使用中的内存池单元，退回glibc的分配不在其中 */
+static void mp_hash_leak_report(struct mp_hash_imp *imp)
+{
+    int printed = 0;
+    int count;
+
+    if (!imp->nodes) {
+        return;
+    }
+    count = mp_hash_foreach_live_imp(imp, mp_hash_leak_print, &printed);
+    if (count > 0) {
+        MP_LOG_WARN("%d slots not freed before destroy.", count);
+        /* 之后释放内存池时断言失败，先把报告输出 */
+        fflush(stdout);
+    }
+}
+#endif
+
+int mp_hash_auto_units_imp(size_t min_size, size_t max_size, unsigned int max_waste_pct, int capacity,
+                           struct mp_unit *arr, int arr_num)
+{
+    int i;
+    int shift;
+    int first;
+    int last;
+
+    if (!arr || !min_size || min_size > max_size || !max_waste_pct || capacity <= 0) {
+        MP_LOG_ERROR("invalid param, min[%lu] max[%lu] waste[%u] capacity[%d].",
+                     min_size, max_size, max_waste_pct, capacity);
+        return MP_ERR;
+    }
+    /*
+     * 每个2的幂区间分 1<<shift 级，相对浪费小于 1/(1<<shift) <= max_waste_pct/100；
+     * 第0组固定每16字节一级（单元按16字节对齐，不能更细），只有size >= 1600/max_waste_pct 时满足比例，
+     * 更小的size浪费小于16字节
+     */
+    for (shift = 0; shift <= MP_HASH_LADDER_MAX_SHIFT; shift++) {
+        if (((size_t)max_waste_pct << shift) >= 100) {
+            break;
+        }
+    }
+    if (shift > MP_HASH_LADDER_MAX_SHIFT) {
+        MP_LOG_ERROR("waste[%u%%] too small, min is 1%%.", max_waste_pct);
+        return MP_ERR;
+    }
+    first = mp_hash_ladder_index(min_size, shift);
+    last = mp_hash_ladder_index(max_size, shift);
+    if (min_size * max_waste_pct < ((size_t)100 << MP_HASH_LADDER_QUANTUM_SHIFT)) {
+        MP_LOG_DEBUG("size below %lu may waste more than %u%%, up to %d bytes.",
+                     ((size_t)100 << MP_HASH_LADDER_QUANTUM_SHIFT) / max_waste_pct, max_waste_pct,
+                     (1 << MP_HASH_LADDER_QUANTUM_SHIFT) - 1);
+    }
+    if (last - first + 1 > arr_num || last - first + 1 > MP_HASH_SIZE_TYPE_MAX_NUM) {
+        MP_LOG_ERROR("too many classes[%d] for range[%lu, %lu].", last - first + 1, min_size, max_size);
+        return MP_ERR;
+    }
+    for (i = first; i <= last; i++) {
+        arr[i - first].size = mp_hash_ladder_size(i, shift);
+        arr[i - first].capacity = capacity;
+    }
+    return last - first + 1;
+}
@@ -7,11 +7,33 @@ extern "C" {
 #endif
 
 struct mp_unit;
-void *mp_hash_create_imp(const struct mp_unit *arr, int arr_num);
+struct mp_attr;
+void *mp_hash_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr);
 void *mp_hash_alloc_imp(void* mh, size_t size);
 void *mp_hash_realloc_imp(void* mh, void *mem, size_t newsize);
 void mp_hash_free_imp(void* mh, void *mem);
+void mp_hash_free_sized_imp(void* mh, void *mem, size_t size);
 void mp_hash_destroy_imp(void* mh);
+int mp_hash_size_class_imp(void* mh, size_t size);
+void *mp_hash_alloc_class_imp(void* mh, int class_id);
+int mp_hash_set_budget_imp(void* mh, size_t limit);
+int mp_hash_add_reclaim_imp(void* mh, size_t (*fn)(void *arg, size_t need), void *arg);
+int mp_hash_get_budget_imp(void* mh, size_t *limit, size_t *used);
+struct mp_hist;
+int mp_hash_get_hist_imp(void* mh, int class_id, int type, struct mp_hist *out);
+int mp_hash_prof_set_rate_imp(void* mh, size_t rate);
+int mp_hash_prof_dump_imp(void* mh, const char *path);
+size_t mp_hash_usable_size_imp(void* mh, const void *mem);
+int mp_hash_reserve_imp(void* mh, size_t size, size_t count, int flags);
+void *mp_hash_calloc_imp(void* mh, size_t size);
+int mp_hash_zero_on_free_imp(void* mh, size_t size, int on);
+void *mp_hash_alloc_tagged_imp(void* mh, int tag, size_t size);
+struct mp_tag_stats;
+int mp_hash_tag_stats_imp(void* mh, int tag, struct mp_tag_stats *out);
+int mp_hash_foreach_live_imp(void* mh, void (*fn)(void *mem, size_t size, void *arg), void *arg);
+/* 按size范围生成分配单元阶梯，返回单元个数，失败返回MP_ERR */
+int mp_hash_auto_units_imp(size_t min_size, size_t max_size, unsigned int max_waste_pct, int capacity,
+                           struct mp_unit *arr, int arr_num);
 
 #ifdef __cplusplus
 }
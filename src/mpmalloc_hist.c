@@ -0,0 +1,330 @@
+#include "mpmalloc.h"
+#include "mpmalloc_hist.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_hist_calloc
+#define mp_hist_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_hist_free
+#define mp_hist_free(P) free(P)
+#endif
+
+/* 每段线性划分的份数（2的幂） */
+#define MP_HIST_SUB_BITS        2
+#define MP_HIST_SUB_NUM         (1 << MP_HIST_SUB_BITS)
+
+/* 校准tsc频率的时长 */
+#define MP_HIST_CALIBRATE_NS    10000000ull
+
+struct mp_hist_class
+{
+    struct mp_hist          h[MP_HIST_E_MAX];
+};
+
+/* 线程缓冲，只有所属线程写，单元统计第一次记录时才分配 */
+struct mp_hist_buf
+{
+    struct mp_hist_buf      *next;
+    struct mp_hist_ctx      *ctx;
+    struct mp_hist_class    *cls[0];
+};
+
+struct mp_hist_ctx
+{
+    pthread_key_t           key;
+    pthread_mutex_t         lck;        /* 保护bufs链表和retired */
+    int                     class_num;
+    unsigned long           gen;        /* 区分同一地址上先后创建的ctx */
+    struct mp_hist_buf      *bufs;
+    struct mp_hist_class    **retired;  /* 已退出线程的统计，按单元合并 */
+};
+
+/* 线程最近使用的缓冲，避免每次pthread_getspecific */
+static __thread struct mp_hist_ctx *g_hist_last_ctx;
+static __thread unsigned long g_hist_last_gen;
+static __thread struct mp_hist_buf *g_hist_last_buf;
+
+static unsigned long g_hist_gen;
+
+static inline int mp_hist_bucket(uint64_t v)
+{
+    int msb;
+
+    if (v < (2 * MP_HIST_SUB_NUM)) {
+        return (int)v;
+    }
+    msb = 63 - __builtin_clzll(v);
+    return (msb - MP_HIST_SUB_BITS + 1) * MP_HIST_SUB_NUM + (int)((v >> (msb - MP_HIST_SUB_BITS)) & (MP_HIST_SUB_NUM - 1));
+}
+
+static inline uint64_t mp_hist_bucket_low(int idx)
+{
+    int msb;
+
+    if (idx < (2 * MP_HIST_SUB_NUM)) {
+        return idx;
+    }
+    msb = idx / MP_HIST_SUB_NUM + MP_HIST_SUB_BITS - 1;
+    return (uint64_t)(MP_HIST_SUB_NUM + idx % MP_HIST_SUB_NUM) << (msb - MP_HIST_SUB_BITS);
+}
+
+static void mp_hist_add(struct mp_hist *out, const struct mp_hist *h)
+{
+    int i;
+    unsigned long long max;
+
+    out->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    out->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    if (max > out->max) {
+        out->max = max;
+    }
+    for (i = 0; i < MP_HIST_BUCKET_NUM; i++) {
+        out->buckets[i] += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void mp_hist_class_free(struct mp_hist_class **cls, int class_num)
+{
+    int i;
+
+    for (i = 0; i < class_num; i++) {
+        mp_hist_free(cls[i]);
+    }
+}
+
+/* 线程退出：统计合并到retired后释放缓冲，retired里还没有的单元直接接管 */
+static void mp_hist_buf_destroy(void *arg)
+{
+    int i;
+    int t;
+    struct mp_hist_buf **pp;
+    struct mp_hist_buf *buf = (struct mp_hist_buf *)arg;
+    struct mp_hist_ctx *ctx = buf->ctx;
+
+    /* 之后其它线程局部变量的析构函数仍可能打点，不能再用缓存的缓冲 */
+    if (g_hist_last_buf == buf) {
+        g_hist_last_ctx = NULL;
+        g_hist_last_buf = NULL;
+    }
+    pthread_mutex_lock(&ctx->lck);
+    for (pp = &ctx->bufs; *pp; pp = &(*pp)->next) {
+        if (*pp == buf) {
+            *pp = buf->next;
+            break;
+        }
+    }
+    for (i = 0; i < ctx->class_num; i++) {
+        if (!buf->cls[i]) {
+            continue;
+        }
+        if (!ctx->retired[i]) {
+            ctx->retired[i] = buf->cls[i];
+            buf->cls[i] = NULL;
+            continue;
+        }
+        for (t = 0; t < MP_HIST_E_MAX; t++) {
+            mp_hist_add(&ctx->retired[i]->h[t], &buf->cls[i]->h[t]);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lck);
+    mp_hist_class_free(buf->cls, ctx->class_num);
+    mp_hist_free(buf);
+}
+
+struct mp_hist_ctx *mp_hist_ctx_create(int class_num)
+{
+    struct mp_hist_ctx *ctx;
+
+    if (class_num <= 0) {
+        MP_LOG_ERROR("class_num[%d] invalid.", class_num);
+        return NULL;
+    }
+    ctx = mp_hist_calloc(1, sizeof(struct mp_hist_ctx));
+    if (!ctx) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    ctx->retired = mp_hist_calloc(class_num, sizeof(struct mp_hist_class *));
+    if (!ctx->retired) {
+        MP_LOG_ERROR("calloc retired fail.");
+        mp_hist_free(ctx);
+        return NULL;
+    }
+    if (pthread_key_create(&ctx->key, mp_hist_buf_destroy) != 0) {
+        MP_LOG_ERROR("pthread_key_create fail.");
+        mp_hist_free(ctx->retired);
+        mp_hist_free(ctx);
+        return NULL;
+    }
+    pthread_mutex_init(&ctx->lck, NULL);
+    ctx->class_num = class_num;
+    ctx->gen = __atomic_add_fetch(&g_hist_gen, 1, __ATOMIC_RELAXED);
+    return ctx;
+}
+
+void mp_hist_ctx_destroy(struct mp_hist_ctx *ctx)
+{
+    struct mp_hist_buf *buf;
+
+    if (!ctx) {
+        return;
+    }
+    /* 先删除key，之后退出的线程不再回调；仍存活线程的缓冲在这里释放 */
+    pthread_key_delete(ctx->key);
+    while (ctx->bufs) {
+        buf = ctx->bufs;
+        ctx->bufs = buf->next;
+        mp_hist_class_free(buf->cls, ctx->class_num);
+        mp_hist_free(buf);
+    }
+    mp_hist_class_free(ctx->retired, ctx->class_num);
+    mp_hist_free(ctx->retired);
+    pthread_mutex_destroy(&ctx->lck);
+    mp_hist_free(ctx);
+}
+
+static struct mp_hist_buf *mp_hist_buf_get(struct mp_hist_ctx *ctx)
+{
+    struct mp_hist_buf *buf;
+
+    if (g_hist_last_ctx == ctx && g_hist_last_gen == ctx->gen) {
+        return g_hist_last_buf;
+    }
+    buf = pthread_getspecific(ctx->key);
+    if (!buf) {
+        buf = mp_hist_calloc(1, sizeof(struct mp_hist_buf) + ctx->class_num * sizeof(struct mp_hist_class *));
+        if (!buf) {
+            return NULL;
+        }
+        buf->ctx = ctx;
+        pthread_setspecific(ctx->key, buf);
+        pthread_mutex_lock(&ctx->lck);
+        buf->next = ctx->bufs;
+        ctx->bufs = buf;
+        pthread_mutex_unlock(&ctx->lck);
+    }
+    g_hist_last_ctx = ctx;
+    g_hist_last_gen = ctx->gen;
+    g_hist_last_buf = buf;
+    return buf;
+}
+
+void mp_hist_record(struct mp_hist_ctx *ctx, int class_id, int type, uint64_t ticks)
+{
+    struct mp_hist_buf *buf;
+    struct mp_hist_class *cls;
+    struct mp_hist *h;
+    int idx;
+
+    /* 内部接口，避免重复校验，入参由调用者校验 */
+    buf = mp_hist_buf_get(ctx);
+    if (!buf) {
+        return;
+    }
+    cls = buf->cls[class_id];
+    if (!cls) {
+        cls = mp_hist_calloc(1, sizeof(struct mp_hist_class));
+        if (!cls) {
+            return;
+        }
+        __atomic_store_n(&buf->cls[class_id], cls, __ATOMIC_RELEASE);
+    }
+
+    /* 单线程写，其它线程查询时可能读到旧值，但不会读到撕裂的值 */
+    h = &cls->h[type];
+    idx = mp_hist_bucket(ticks);
+    __atomic_store_n(&h->buckets[idx], h->buckets[idx] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + ticks, __ATOMIC_RELAXED);
+    if (ticks > h->max) {
+        __atomic_store_n(&h->max, ticks, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+}
+
+int mp_hist_ctx_merge(struct mp_hist_ctx *ctx, int class_id, int type, struct mp_hist *out)
+{
+    int i;
+    struct mp_hist_buf *buf;
+    struct mp_hist_class *cls;
+
+    if (!ctx || !out || class_id >= ctx->class_num || type < 0 || type >= MP_HIST_E_MAX) {
+        return MP_ERR;
+    }
+    memset(out, 0, sizeof(struct mp_hist));
+    pthread_mutex_lock(&ctx->lck);
+    for (i = (class_id < 0 ? 0 : class_id); i < (class_id < 0 ? ctx->class_num : class_id + 1); i++) {
+        if (ctx->retired[i]) {
+            mp_hist_add(out, &ctx->retired[i]->h[type]);
+        }
+    }
+    for (buf = ctx->bufs; buf; buf = buf->next) {
+        for (i = (class_id < 0 ? 0 : class_id); i < (class_id < 0 ? ctx->class_num : class_id + 1); i++) {
+            cls = __atomic_load_n(&buf->cls[i], __ATOMIC_ACQUIRE);
+            if (cls) {
+                mp_hist_add(out, &cls->h[type]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&ctx->lck);
+    return MP_OK;
+}
+
+unsigned long long mp_hist_percentile(const struct mp_hist *h, double p)
+{
+    int i;
+    unsigned long long rank;
+    unsigned long long seen = 0;
+
+    if (!h || !h->count) {
+        return 0;
+    }
+    if (p >= 100.0) {
+        return h->max;
+    }
+    rank = (unsigned long long)(h->count * (p > 0 ? p : 0) / 100.0);
+    for (i = 0; i < MP_HIST_BUCKET_NUM; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            /* 返回桶的上界，不超过最大值 */
+            if (i + 1 < MP_HIST_BUCKET_NUM && mp_hist_bucket_low(i + 1) - 1 < h->max) {
+                return mp_hist_bucket_low(i + 1) - 1;
+            }
+            return h->max;
+        }
+    }
+    return h->max;
+}
+
+static double g_hist_ticks_per_ns;
+static pthread_once_t g_hist_calibrate_once = PTHREAD_ONCE_INIT;
+
+static void mp_hist_calibrate(void)
+{
+    struct timespec ts0, ts1;
+    uint64_t t0, t1;
+    unsigned long long ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    t0 = mp_hist_now();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &ts1);
+        ns = (ts1.tv_sec - ts0.tv_sec) * 1000000000ull + ts1.tv_nsec - ts0.tv_nsec;
+    } while (ns < MP_HIST_CALIBRATE_NS);
+    t1 = mp_hist_now();
+    g_hist_ticks_per_ns = (double)(t1 - t0) / ns;
+}
+
+double mp_hist_ticks_per_ns(void)
+{
+    pthread_once(&g_hist_calibrate_once, mp_hist_calibrate);
+    return g_hist_ticks_per_ns;
+}
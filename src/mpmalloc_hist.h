@@ -0,0 +1,54 @@
+#ifndef MPMALLOC_HIST_H_
+#define MPMALLOC_HIST_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 时延直方图（内部接口）
+ *   按分配单元和事件类型统计，每个线程写自己的缓冲，查询时合并，记录路径不加锁；
+ *   桶按2的幂分段，每段再线性分为4份，最大相对误差25%。
+ *   编译时定义 MP_LATENCY_HIST 才在分配路径上打点，否则打点宏为空。
+ */
+struct mp_hist;
+struct mp_hist_ctx;
+
+struct mp_hist_ctx *mp_hist_ctx_create(int class_num);
+void mp_hist_ctx_destroy(struct mp_hist_ctx *ctx);
+void mp_hist_record(struct mp_hist_ctx *ctx, int class_id, int type, uint64_t ticks);
+/* class_id小于0时合并所有单元 */
+int mp_hist_ctx_merge(struct mp_hist_ctx *ctx, int class_id, int type, struct mp_hist *out);
+
+static inline uint64_t mp_hist_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+#ifdef MP_LATENCY_HIST
+#define MP_HIST_START(v)                        uint64_t v = mp_hist_now()
+#define MP_HIST_RECORD(ctx, cls, type, v)       mp_hist_record((ctx), (cls), (type), mp_hist_now() - (v))
+#else
+#define MP_HIST_START(v)
+#define MP_HIST_RECORD(ctx, cls, type, v)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
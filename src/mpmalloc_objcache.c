@@ -0,0 +1,274 @@
+#include "mpmalloc.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <pthread.h>
+
+#include "mempool.h"
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_objcache_calloc
+#define mp_objcache_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_objcache_free_mem
+#define mp_objcache_free_mem(P) free(P)
+#endif
+
+/*每个对象缓存，支持动态拓展的最大内存池个数*/
+#define MP_OBJCACHE_MAX_MEMPOOL_NUM         8
+
+/*固定内存池个数，生命周期里不会被释放*/
+#define MP_OBJCACHE_ACTIVE_MEMPOOL_NUM      1
+
+/*每个内存池默认对象个数*/
+#define MP_OBJCACHE_CAPACITY                512
+
+/*未指定对齐时按max_align_t对齐，任何情况下不低于指针大小*/
+#define MP_OBJCACHE_DEFAULT_ALIGN           _Alignof(max_align_t)
+#define MP_OBJCACHE_MIN_ALIGN               sizeof(void *)
+
+struct mp_objcache
+{
+    size_t                  size;
+    size_t                  align;
+    size_t                  init_capacity;
+    mp_obj_fn               ctor;
+    mp_obj_fn               dtor;
+    pthread_rwlock_t        mempools_rwlock;
+    struct mempool_imp      *mempools[MP_OBJCACHE_MAX_MEMPOOL_NUM];
+    size_t                  capacity[MP_OBJCACHE_MAX_MEMPOOL_NUM];
+    int                     mempool_active;
+};
+
+static struct mempool_imp *mp_objcache_pool_create(struct mp_objcache *oc, int id, size_t capacity)
+{
+    struct mempool_imp *mp;
+
+    mp = mempool_create_ex_imp(id, capacity, oc->size, oc->align, 0, 0);
+    if (!mp) {
+        MP_LOG_ERROR("mempool create fail, capacity[%lu], size[%lu], align[%lu].", capacity, oc->size, oc->align);
+        return NULL;
+    }
+    mempool_set_ctor_imp(mp, oc->ctor, oc->dtor);
+    return mp;
+}
+
+struct mp_objcache *mp_objcache_create(size_t size, size_t align, mp_obj_fn ctor, mp_obj_fn dtor)
+{
+    struct mp_objcache *oc;
+
+    if (!size) {
+        MP_LOG_ERROR("size of param invalid.");
+        return NULL;
+    }
+    if (!align) {
+        align = MP_OBJCACHE_DEFAULT_ALIGN;
+    }
+    if ((align & (align - 1)) || align > MEMPOOL_MAX_ALIGN) {
+        MP_LOG_ERROR("align[%lu] of param invalid.", align);
+        return NULL;
+    }
+    if (align < MP_OBJCACHE_MIN_ALIGN) {
+        align = MP_OBJCACHE_MIN_ALIGN;
+    }
+
+    oc = mp_objcache_calloc(1, sizeof(struct mp_objcache));
+    if (!oc) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    oc->size = size;
+    oc->align = align;
+    oc->ctor = ctor;
+    oc->dtor = dtor;
+    oc->init_capacity = MP_OBJCACHE_CAPACITY;
+    if (pthread_rwlock_init(&oc->mempools_rwlock, NULL) != 0) {
+        MP_LOG_ERROR("pthread_rwlock_init fail.");
+        mp_objcache_free_mem(oc);
+        return NULL;
+    }
+
+    for (oc->mempool_active = 0; oc->mempool_active < MP_OBJCACHE_ACTIVE_MEMPOOL_NUM; oc->mempool_active++) {
+        oc->capacity[oc->mempool_active] = oc->init_capacity;
+        oc->mempools[oc->mempool_active] = mp_objcache_pool_create(oc, oc->mempool_active, oc->init_capacity);
+        if (!oc->mempools[oc->mempool_active]) {
+            mp_objcache_destroy(oc);
+            return NULL;
+        }
+    }
+    return oc;
+}
+
+void mp_objcache_destroy(struct mp_objcache *oc)
+{
+    int i;
+
+    if (!oc) {
+        return;
+    }
+    /* 析构在内存池释放时统一执行 */
+    for (i = 0; i < MP_OBJCACHE_MAX_MEMPOOL_NUM; i++) {
+        if (oc->mempools[i]) {
+            mempool_free_imp(oc->mempools[i]);
+            oc->mempools[i] = NULL;
+        }
+    }
+    pthread_rwlock_destroy(&oc->mempools_rwlock);
+    mp_objcache_free_mem(oc);
+}
+
+/* 池耗尽后的兜底分配，对象不缓存，每次构造和析构 */
+static void *mp_objcache_any_alloc(struct mp_objcache *oc)
+{
+    void *obj;
+
+    if (posix_memalign(&obj, oc->align, oc->size) != 0) {
+        MP_LOG_ERROR("posix_memalign fail, size[%lu].", oc->size);
+        return NULL;
+    }
+    if (oc->ctor) {
+        oc->ctor(obj);
+    }
+    return obj;
+}
+
+void *mp_objcache_alloc(struct mp_objcache *oc)
+{
+    int i;
+    void *obj = NULL;
+
+    if (!oc) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+
+    /* 固定内存池不会被释放，不需要加锁 */
+    for (i = 0; i < MP_OBJCACHE_ACTIVE_MEMPOOL_NUM; i++) {
+        obj = mempool_get_imp(oc->mempools[i]);
+        if (obj) {
+            return obj;
+        }
+    }
+
+    pthread_rwlock_rdlock(&oc->mempools_rwlock);
+    for (i = MP_OBJCACHE_ACTIVE_MEMPOOL_NUM; i < MP_OBJCACHE_MAX_MEMPOOL_NUM && !obj; i++) {
+        if (oc->mempools[i]) {
+            obj = mempool_get_imp(oc->mempools[i]);
+        }
+    }
+    pthread_rwlock_unlock(&oc->mempools_rwlock);
+    if (obj) {
+        return obj;
+    }
+
+    pthread_rwlock_wrlock(&oc->mempools_rwlock);
+    for (i = MP_OBJCACHE_ACTIVE_MEMPOOL_NUM; i < MP_OBJCACHE_MAX_MEMPOOL_NUM && !obj; i++) {
+        if (!oc->mempools[i]) {
+            oc->capacity[i] = (oc->mempool_active + 1) * oc->init_capacity;
+            oc->mempools[i] = mp_objcache_pool_create(oc, i, oc->capacity[i]);
+            if (!oc->mempools[i]) {
+                break;
+            }
+            oc->mempool_active++;
+        }
+        /* 等写锁期间其它线程可能已经扩展或归还 */
+        obj = mempool_get_imp(oc->mempools[i]);
+    }
+    pthread_rwlock_unlock(&oc->mempools_rwlock);
+    if (obj) {
+        return obj;
+    }
+    return mp_objcache_any_alloc(oc);
+}
+
+/* 释放空闲的动态内存池，force为0时只有其它池余量足够才释放；调用者持有写锁 */
+static int mp_objcache_trim_locked(struct mp_objcache *oc, int pool_id, int force)
+{
+    int i;
+    size_t left_capacity = 0;
+
+    if (!oc->mempools[pool_id] || mempool_use_count_imp(oc->mempools[pool_id]) != 0) {
+        return 0;
+    }
+    if (!force) {
+        for (i = 0; i < MP_OBJCACHE_MAX_MEMPOOL_NUM; i++) {
+            if (i != pool_id) {
+                left_capacity += mempool_avail_count_imp(oc->mempools[i]);
+            }
+        }
+        if (left_capacity <= oc->capacity[pool_id]/4) {
+            return 0;
+        }
+    }
+    mempool_free_imp(oc->mempools[pool_id]);
+    oc->mempools[pool_id] = NULL;
+    oc->capacity[pool_id] = 0;
+    oc->mempool_active--;
+    return 1;
+}
+
+void mp_objcache_free(struct mp_objcache *oc, void *obj)
+{
+    int i;
+    int empty = 0;
+
+    if (!oc || !obj) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+
+    for (i = 0; i < MP_OBJCACHE_ACTIVE_MEMPOOL_NUM; i++) {
+        if (mempool_owns_imp(oc->mempools[i], obj)) {
+            mempool_put_imp(oc->mempools[i], obj);
+            return;
+        }
+    }
+
+    pthread_rwlock_rdlock(&oc->mempools_rwlock);
+    for (i = MP_OBJCACHE_ACTIVE_MEMPOOL_NUM; i < MP_OBJCACHE_MAX_MEMPOOL_NUM; i++) {
+        if (mempool_owns_imp(oc->mempools[i], obj)) {
+            mempool_put_imp(oc->mempools[i], obj);
+            empty = (mempool_use_count_imp(oc->mempools[i]) == 0);
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&oc->mempools_rwlock);
+
+    if (i == MP_OBJCACHE_MAX_MEMPOOL_NUM) {
+        if (oc->dtor) {
+            oc->dtor(obj);
+        }
+        free(obj);
+        return;
+    }
+
+    /* 缩减内存池，对象在这里才析构 */
+    if (empty) {
+        pthread_rwlock_wrlock(&oc->mempools_rwlock);
+        mp_objcache_trim_locked(oc, i, 0);
+        pthread_rwlock_unlock(&oc->mempools_rwlock);
+    }
+}
+
+int mp_objcache_shrink(struct mp_objcache *oc)
+{
+    int i;
+    int released = 0;
+
+    if (!oc) {
+        MP_LOG_ERROR("null ptr.");
+        return 0;
+    }
+    pthread_rwlock_wrlock(&oc->mempools_rwlock);
+    for (i = MP_OBJCACHE_ACTIVE_MEMPOOL_NUM; i < MP_OBJCACHE_MAX_MEMPOOL_NUM; i++) {
+        released += mp_objcache_trim_locked(oc, i, 1);
+    }
+    pthread_rwlock_unlock(&oc->mempools_rwlock);
+    return released;
+}
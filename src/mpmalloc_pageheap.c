@@ -0,0 +1,391 @@
+#include "mpmalloc.h"
+#include "mpmalloc_pageheap.h"
+#include "queue.h"
+
+#include <sys/mman.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_pageheap_calloc
+#define mp_pageheap_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_pageheap_mfree
+#define mp_pageheap_mfree(P) free(P)
+#endif
+
+#define MP_PAGEHEAP_PAGE_SIZE       4096UL
+
+/* 每次向系统申请的最小长度，取大页大小，能用大页时直接用大页 */
+#define MP_PAGEHEAP_GROW_MIN        (2UL << 20)
+
+/* 默认保留的空闲字节数，超过后归还系统 */
+#define MP_PAGEHEAP_RETAIN_DEFAULT  (64UL << 20)
+
+/* 不小于该长度的清零用非临时写，不把整块内存拉进cache挤掉热数据 */
+#define MP_PAGEHEAP_NT_ZERO_MIN     (256UL << 10)
+
+#define MP_PAGEHEAP_ALIGN_UP(x, a)  (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+/* 一次mmap得到的连续区域，进程退出前不解除映射 */
+struct mp_page_chunk
+{
+    struct mp_page_chunk    *next;
+    char                    *base;
+    size_t                  size;
+    int                     huge;       /* 大页不能按4K归还系统 */
+};
+
+/* 空闲span，按地址有序挂在空闲链表上，只和同一chunk内相邻的span合并 */
+struct mp_span
+{
+    QUEUE                   q;
+    char                    *base;
+    size_t                  size;
+    struct mp_page_chunk    *chunk;
+    int                     released;   /* 已归还系统，再次使用时缺页清零 */
+    int                     zero;       /* 内容全为0：新映射或已归还系统 */
+};
+
+struct mp_pageheap
+{
+    pthread_mutex_t         lck;        /* 只在内存池创建和销毁时使用 */
+    int                     inited;
+    QUEUE                   free_spans;
+    struct mp_page_chunk    *chunks;
+    size_t                  retain;
+    size_t                  mapped;
+    size_t                  free;
+    size_t                  released;
+};
+
+static struct mp_pageheap g_pageheap = {
+    .lck = PTHREAD_MUTEX_INITIALIZER,
+    .retain = MP_PAGEHEAP_RETAIN_DEFAULT,
+};
+
+static inline void mp_pageheap_init(struct mp_pageheap *heap)
+{
+    if (!heap->inited) {
+        QUEUE_INIT(&heap->free_spans);
+        heap->inited = 1;
+    }
+}
+
+/* 合并next到span，合并后只要有一部分还驻留就按驻留统计 */
+static void mp_pageheap_merge(struct mp_pageheap *heap, struct mp_span *span, struct mp_span *next)
+{
+    if (span->released && !next->released) {
+        heap->released -= span->size;
+        span->released = 0;
+    } else if (!span->released && next->released) {
+        heap->released -= next->size;
+    }
+    span->zero = span->zero && next->zero;
+    span->size += next->size;
+    QUEUE_REMOVE(&next->q);
+    mp_pageheap_mfree(next);
+}
+
+/* 按地址插入空闲链表，并和同一chunk内相邻的空闲span合并，返回合并后的span */
+static struct mp_span *mp_pageheap_insert(struct mp_pageheap *heap, struct mp_span *span)
+{
+    QUEUE *iter;
+    struct mp_span *cur;
+    struct mp_span *near;
+
+    QUEUE_FOREACH(iter, &heap->free_spans) {
+        cur = QUEUE_DATA(iter, struct mp_span, q);
+        if (cur->base > span->base) {
+            break;
+        }
+    }
+    /* iter指向第一个地址更大的span或链表头，插到它前面 */
+    QUEUE_INSERT_TAIL(iter, &span->q);
+    heap->free += span->size;
+    if (span->released) {
+        heap->released += span->size;
+    }
+
+    iter = QUEUE_NEXT(&span->q);
+    if (iter != &heap->free_spans) {
+        near = QUEUE_DATA(iter, struct mp_span, q);
+        if (near->chunk == span->chunk && span->base + span->size == near->base) {
+            mp_pageheap_merge(heap, span, near);
+        }
+    }
+    iter = QUEUE_PREV(&span->q);
+    if (iter != &heap->free_spans) {
+        near = QUEUE_DATA(iter, struct mp_span, q);
+        if (near->chunk == span->chunk && near->base + near->size == span->base) {
+            mp_pageheap_merge(heap, near, span);
+            span = near;
+        }
+    }
+    return span;
+}
+
+static struct mp_span *mp_pageheap_grow(struct mp_pageheap *heap, size_t size)
+{
+    char *base;
+    int huge = 1;
+    struct mp_span *span;
+    struct mp_page_chunk *adj;
+    struct mp_page_chunk *chunk;
+
+    size = MP_PAGEHEAP_ALIGN_UP(size, MP_PAGEHEAP_GROW_MIN);
+    chunk = mp_pageheap_calloc(1, sizeof(struct mp_page_chunk));
+    span = mp_pageheap_calloc(1, sizeof(struct mp_span));
+    if (!chunk || !span) {
+        MP_LOG_ERROR("calloc fail.");
+        goto fail;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED) {
+        /* 没有预留大页时退回普通页 */
+        huge = 0;
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    }
+    if (base == MAP_FAILED) {
+        MP_LOG_ERROR("mmap fail, size[%lu].", size);
+        goto fail;
+    }
+    heap->mapped += size;
+    span->base = base;
+    span->size = size;
+    span->zero = 1;
+
+    /* 新映射和已有区域地址相邻时直接扩展该区域，两边的空闲页可以合并成更大的span */
+    for (adj = heap->chunks; adj; adj = adj->next) {
+        if (adj->huge != huge) {
+            continue;
+        }
+        if (adj->base + adj->size == base) {
+            adj->size += size;
+            break;
+        }
+        if (base + size == adj->base) {
+            adj->base = base;
+            adj->size += size;
+            break;
+        }
+    }
+    if (adj) {
+        mp_pageheap_mfree(chunk);
+        chunk = adj;
+    } else {
+        chunk->base = base;
+        chunk->size = size;
+        chunk->huge = huge;
+        chunk->next = heap->chunks;
+        heap->chunks = chunk;
+    }
+    span->chunk = chunk;
+    return mp_pageheap_insert(heap, span);
+fail:
+    mp_pageheap_mfree(chunk);
+    mp_pageheap_mfree(span);
+    return NULL;
+}
+
+void *mp_pageheap_alloc(size_t size)
+{
+    return mp_pageheap_alloc_ex(size, NULL);
+}
+
+void *mp_pageheap_alloc_ex(size_t size, int *zeroed)
+{
+    QUEUE *iter;
+    char *ptr;
+    struct mp_span *cur;
+    struct mp_span *best = NULL;
+    struct mp_pageheap *heap = &g_pageheap;
+
+    if (!size) {
+        return NULL;
+    }
+    size = MP_PAGEHEAP_ALIGN_UP(size, MP_PAGEHEAP_PAGE_SIZE);
+
+    pthread_mutex_lock(&heap->lck);
+    mp_pageheap_init(heap);
+    /* 最佳适配，优先复用其它句柄归还的页 */
+    QUEUE_FOREACH(iter, &heap->free_spans) {
+        cur = QUEUE_DATA(iter, struct mp_span, q);
+        if (cur->size >= size && (!best || cur->size < best->size)) {
+            best = cur;
+            if (cur->size == size) {
+                break;
+            }
+        }
+    }
+    if (!best) {
+        best = mp_pageheap_grow(heap, size);
+        if (!best) {
+            pthread_mutex_unlock(&heap->lck);
+            return NULL;
+        }
+    }
+
+    /* 从span头部切出，剩余部分留在原位置，链表仍按地址有序 */
+    ptr = best->base;
+    if (zeroed) {
+        *zeroed = best->zero;
+    }
+    heap->free -= size;
+    if (best->released) {
+        heap->released -= size;
+    }
+    if (best->size == size) {
+        QUEUE_REMOVE(&best->q);
+        mp_pageheap_mfree(best);
+    } else {
+        best->base += size;
+        best->size -= size;
+    }
+    pthread_mutex_unlock(&heap->lck);
+    return ptr;
+}
+
+static struct mp_page_chunk *mp_pageheap_find_chunk(struct mp_pageheap *heap, const char *ptr)
+{
+    struct mp_page_chunk *chunk;
+
+    for (chunk = heap->chunks; chunk; chunk = chunk->next) {
+        if (ptr >= chunk->base && ptr < chunk->base + chunk->size) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+void mp_pageheap_free(void *ptr, size_t size)
+{
+    struct mp_span *span;
+    struct mp_page_chunk *chunk;
+    struct mp_pageheap *heap = &g_pageheap;
+
+    if (!ptr || !size) {
+        return;
+    }
+    size = MP_PAGEHEAP_ALIGN_UP(size, MP_PAGEHEAP_PAGE_SIZE);
+    span = mp_pageheap_calloc(1, sizeof(struct mp_span));
+
+    pthread_mutex_lock(&heap->lck);
+    chunk = mp_pageheap_find_chunk(heap, (char *)ptr);
+    if (!chunk || (char *)ptr + size > chunk->base + chunk->size) {
+        pthread_mutex_unlock(&heap->lck);
+        MP_LOG_ERROR("ptr[%p] size[%lu] not from page heap.", ptr, size);
+        mp_pageheap_mfree(span);
+        return;
+    }
+    if (!span) {
+        /* 没有内存记录span，页交还系统后丢弃，只损失地址空间 */
+        pthread_mutex_unlock(&heap->lck);
+        MP_LOG_ERROR("calloc fail, drop span[%p] size[%lu].", ptr, size);
+        if (!chunk->huge) {
+            madvise(ptr, size, MADV_DONTNEED);
+        }
+        return;
+    }
+    span->base = (char *)ptr;
+    span->size = size;
+    span->chunk = chunk;
+    span = mp_pageheap_insert(heap, span);
+
+    /* 驻留的空闲页超过保留上限，合并后的整段交还系统，地址保留可以继续复用 */
+    if (!span->released && !chunk->huge && heap->free - heap->released > heap->retain) {
+        if (madvise(span->base, span->size, MADV_DONTNEED) == 0) {
+            span->released = 1;
+            span->zero = 1;
+            heap->released += span->size;
+        }
+    }
+    pthread_mutex_unlock(&heap->lck);
+}
+
+void mp_pageheap_populate(void *ptr, size_t size)
+{
+    size_t off;
+    char *base;
+
+    if (!ptr || !size) {
+        return;
+    }
+    /* 按所在页对齐，区域首尾可能不在页边界上 */
+    base = (char *)((uintptr_t)ptr & ~(MP_PAGEHEAP_PAGE_SIZE - 1));
+    size = MP_PAGEHEAP_ALIGN_UP((char *)ptr + size - base, MP_PAGEHEAP_PAGE_SIZE);
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(base, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+    /* 内核不支持时逐页写一次，原子加0不改变内容，区域正在被使用也安全 */
+    for (off = 0; off < size; off += MP_PAGEHEAP_PAGE_SIZE) {
+        __atomic_fetch_add((volatile char *)(base + off), 0, __ATOMIC_RELAXED);
+    }
+}
+
+void mp_pageheap_zero(void *ptr, size_t size)
+{
+#if defined(__SSE2__)
+    char *p = (char *)ptr;
+    size_t head;
+    size_t body;
+    __m128i z;
+
+    if (size < MP_PAGEHEAP_NT_ZERO_MIN) {
+        memset(ptr, 0, size);
+        return;
+    }
+    /* 首尾不满16字节的部分普通写，中间按16字节对齐流式写入 */
+    head = (16 - ((uintptr_t)p & 15)) & 15;
+    memset(p, 0, head);
+    p += head;
+    size -= head;
+    body = size & ~(size_t)63;
+    z = _mm_setzero_si128();
+    for (; body; body -= 64, p += 64) {
+        _mm_stream_si128((__m128i *)p, z);
+        _mm_stream_si128((__m128i *)(p + 16), z);
+        _mm_stream_si128((__m128i *)(p + 32), z);
+        _mm_stream_si128((__m128i *)(p + 48), z);
+    }
+    /* 非临时写是弱序的，返回前排空写合并缓冲，保证之后的普通读写看到0 */
+    _mm_sfence();
+    memset(p, 0, size & 63);
+#else
+    memset(ptr, 0, size);
+#endif
+}
+
+void mp_pageheap_set_retain(size_t bytes)
+{
+    pthread_mutex_lock(&g_pageheap.lck);
+    g_pageheap.retain = bytes;
+    pthread_mutex_unlock(&g_pageheap.lck);
+}
+
+int mp_pageheap_stats(struct mp_pageheap_stats *out)
+{
+    if (!out) {
+        MP_LOG_ERROR("out null.");
+        return MP_ERR;
+    }
+    pthread_mutex_lock(&g_pageheap.lck);
+    out->mapped = g_pageheap.mapped;
+    out->free = g_pageheap.free;
+    out->released = g_pageheap.released;
+    pthread_mutex_unlock(&g_pageheap.lck);
+    return MP_OK;
+}
@@ -0,0 +1,29 @@
+#ifndef MPMALLOC_PAGEHEAP_H_
+#define MPMALLOC_PAGEHEAP_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 进程级页堆（内部接口）
+ *   所有句柄的内存池都从这里按页申请span，销毁或回收内存池时归还，
+ *   空闲页可以被其它句柄复用；空闲量超过保留上限后再把多余的页交还系统。
+ *   返回的内存按页对齐，内容不保证清零。
+ */
+void *mp_pageheap_alloc(size_t size);
+/* 同 mp_pageheap_alloc，zeroed返回内容是否全为0（新映射或已交还系统的页），可以省去清零 */
+void *mp_pageheap_alloc_ex(size_t size, int *zeroed);
+void mp_pageheap_free(void *ptr, size_t size);
+/* 预先触发区域内所有页的缺页，已归还系统的页重新驻留，不改变内容 */
+void mp_pageheap_populate(void *ptr, size_t size);
+/* 清零，大块内存用非临时写，不污染cache */
+void mp_pageheap_zero(void *ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
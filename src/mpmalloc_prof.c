@@ -0,0 +1,252 @@
+#include "mpmalloc.h"
+#include "mpmalloc_prof.h"
+#include "khash.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <execinfo.h>
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_prof_calloc
+#define mp_prof_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_prof_free
+#define mp_prof_free(P) free(P)
+#endif
+
+/* 调用栈最大深度 */
+#define MP_PROF_MAX_DEPTH       32
+
+/* 跳过的栈帧：mp_prof_track 自身 */
+#define MP_PROF_SKIP_DEPTH      1
+
+struct mp_prof_sample
+{
+    size_t          size;
+    int             depth;
+    void            *stack[MP_PROF_MAX_DEPTH];
+};
+
+KHASH_MAP_INIT_INT64(prof_ptr, struct mp_prof_sample*)
+
+struct mp_prof_ctx
+{
+    pthread_mutex_t     lck;        /* 只在采样命中和释放采样内存时加锁 */
+    size_t              rate;
+    khash_t(prof_ptr)   *live;
+};
+
+__thread ssize_t g_mp_prof_left;
+static __thread int g_prof_inited;
+static __thread uint64_t g_prof_rand;
+
+static inline uint64_t mp_prof_rand(void)
+{
+    uint64_t x = g_prof_rand;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    g_prof_rand = x;
+    return x;
+}
+
+/* 均值为rate的指数分布，保证相邻两次采样相互独立，不会和分配模式共振 */
+static ssize_t mp_prof_interval(size_t rate)
+{
+    double u;
+    double v;
+
+    if (!g_prof_rand) {
+        g_prof_rand = ((uint64_t)(uintptr_t)&g_prof_rand) ^ ((uint64_t)time(NULL) << 32) ^ 0x9e3779b97f4a7c15ull;
+    }
+    /* 取高53位，u落在(0,1] */
+    u = (double)((mp_prof_rand() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    v = -log(u) * (double)rate;
+    if (v < 1.0) {
+        return 1;
+    }
+    if (v > (double)(SSIZE_MAX / 2)) {
+        return SSIZE_MAX / 2;
+    }
+    return (ssize_t)v;
+}
+
+int mp_prof_next(size_t rate)
+{
+    if (!rate) {
+        g_mp_prof_left = 0;
+        return 0;
+    }
+    g_mp_prof_left = mp_prof_interval(rate);
+    /* 线程第一次进入时只抽取间隔，避免每个线程的首次分配都被采样 */
+    if (!g_prof_inited) {
+        g_prof_inited = 1;
+        return 0;
+    }
+    return 1;
+}
+
+struct mp_prof_ctx *mp_prof_ctx_create(void)
+{
+    struct mp_prof_ctx *ctx;
+
+    ctx = mp_prof_calloc(1, sizeof(struct mp_prof_ctx));
+    if (!ctx) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    ctx->live = kh_init(prof_ptr);
+    if (!ctx->live) {
+        MP_LOG_ERROR("kh_init fail.");
+        mp_prof_free(ctx);
+        return NULL;
+    }
+    pthread_mutex_init(&ctx->lck, NULL);
+    return ctx;
+}
+
+void mp_prof_ctx_destroy(struct mp_prof_ctx *ctx)
+{
+    khiter_t k;
+
+    if (!ctx) {
+        return;
+    }
+    for (k = kh_begin(ctx->live); k != kh_end(ctx->live); k++) {
+        if (kh_exist(ctx->live, k)) {
+            mp_prof_free(kh_value(ctx->live, k));
+        }
+    }
+    kh_destroy(prof_ptr, ctx->live);
+    pthread_mutex_destroy(&ctx->lck);
+    mp_prof_free(ctx);
+}
+
+int mp_prof_track(struct mp_prof_ctx *ctx, const void *ptr, size_t size)
+{
+    int ret;
+    khiter_t k;
+    void *stack[MP_PROF_MAX_DEPTH + MP_PROF_SKIP_DEPTH];
+    struct mp_prof_sample *sample;
+
+    sample = mp_prof_calloc(1, sizeof(struct mp_prof_sample));
+    if (!sample) {
+        return MP_ERR;
+    }
+    sample->size = size;
+    sample->depth = backtrace(stack, MP_PROF_MAX_DEPTH + MP_PROF_SKIP_DEPTH) - MP_PROF_SKIP_DEPTH;
+    if (sample->depth > 0) {
+        memcpy(sample->stack, stack + MP_PROF_SKIP_DEPTH, sample->depth * sizeof(void *));
+    } else {
+        sample->depth = 0;
+    }
+
+    pthread_mutex_lock(&ctx->lck);
+    k = kh_put(prof_ptr, ctx->live, (khint64_t)(uintptr_t)ptr, &ret);
+    if (ret < 0) {
+        pthread_mutex_unlock(&ctx->lck);
+        mp_prof_free(sample);
+        return MP_ERR;
+    }
+    if (!ret) {
+        /* 同一地址的旧样本没有注销，覆盖 */
+        mp_prof_free(kh_value(ctx->live, k));
+    }
+    kh_value(ctx->live, k) = sample;
+    pthread_mutex_unlock(&ctx->lck);
+    return MP_OK;
+}
+
+void mp_prof_untrack(struct mp_prof_ctx *ctx, const void *ptr)
+{
+    khiter_t k;
+    struct mp_prof_sample *sample = NULL;
+
+    pthread_mutex_lock(&ctx->lck);
+    k = kh_get(prof_ptr, ctx->live, (khint64_t)(uintptr_t)ptr);
+    if (k != kh_end(ctx->live)) {
+        sample = kh_value(ctx->live, k);
+        kh_del(prof_ptr, ctx->live, k);
+    }
+    pthread_mutex_unlock(&ctx->lck);
+    mp_prof_free(sample);
+}
+
+static void mp_prof_dump_maps(FILE *fp)
+{
+    FILE *maps;
+    char buf[4096];
+    size_t n;
+
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    maps = fopen("/proc/self/maps", "r");
+    if (!maps) {
+        return;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) {
+        fwrite(buf, 1, n, fp);
+    }
+    fclose(maps);
+}
+
+void mp_prof_set_rate(struct mp_prof_ctx *ctx, size_t rate)
+{
+    if (rate) {
+        __atomic_store_n(&ctx->rate, rate, __ATOMIC_RELAXED);
+    }
+}
+
+int mp_prof_dump(struct mp_prof_ctx *ctx, const char *path)
+{
+    int i;
+    FILE *fp;
+    khiter_t k;
+    size_t count = 0;
+    size_t bytes = 0;
+    struct mp_prof_sample *sample;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        MP_LOG_ERROR("open [%s] fail.", path);
+        return MP_ERR;
+    }
+
+    /* 持锁写文件，期间只阻塞采样命中的分配和采样内存的释放 */
+    pthread_mutex_lock(&ctx->lck);
+    for (k = kh_begin(ctx->live); k != kh_end(ctx->live); k++) {
+        if (kh_exist(ctx->live, k)) {
+            count++;
+            bytes += kh_value(ctx->live, k)->size;
+        }
+    }
+    /* 只跟踪存活样本，累计分配量和存活量相同 */
+    fprintf(fp, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n", count, bytes, count, bytes, ctx->rate);
+    for (k = kh_begin(ctx->live); k != kh_end(ctx->live); k++) {
+        if (!kh_exist(ctx->live, k)) {
+            continue;
+        }
+        sample = kh_value(ctx->live, k);
+        fprintf(fp, "%6d: %8zu [%6d: %8zu] @", 1, sample->size, 1, sample->size);
+        for (i = 0; i < sample->depth; i++) {
+            fprintf(fp, " %p", sample->stack[i]);
+        }
+        fprintf(fp, "\n");
+    }
+    pthread_mutex_unlock(&ctx->lck);
+
+    mp_prof_dump_maps(fp);
+    if (fclose(fp) != 0) {
+        MP_LOG_ERROR("write [%s] fail.", path);
+        return MP_ERR;
+    }
+    return MP_OK;
+}
@@ -0,0 +1,46 @@
+#ifndef MPMALLOC_PROF_H_
+#define MPMALLOC_PROF_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 采样堆分析（内部接口）
+ *   每个线程维护距下次采样的剩余字节数，间隔服从均值为rate的指数分布；
+ *   计数减到负数时才进入慢路径抓调用栈并登记，释放时按内存头的采样标记注销。
+ *   dump输出pprof可解析的heap_v2文本格式，由pprof按rate还原真实分配量。
+ */
+struct mp_prof_ctx;
+
+struct mp_prof_ctx *mp_prof_ctx_create(void);
+void mp_prof_ctx_destroy(struct mp_prof_ctx *ctx);
+int mp_prof_track(struct mp_prof_ctx *ctx, const void *ptr, size_t size);
+void mp_prof_untrack(struct mp_prof_ctx *ctx, const void *ptr);
+/* 记录最近一次开启的采样间隔，关闭后dump仍按它还原 */
+void mp_prof_set_rate(struct mp_prof_ctx *ctx, size_t rate);
+int mp_prof_dump(struct mp_prof_ctx *ctx, const char *path);
+
+/* 重新抽取采样间隔，返回本次是否采样 */
+int mp_prof_next(size_t rate);
+
+extern __thread ssize_t g_mp_prof_left;
+
+/* 分配路径调用，未命中采样时只有一次减法和比较 */
+static inline int mp_prof_tick(size_t rate, size_t size)
+{
+    g_mp_prof_left -= (ssize_t)size;
+    if (__builtin_expect(g_mp_prof_left >= 0, 1)) {
+        return 0;
+    }
+    return mp_prof_next(rate);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
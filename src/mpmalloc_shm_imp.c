@@ -0,0 +1,683 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "mpmalloc.h"
+#include "mpmalloc_shm_imp.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <pthread.h>
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_shm_calloc
+#define mp_shm_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_shm_free_mem
+#define mp_shm_free_mem(P) free(P)
+#endif
+
+/*
+ * 进程间共享分配方法
+ *   所有分配单元的内存池放在同一个共享内存段（shm_open或memfd）里，段内只保存偏移，
+ *   每个进程映射地址可以不同，通过 mp_offset/mp_ptr 转换后即可零拷贝传递数据；
+ *   每个单元一把进程间共享的健壮锁，持锁进程异常退出后，下一个加锁者按单元状态重建空闲链表。
+ *   容量在创建时确定，不会扩展，也不会退回glibc，耗尽时返回NULL。
+ *
+ * 持久化（MP_ATTR_F_PERSIST）
+ *   段映射到普通文件，内容和空闲链表在重启后保留。重新打开时只校验段头和布局、重新初始化锁，
+ *   不遍历单元；链表修改前后置位/清除单元的busy标记，打开时只重建标记未清除（更新中途退出）的单元。
+ *   段头的clean标记区分正常关闭和异常退出，只覆盖进程异常退出，掉电一致性依赖业务自己msync。
+ */
+#define MP_SHM_MAGIC            0x6d707368u     /* "mpsh" */
+#define MP_SHM_VERSION          1
+#define MP_SHM_MAX_CLASS        64
+#define MP_SHM_ALIGN            8
+#define MP_SHM_ALIGN_UP(x, a)   (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+#define MP_SHM_SLOT_MAGIC       0xc5
+#define MP_SHM_SLOT_FREE        0
+#define MP_SHM_SLOT_USED        1
+
+/* 段内单元头，位于每次分配的数据前面 */
+struct mp_shm_slot
+{
+    uint16_t    class_id;
+    uint8_t     state;
+    uint8_t     magic;
+    uint32_t    reserved;
+};
+
+/* 段内分配单元描述，只保存偏移，不保存指针 */
+struct mp_shm_class
+{
+    pthread_mutex_t     lck;            /* PTHREAD_PROCESS_SHARED | PTHREAD_MUTEX_ROBUST */
+    uint64_t            size;           /* 单元可用大小 */
+    uint64_t            slot_size;      /* 单元头 + 数据 */
+    uint64_t            count;
+    uint64_t            used;
+    uint64_t            base_off;       /* 第一个单元头的段内偏移 */
+    uint64_t            free_head;      /* 空闲链表头（单元头偏移），0表示空；下一项保存在数据区开头 */
+    uint32_t            busy;           /* 正在修改链表，异常退出后据此判断是否需要重建 */
+    uint32_t            reserved;
+};
+
+/* 段头，位于偏移0 */
+struct mp_shm_seg
+{
+    uint32_t            magic;
+    uint32_t            version;
+    uint64_t            seg_size;
+    uint32_t            class_num;
+    uint32_t            ready;          /* 创建者初始化完成后置1 */
+    uint32_t            clean;          /* 持久化段正常关闭时置1，打开后清0 */
+    uint32_t            reserved;
+    uint64_t            root;           /* 业务根对象偏移，0表示未设置 */
+    struct mp_shm_class classes[0];     /* 按size升序 */
+};
+
+/* 进程内句柄 */
+struct mp_shm_imp
+{
+    struct mp_shm_seg   *seg;
+    size_t              seg_size;
+    int                 fd;
+    int                 owner;          /* 创建者销毁时删除共享段名字 */
+    int                 persist;        /* 文件持久化段，销毁时标记正常关闭并落盘 */
+    char                name[NAME_MAX];
+};
+
+static int mp_shm_unit_cmp(const void *a, const void *b)
+{
+    const struct mp_unit *ua = (const struct mp_unit *)a;
+    const struct mp_unit *ub = (const struct mp_unit *)b;
+
+    if (ua->size == ub->size) {
+        return 0;
+    }
+    return ua->size < ub->size ? -1 : 1;
+}
+
+static inline struct mp_shm_slot *mp_shm_slot_at(struct mp_shm_imp *imp, uint64_t off)
+{
+    return (struct mp_shm_slot *)((char *)imp->seg + off);
+}
+
+static inline uint64_t *mp_shm_slot_next(struct mp_shm_slot *slot)
+{
+    return (uint64_t *)(slot + 1);
+}
+
+/* 按单元状态重建空闲链表，调用者持有锁 */
+static void mp_shm_class_rebuild(struct mp_shm_imp *imp, struct mp_shm_class *cls)
+{
+    uint64_t i;
+    uint64_t off;
+    uint64_t used = 0;
+    struct mp_shm_slot *slot;
+
+    cls->free_head = 0;
+    /* 倒序插入，链表保持地址升序 */
+    for (i = cls->count; i > 0; i--) {
+        off = cls->base_off + (i - 1) * cls->slot_size;
+        slot = mp_shm_slot_at(imp, off);
+        if (slot->state == MP_SHM_SLOT_USED) {
+            used++;
+            continue;
+        }
+        slot->state = MP_SHM_SLOT_FREE;
+        *mp_shm_slot_next(slot) = cls->free_head;
+        cls->free_head = off;
+    }
+    cls->used = used;
+    cls->busy = 0;
+}
+
+/* 链表修改区间的开始和结束，标记必须先于/晚于链表的修改写入 */
+static inline void mp_shm_class_busy(struct mp_shm_class *cls)
+{
+    cls->busy = 1;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void mp_shm_class_idle(struct mp_shm_class *cls)
+{
+    __atomic_store_n(&cls->busy, 0, __ATOMIC_RELEASE);
+}
+
+static int mp_shm_class_lock(struct mp_shm_imp *imp, struct mp_shm_class *cls)
+{
+    int rc;
+
+    rc = pthread_mutex_lock(&cls->lck);
+    if (rc == EOWNERDEAD) {
+        /*
+         * 持锁进程在更新中途退出。分配先摘链再置USED，释放先置FREE再入链，
+         * 所以单元状态总是可信的，按状态重建链表即可
+         */
+        if (cls->busy) {
+            MP_LOG_ERROR("lock owner died, rebuild class size[%lu].", (unsigned long)cls->size);
+            mp_shm_class_rebuild(imp, cls);
+        }
+        pthread_mutex_consistent(&cls->lck);
+        rc = 0;
+    }
+    if (rc != 0) {
+        MP_LOG_ERROR("pthread_mutex_lock fail, rc[%d].", rc);
+    }
+    return rc;
+}
+
+static int mp_shm_lock_init(struct mp_shm_class *cls)
+{
+    pthread_mutexattr_t attr;
+    int rc;
+
+    if (pthread_mutexattr_init(&attr) != 0) {
+        return MP_ERR;
+    }
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    rc = pthread_mutex_init(&cls->lck, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) {
+        MP_LOG_ERROR("pthread_mutex_init fail, rc[%d].", rc);
+        return MP_ERR;
+    }
+    return MP_OK;
+}
+
+static int mp_shm_class_init(struct mp_shm_imp *imp, int class_id)
+{
+    uint64_t i;
+    struct mp_shm_slot *slot;
+    struct mp_shm_class *cls = &imp->seg->classes[class_id];
+
+    if (mp_shm_lock_init(cls) != MP_OK) {
+        return MP_ERR;
+    }
+    for (i = 0; i < cls->count; i++) {
+        slot = mp_shm_slot_at(imp, cls->base_off + i * cls->slot_size);
+        slot->class_id = class_id;
+        slot->magic = MP_SHM_SLOT_MAGIC;
+    }
+    mp_shm_class_rebuild(imp, cls);
+    return MP_OK;
+}
+
+static int mp_shm_map(struct mp_shm_imp *imp, size_t seg_size)
+{
+    void *page;
+
+    page = mmap(NULL, seg_size, PROT_READ | PROT_WRITE, MAP_SHARED, imp->fd, 0);
+    if (page == MAP_FAILED) {
+        MP_LOG_ERROR("mmap fail, size[%lu], errno[%d].", seg_size, errno);
+        return MP_ERR;
+    }
+    imp->seg = (struct mp_shm_seg *)page;
+    imp->seg_size = seg_size;
+    return MP_OK;
+}
+
+/* 重新打开持久化文件：校验段头和布局，重建易失状态 */
+static int mp_shm_reopen(struct mp_shm_imp *imp, const struct mp_unit *units, int arr_num, size_t file_size)
+{
+    int i;
+    struct mp_shm_seg *seg;
+    struct mp_shm_class *cls;
+
+    if (file_size < sizeof(struct mp_shm_seg) || mp_shm_map(imp, file_size) != MP_OK) {
+        MP_LOG_ERROR("file[%s] size[%lu] invalid.", imp->name, file_size);
+        return MP_ERR;
+    }
+    seg = imp->seg;
+    if (seg->magic != MP_SHM_MAGIC || seg->version != MP_SHM_VERSION || seg->seg_size != file_size
+        || !seg->ready || seg->class_num != (uint32_t)arr_num) {
+        MP_LOG_ERROR("file[%s] header invalid, magic[0x%x], version[%u], class_num[%u].",
+                     imp->name, seg->magic, seg->version, seg->class_num);
+        return MP_ERR;
+    }
+    for (i = 0; i < arr_num; i++) {
+        cls = &seg->classes[i];
+        if (cls->size != MP_SHM_ALIGN_UP(units[i].size, MP_SHM_ALIGN)
+            || cls->count != (uint64_t)(units[i].capacity > 0 ? units[i].capacity : 1)) {
+            MP_LOG_ERROR("file[%s] unit[%d] layout mismatch, size[%lu], count[%lu].",
+                         imp->name, i, (unsigned long)cls->size, (unsigned long)cls->count);
+            return MP_ERR;
+        }
+    }
+    if (!seg->clean) {
+        MP_LOG_ERROR("file[%s] not closed cleanly, recover.", imp->name);
+    }
+    seg->clean = 0;
+
+    /* 锁属于上一次运行，直接重新初始化；只有更新中途中断的单元才遍历重建 */
+    for (i = 0; i < arr_num; i++) {
+        cls = &seg->classes[i];
+        if (mp_shm_lock_init(cls) != MP_OK) {
+            return MP_ERR;
+        }
+        if (cls->busy) {
+            MP_LOG_ERROR("file[%s] unit[%d] interrupted, rebuild free list.", imp->name, i);
+            mp_shm_class_rebuild(imp, cls);
+        }
+    }
+    return MP_OK;
+}
+
+void *mp_shm_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr)
+{
+    int i;
+    uint64_t off;
+    size_t seg_size;
+    struct stat st;
+    struct mp_unit units[MP_SHM_MAX_CLASS];
+    struct mp_shm_class *cls;
+    struct mp_shm_imp *imp;
+
+    if (!arr) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (arr_num > MP_SHM_MAX_CLASS) {
+        MP_LOG_ERROR("arr_num[%d] exceed max[%d].", arr_num, MP_SHM_MAX_CLASS);
+        return NULL;
+    }
+    memcpy(units, arr, arr_num * sizeof(struct mp_unit));
+    qsort(units, arr_num, sizeof(struct mp_unit), mp_shm_unit_cmp);
+
+    off = MP_SHM_ALIGN_UP(sizeof(struct mp_shm_seg) + arr_num * sizeof(struct mp_shm_class), MP_SHM_ALIGN);
+    seg_size = off;
+    for (i = 0; i < arr_num; i++) {
+        if (!units[i].size) {
+            MP_LOG_ERROR("size of unit[%d] invalid.", i);
+            return NULL;
+        }
+        seg_size += (sizeof(struct mp_shm_slot) + MP_SHM_ALIGN_UP(units[i].size, MP_SHM_ALIGN))
+                    * (units[i].capacity > 0 ? units[i].capacity : 1);
+    }
+
+    imp = mp_shm_calloc(1, sizeof(struct mp_shm_imp));
+    if (!imp) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    imp->fd = -1;
+    imp->owner = 1;
+    if (attr && (attr->flags & MP_ATTR_F_PERSIST)) {
+        if (!attr->name) {
+            MP_LOG_ERROR("persist need file name.");
+            mp_shm_destroy_imp(imp);
+            return NULL;
+        }
+        /* 文件由业务管理，销毁时不删除 */
+        imp->owner = 0;
+        snprintf(imp->name, sizeof(imp->name), "%s", attr->name);
+        imp->fd = open(imp->name, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+    } else if (attr && attr->name) {
+        snprintf(imp->name, sizeof(imp->name), "%s", attr->name);
+        imp->fd = shm_open(imp->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    } else {
+        imp->fd = memfd_create("mpmalloc", MFD_CLOEXEC);
+    }
+    if (imp->fd < 0) {
+        MP_LOG_ERROR("open shm[%s] fail, errno[%d].", imp->name, errno);
+        imp->name[0] = '\0';
+        mp_shm_destroy_imp(imp);
+        return NULL;
+    }
+    if (attr && (attr->flags & MP_ATTR_F_PERSIST)) {
+        /* 同一文件只允许一个句柄打开，重新初始化锁时不能有其它使用者 */
+        if (flock(imp->fd, LOCK_EX | LOCK_NB) != 0 || fstat(imp->fd, &st) != 0) {
+            MP_LOG_ERROR("file[%s] busy or stat fail, errno[%d].", imp->name, errno);
+            mp_shm_destroy_imp(imp);
+            return NULL;
+        }
+        if (st.st_size > 0) {
+            if (mp_shm_reopen(imp, units, arr_num, st.st_size) != MP_OK) {
+                mp_shm_destroy_imp(imp);
+                return NULL;
+            }
+            imp->persist = 1;
+            return imp;
+        }
+    }
+    if (ftruncate(imp->fd, seg_size) != 0) {
+        MP_LOG_ERROR("ftruncate fail, size[%lu], errno[%d].", seg_size, errno);
+        mp_shm_destroy_imp(imp);
+        return NULL;
+    }
+    if (mp_shm_map(imp, seg_size) != MP_OK) {
+        mp_shm_destroy_imp(imp);
+        return NULL;
+    }
+
+    /* ftruncate扩展的部分为0，单元状态初始即为FREE */
+    imp->seg->magic = MP_SHM_MAGIC;
+    imp->seg->version = MP_SHM_VERSION;
+    imp->seg->seg_size = seg_size;
+    imp->seg->class_num = arr_num;
+    for (i = 0; i < arr_num; i++) {
+        cls = &imp->seg->classes[i];
+        cls->size = MP_SHM_ALIGN_UP(units[i].size, MP_SHM_ALIGN);
+        cls->slot_size = sizeof(struct mp_shm_slot) + cls->size;
+        cls->count = units[i].capacity > 0 ? units[i].capacity : 1;
+        cls->base_off = off;
+        off += cls->slot_size * cls->count;
+        if (mp_shm_class_init(imp, i) != MP_OK) {
+            mp_shm_destroy_imp(imp);
+            return NULL;
+        }
+    }
+    __atomic_store_n(&imp->seg->ready, 1, __ATOMIC_RELEASE);
+    imp->persist = attr && (attr->flags & MP_ATTR_F_PERSIST);
+    return imp;
+}
+
+void *mp_shm_attach_imp(const char *name, int fd)
+{
+    struct stat st;
+    struct mp_shm_imp *imp;
+
+    imp = mp_shm_calloc(1, sizeof(struct mp_shm_imp));
+    if (!imp) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    imp->fd = -1;
+    imp->owner = 0;
+    imp->fd = name ? shm_open(name, O_RDWR, 0600) : fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (imp->fd < 0) {
+        MP_LOG_ERROR("open shm[%s] fd[%d] fail, errno[%d].", name ? name : "", fd, errno);
+        mp_shm_destroy_imp(imp);
+        return NULL;
+    }
+    if (fstat(imp->fd, &st) != 0 || (size_t)st.st_size < sizeof(struct mp_shm_seg)) {
+        MP_LOG_ERROR("shm size invalid, errno[%d].", errno);
+        mp_shm_destroy_imp(imp);
+        return NULL;
+    }
+    if (mp_shm_map(imp, st.st_size) != MP_OK) {
+        mp_shm_destroy_imp(imp);
+        return NULL;
+    }
+    if (imp->seg->magic != MP_SHM_MAGIC || imp->seg->version != MP_SHM_VERSION
+        || imp->seg->seg_size != (uint64_t)st.st_size || imp->seg->class_num > MP_SHM_MAX_CLASS
+        || !__atomic_load_n(&imp->seg->ready, __ATOMIC_ACQUIRE)) {
+        MP_LOG_ERROR("shm header invalid, magic[0x%x], version[%u].", imp->seg->magic, imp->seg->version);
+        mp_shm_destroy_imp(imp);
+        return NULL;
+    }
+    return imp;
+}
+
+void mp_shm_destroy_imp(void* mh)
+{
+    struct mp_shm_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    /* 其它进程可能还在使用，锁不销毁，随共享段一起释放 */
+    if (imp->seg) {
+        if (imp->persist) {
+            imp->seg->clean = 1;
+            msync(imp->seg, imp->seg_size, MS_SYNC);
+        }
+        munmap(imp->seg, imp->seg_size);
+    }
+    if (imp->fd >= 0) {
+        close(imp->fd);
+    }
+    if (imp->owner && imp->name[0]) {
+        shm_unlink(imp->name);
+    }
+    mp_shm_free_mem(imp);
+}
+
+static void *mp_shm_class_get(struct mp_shm_imp *imp, struct mp_shm_class *cls)
+{
+    uint64_t off;
+    struct mp_shm_slot *slot;
+
+    if (mp_shm_class_lock(imp, cls) != 0) {
+        return NULL;
+    }
+    off = cls->free_head;
+    if (!off) {
+        pthread_mutex_unlock(&cls->lck);
+        return NULL;
+    }
+    slot = mp_shm_slot_at(imp, off);
+    mp_shm_class_busy(cls);
+    cls->free_head = *mp_shm_slot_next(slot);
+    slot->state = MP_SHM_SLOT_USED;
+    cls->used++;
+    mp_shm_class_idle(cls);
+    pthread_mutex_unlock(&cls->lck);
+    return slot + 1;
+}
+
+void *mp_shm_alloc_imp(void* mh, size_t size)
+{
+    uint32_t i;
+    void *ptr;
+    struct mp_shm_imp *imp;
+    struct mp_shm_class *cls;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    imp = (struct mp_shm_imp *)mh;
+
+    /* 从最合适的单元开始，耗尽时使用更大的单元 */
+    for (i = 0; i < imp->seg->class_num; i++) {
+        cls = &imp->seg->classes[i];
+        if (cls->size < size) {
+            continue;
+        }
+        ptr = mp_shm_class_get(imp, cls);
+        if (ptr) {
+            return ptr;
+        }
+    }
+    MP_LOG_DEBUG("no shm slot for size[%lu].", size);
+    return NULL;
+}
+
+/* 校验指针属于本段且处于使用状态，返回单元头 */
+static struct mp_shm_slot *mp_shm_slot_of(struct mp_shm_imp *imp, const void *mem)
+{
+    uint64_t off;
+    struct mp_shm_slot *slot;
+    struct mp_shm_class *cls;
+
+    if ((const char *)mem < (const char *)imp->seg + sizeof(struct mp_shm_slot)
+        || (const char *)mem >= (const char *)imp->seg + imp->seg_size) {
+        return NULL;
+    }
+    slot = (struct mp_shm_slot *)mem - 1;
+    if (slot->magic != MP_SHM_SLOT_MAGIC || slot->class_id >= imp->seg->class_num) {
+        return NULL;
+    }
+    cls = &imp->seg->classes[slot->class_id];
+    off = (uint64_t)((const char *)slot - (const char *)imp->seg);
+    if (off < cls->base_off || off >= cls->base_off + cls->count * cls->slot_size
+        || (off - cls->base_off) % cls->slot_size) {
+        return NULL;
+    }
+    return slot;
+}
+
+void mp_shm_free_imp(void* mh, void *mem)
+{
+    uint64_t off;
+    struct mp_shm_imp *imp;
+    struct mp_shm_slot *slot;
+    struct mp_shm_class *cls;
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    slot = mp_shm_slot_of(imp, mem);
+    if (!slot) {
+        MP_LOG_ERROR("mem[%p] not belong to shm.", mem);
+        return;
+    }
+    cls = &imp->seg->classes[slot->class_id];
+    if (mp_shm_class_lock(imp, cls) != 0) {
+        return;
+    }
+    if (slot->state != MP_SHM_SLOT_USED) {
+        pthread_mutex_unlock(&cls->lck);
+        MP_LOG_ERROR("mem[%p] double free.", mem);
+        return;
+    }
+    off = (uint64_t)((char *)slot - (char *)imp->seg);
+    mp_shm_class_busy(cls);
+    slot->state = MP_SHM_SLOT_FREE;
+    *mp_shm_slot_next(slot) = cls->free_head;
+    cls->free_head = off;
+    cls->used--;
+    mp_shm_class_idle(cls);
+    pthread_mutex_unlock(&cls->lck);
+}
+
+void *mp_shm_realloc_imp(void* mh, void *mem, size_t newsize)
+{
+    struct mp_shm_imp *imp;
+    struct mp_shm_slot *slot;
+    size_t old_size;
+    void *new_mem;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (!mem) {
+        return mp_shm_alloc_imp(mh, newsize);
+    }
+    if (newsize == 0) {
+        mp_shm_free_imp(mh, mem);
+        return NULL;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    slot = mp_shm_slot_of(imp, mem);
+    if (!slot) {
+        MP_LOG_ERROR("mem[%p] not belong to shm.", mem);
+        return NULL;
+    }
+    old_size = imp->seg->classes[slot->class_id].size;
+    if (newsize <= old_size) {
+        return mem;
+    }
+    new_mem = mp_shm_alloc_imp(mh, newsize);
+    if (!new_mem) {
+        return NULL;
+    }
+    memcpy(new_mem, mem, old_size);
+    mp_shm_free_imp(mh, mem);
+    return new_mem;
+}
+
+size_t mp_shm_offset_imp(void* mh, const void *mem)
+{
+    struct mp_shm_imp *imp;
+
+    if (!mh || !mem) {
+        return MP_OFFSET_INVALID;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    if ((const char *)mem < (const char *)imp->seg || (const char *)mem >= (const char *)imp->seg + imp->seg_size) {
+        return MP_OFFSET_INVALID;
+    }
+    return (size_t)((const char *)mem - (const char *)imp->seg);
+}
+
+void *mp_shm_ptr_imp(void* mh, size_t offset)
+{
+    struct mp_shm_imp *imp;
+
+    if (!mh) {
+        return NULL;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    if (offset == 0 || offset >= imp->seg_size) {
+        return NULL;
+    }
+    return (char *)imp->seg + offset;
+}
+
+int mp_shm_fd_imp(void* mh)
+{
+    if (!mh) {
+        return -1;
+    }
+    return ((struct mp_shm_imp *)mh)->fd;
+}
+
+int mp_shm_set_root_imp(void* mh, const void *mem)
+{
+    size_t off;
+    struct mp_shm_imp *imp;
+
+    if (!mh) {
+        return MP_ERR;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    off = mem ? mp_shm_offset_imp(mh, mem) : 0;
+    if (off == MP_OFFSET_INVALID) {
+        MP_LOG_ERROR("mem[%p] not belong to shm.", mem);
+        return MP_ERR;
+    }
+    __atomic_store_n(&imp->seg->root, off, __ATOMIC_RELEASE);
+    return MP_OK;
+}
+
+void *mp_shm_get_root_imp(void* mh)
+{
+    uint64_t off;
+    struct mp_shm_imp *imp;
+
+    if (!mh) {
+        return NULL;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    off = __atomic_load_n(&imp->seg->root, __ATOMIC_ACQUIRE);
+    return off ? mp_shm_ptr_imp(mh, off) : NULL;
+}
+
+size_t mp_shm_usable_size_imp(void* mh, const void *mem)
+{
+    struct mp_shm_imp *imp;
+    struct mp_shm_slot *slot;
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return 0;
+    }
+    imp = (struct mp_shm_imp *)mh;
+    slot = mp_shm_slot_of(imp, mem);
+    if (!slot) {
+        MP_LOG_ERROR("mem[%p] not belong to shm.", mem);
+        return 0;
+    }
+    return imp->seg->classes[slot->class_id].size;
+}
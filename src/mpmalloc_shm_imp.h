@@ -0,0 +1,27 @@
+#ifndef MPMALLOC_SHM_IMP_H_
+#define MPMALLOC_SHM_IMP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mp_unit;
+struct mp_attr;
+void *mp_shm_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr);
+void *mp_shm_attach_imp(const char *name, int fd);
+void *mp_shm_alloc_imp(void* mh, size_t size);
+void *mp_shm_realloc_imp(void* mh, void *mem, size_t newsize);
+void mp_shm_free_imp(void* mh, void *mem);
+void mp_shm_destroy_imp(void* mh);
+size_t mp_shm_offset_imp(void* mh, const void *mem);
+void *mp_shm_ptr_imp(void* mh, size_t offset);
+int mp_shm_fd_imp(void* mh);
+int mp_shm_set_root_imp(void* mh, const void *mem);
+void *mp_shm_get_root_imp(void* mh);
+size_t mp_shm_usable_size_imp(void* mh, const void *mem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
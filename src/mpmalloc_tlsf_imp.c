@@ -0,0 +1,545 @@
+#include "mpmalloc.h"
+#include "mpmalloc_tlsf_imp.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/mman.h>
+#include <pthread.h>
+
+#define MP_LOG_ERROR(format, arg...) printf("ERROR [%s,%d]:  "format"\n", __FUNCTION__, __LINE__, ##arg)
+#define MP_LOG_DEBUG(format, arg...)
+
+#ifndef mp_tlsf_calloc
+#define mp_tlsf_calloc(N,Z) calloc(N,Z)
+#endif
+#ifndef mp_tlsf_free
+#define mp_tlsf_free(P) free(P)
+#endif
+
+/*
+ * 两级分离适配（TLSF）分配方法
+ *   创建时一次性预留并预取整块区域，之后的分配和释放都是O(1)：
+ *   一级按2的幂划分，二级把每个区间再线性划分为32份，两级都用位图查找非空链表；
+ *   不会扩展区域，也不会退回glibc，区域耗尽时返回NULL，保证最坏时延有界。
+ */
+#define MP_TLSF_ALIGN_LOG2          3
+#define MP_TLSF_ALIGN               (1 << MP_TLSF_ALIGN_LOG2)
+#define MP_TLSF_SL_INDEX_COUNT_LOG2 5
+#define MP_TLSF_SL_INDEX_COUNT      (1 << MP_TLSF_SL_INDEX_COUNT_LOG2)
+#define MP_TLSF_FL_INDEX_MAX        32
+#define MP_TLSF_FL_INDEX_SHIFT      (MP_TLSF_SL_INDEX_COUNT_LOG2 + MP_TLSF_ALIGN_LOG2)
+#define MP_TLSF_FL_INDEX_COUNT      (MP_TLSF_FL_INDEX_MAX - MP_TLSF_FL_INDEX_SHIFT + 1)
+#define MP_TLSF_SMALL_BLOCK_SIZE    (1 << MP_TLSF_FL_INDEX_SHIFT)
+
+/* 预留区域大小：分配单元总容量的倍数，不小于最小值 */
+#define MP_TLSF_REGION_FACTOR       4
+#define MP_TLSF_REGION_MIN          (1024 * 1024)
+#define MP_TLSF_REGION_MAX          ((size_t)1 << (MP_TLSF_FL_INDEX_MAX - 1))
+
+/* size的低两位作为标记：本块空闲、前一个物理块空闲 */
+#define MP_TLSF_BLOCK_FREE          ((size_t)1 << 0)
+#define MP_TLSF_BLOCK_PREV_FREE     ((size_t)1 << 1)
+
+struct mp_tlsf_block
+{
+    struct mp_tlsf_block    *prev_phys;     /* 前一个物理块，只有前一块空闲时有效（位于其数据区末尾） */
+    size_t                  size;           /* 数据区大小和标记 */
+    struct mp_tlsf_block    *next_free;     /* 以下两项只在空闲时有效 */
+    struct mp_tlsf_block    *prev_free;
+};
+
+/* 已使用块只占用size字段，prev_phys与前一个块的数据区重叠 */
+#define MP_TLSF_BLOCK_OVERHEAD      (sizeof(size_t))
+#define MP_TLSF_BLOCK_START         (offsetof(struct mp_tlsf_block, size) + sizeof(size_t))
+#define MP_TLSF_BLOCK_SIZE_MIN      (sizeof(struct mp_tlsf_block) - sizeof(struct mp_tlsf_block *))
+#define MP_TLSF_BLOCK_SIZE_MAX      ((size_t)1 << MP_TLSF_FL_INDEX_MAX)
+
+struct mp_tlsf_imp
+{
+    pthread_mutex_t         lck;
+    struct mp_tlsf_block    block_null;     /* 空链表哨兵 */
+    unsigned int            fl_bitmap;
+    unsigned int            sl_bitmap[MP_TLSF_FL_INDEX_COUNT];
+    struct mp_tlsf_block    *blocks[MP_TLSF_FL_INDEX_COUNT][MP_TLSF_SL_INDEX_COUNT];
+    char                    *region;
+    size_t                  region_size;
+};
+
+static inline int mp_tlsf_ffs(unsigned int word)
+{
+    return word ? __builtin_ffs(word) - 1 : -1;
+}
+
+static inline int mp_tlsf_fls(size_t size)
+{
+    return size ? (int)(sizeof(size_t) * 8 - 1 - __builtin_clzl(size)) : -1;
+}
+
+static inline size_t mp_tlsf_block_size(const struct mp_tlsf_block *block)
+{
+    return block->size & ~(MP_TLSF_BLOCK_FREE | MP_TLSF_BLOCK_PREV_FREE);
+}
+
+static inline void mp_tlsf_block_set_size(struct mp_tlsf_block *block, size_t size)
+{
+    block->size = size | (block->size & (MP_TLSF_BLOCK_FREE | MP_TLSF_BLOCK_PREV_FREE));
+}
+
+static inline int mp_tlsf_block_is_free(const struct mp_tlsf_block *block)
+{
+    return (int)(block->size & MP_TLSF_BLOCK_FREE);
+}
+
+static inline int mp_tlsf_block_is_prev_free(const struct mp_tlsf_block *block)
+{
+    return (int)(block->size & MP_TLSF_BLOCK_PREV_FREE);
+}
+
+static inline void *mp_tlsf_block_to_ptr(const struct mp_tlsf_block *block)
+{
+    return (char *)block + MP_TLSF_BLOCK_START;
+}
+
+static inline struct mp_tlsf_block *mp_tlsf_block_from_ptr(const void *ptr)
+{
+    return (struct mp_tlsf_block *)((char *)ptr - MP_TLSF_BLOCK_START);
+}
+
+static inline struct mp_tlsf_block *mp_tlsf_block_next(const struct mp_tlsf_block *block)
+{
+    return (struct mp_tlsf_block *)((char *)mp_tlsf_block_to_ptr(block) + mp_tlsf_block_size(block) - MP_TLSF_BLOCK_OVERHEAD);
+}
+
+static inline struct mp_tlsf_block *mp_tlsf_block_link_next(struct mp_tlsf_block *block)
+{
+    struct mp_tlsf_block *next = mp_tlsf_block_next(block);
+    next->prev_phys = block;
+    return next;
+}
+
+static inline void mp_tlsf_block_mark_free(struct mp_tlsf_block *block)
+{
+    struct mp_tlsf_block *next = mp_tlsf_block_link_next(block);
+    next->size |= MP_TLSF_BLOCK_PREV_FREE;
+    block->size |= MP_TLSF_BLOCK_FREE;
+}
+
+static inline void mp_tlsf_block_mark_used(struct mp_tlsf_block *block)
+{
+    struct mp_tlsf_block *next = mp_tlsf_block_next(block);
+    next->size &= ~MP_TLSF_BLOCK_PREV_FREE;
+    block->size &= ~MP_TLSF_BLOCK_FREE;
+}
+
+static inline void mp_tlsf_mapping_insert(size_t size, int *fli, int *sli)
+{
+    int fl, sl;
+
+    if (size < MP_TLSF_SMALL_BLOCK_SIZE) {
+        fl = 0;
+        sl = (int)size / (MP_TLSF_SMALL_BLOCK_SIZE / MP_TLSF_SL_INDEX_COUNT);
+    } else {
+        fl = mp_tlsf_fls(size);
+        sl = (int)(size >> (fl - MP_TLSF_SL_INDEX_COUNT_LOG2)) ^ (1 << MP_TLSF_SL_INDEX_COUNT_LOG2);
+        fl -= (MP_TLSF_FL_INDEX_SHIFT - 1);
+    }
+    *fli = fl;
+    *sli = sl;
+}
+
+/* 查找时向上取整到下一个二级区间，保证区间内任一块都满足请求 */
+static inline void mp_tlsf_mapping_search(size_t size, int *fli, int *sli)
+{
+    if (size >= MP_TLSF_SMALL_BLOCK_SIZE) {
+        size += ((size_t)1 << (mp_tlsf_fls(size) - MP_TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mp_tlsf_mapping_insert(size, fli, sli);
+}
+
+static struct mp_tlsf_block *mp_tlsf_search_suitable(struct mp_tlsf_imp *imp, int *fli, int *sli)
+{
+    int fl = *fli;
+    int sl = *sli;
+    unsigned int sl_map;
+    unsigned int fl_map;
+
+    sl_map = imp->sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+        fl_map = (fl + 1 < 32) ? (imp->fl_bitmap & (~0U << (fl + 1))) : 0;
+        if (!fl_map) {
+            return NULL;
+        }
+        fl = mp_tlsf_ffs(fl_map);
+        *fli = fl;
+        sl_map = imp->sl_bitmap[fl];
+    }
+    sl = mp_tlsf_ffs(sl_map);
+    *sli = sl;
+    return imp->blocks[fl][sl];
+}
+
+static void mp_tlsf_remove_free(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block, int fl, int sl)
+{
+    struct mp_tlsf_block *prev = block->prev_free;
+    struct mp_tlsf_block *next = block->next_free;
+
+    next->prev_free = prev;
+    prev->next_free = next;
+    if (imp->blocks[fl][sl] == block) {
+        imp->blocks[fl][sl] = next;
+        if (next == &imp->block_null) {
+            imp->sl_bitmap[fl] &= ~(1U << sl);
+            if (!imp->sl_bitmap[fl]) {
+                imp->fl_bitmap &= ~(1U << fl);
+            }
+        }
+    }
+}
+
+static void mp_tlsf_insert_free(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block, int fl, int sl)
+{
+    struct mp_tlsf_block *current = imp->blocks[fl][sl];
+
+    block->next_free = current;
+    block->prev_free = &imp->block_null;
+    current->prev_free = block;
+    imp->blocks[fl][sl] = block;
+    imp->fl_bitmap |= (1U << fl);
+    imp->sl_bitmap[fl] |= (1U << sl);
+}
+
+static inline void mp_tlsf_block_remove(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block)
+{
+    int fl, sl;
+
+    mp_tlsf_mapping_insert(mp_tlsf_block_size(block), &fl, &sl);
+    mp_tlsf_remove_free(imp, block, fl, sl);
+}
+
+static inline void mp_tlsf_block_insert(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block)
+{
+    int fl, sl;
+
+    mp_tlsf_mapping_insert(mp_tlsf_block_size(block), &fl, &sl);
+    mp_tlsf_insert_free(imp, block, fl, sl);
+}
+
+static inline int mp_tlsf_block_can_split(const struct mp_tlsf_block *block, size_t size)
+{
+    return mp_tlsf_block_size(block) >= sizeof(struct mp_tlsf_block) + size;
+}
+
+static struct mp_tlsf_block *mp_tlsf_block_split(struct mp_tlsf_block *block, size_t size)
+{
+    struct mp_tlsf_block *remaining;
+    size_t remain_size;
+
+    remaining = (struct mp_tlsf_block *)((char *)mp_tlsf_block_to_ptr(block) + size - MP_TLSF_BLOCK_OVERHEAD);
+    remain_size = mp_tlsf_block_size(block) - (size + MP_TLSF_BLOCK_OVERHEAD);
+    remaining->size = 0;
+    mp_tlsf_block_set_size(remaining, remain_size);
+    mp_tlsf_block_set_size(block, size);
+    mp_tlsf_block_mark_free(remaining);
+    return remaining;
+}
+
+static struct mp_tlsf_block *mp_tlsf_block_absorb(struct mp_tlsf_block *prev, struct mp_tlsf_block *block)
+{
+    prev->size += mp_tlsf_block_size(block) + MP_TLSF_BLOCK_OVERHEAD;
+    mp_tlsf_block_link_next(prev);
+    return prev;
+}
+
+static struct mp_tlsf_block *mp_tlsf_merge_prev(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block)
+{
+    struct mp_tlsf_block *prev;
+
+    if (mp_tlsf_block_is_prev_free(block)) {
+        prev = block->prev_phys;
+        mp_tlsf_block_remove(imp, prev);
+        block = mp_tlsf_block_absorb(prev, block);
+    }
+    return block;
+}
+
+static struct mp_tlsf_block *mp_tlsf_merge_next(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block)
+{
+    struct mp_tlsf_block *next = mp_tlsf_block_next(block);
+
+    if (mp_tlsf_block_is_free(next)) {
+        mp_tlsf_block_remove(imp, next);
+        block = mp_tlsf_block_absorb(block, next);
+    }
+    return block;
+}
+
+/* 把空闲块裁剪到size，剩余部分放回空闲链表 */
+static void mp_tlsf_trim_free(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block, size_t size)
+{
+    struct mp_tlsf_block *remaining;
+
+    if (mp_tlsf_block_can_split(block, size)) {
+        remaining = mp_tlsf_block_split(block, size);
+        mp_tlsf_block_link_next(block);
+        remaining->size |= MP_TLSF_BLOCK_PREV_FREE;
+        mp_tlsf_block_insert(imp, remaining);
+    }
+}
+
+/* 把已使用块裁剪到size，剩余部分和后面的空闲块合并 */
+static void mp_tlsf_trim_used(struct mp_tlsf_imp *imp, struct mp_tlsf_block *block, size_t size)
+{
+    struct mp_tlsf_block *remaining;
+
+    if (mp_tlsf_block_can_split(block, size)) {
+        remaining = mp_tlsf_block_split(block, size);
+        remaining->size &= ~MP_TLSF_BLOCK_PREV_FREE;
+        remaining = mp_tlsf_merge_next(imp, remaining);
+        mp_tlsf_block_insert(imp, remaining);
+    }
+}
+
+static inline size_t mp_tlsf_adjust_size(size_t size)
+{
+    size_t aligned;
+
+    if (!size || size >= MP_TLSF_BLOCK_SIZE_MAX) {
+        return 0;
+    }
+    aligned = (size + MP_TLSF_ALIGN - 1) & ~((size_t)MP_TLSF_ALIGN - 1);
+    return aligned < MP_TLSF_BLOCK_SIZE_MIN ? MP_TLSF_BLOCK_SIZE_MIN : aligned;
+}
+
+static struct mp_tlsf_block *mp_tlsf_locate_free(struct mp_tlsf_imp *imp, size_t size)
+{
+    int fl, sl;
+    struct mp_tlsf_block *block;
+
+    mp_tlsf_mapping_search(size, &fl, &sl);
+    if (fl >= MP_TLSF_FL_INDEX_COUNT) {
+        return NULL;
+    }
+    block = mp_tlsf_search_suitable(imp, &fl, &sl);
+    if (!block || block == &imp->block_null) {
+        return NULL;
+    }
+    mp_tlsf_remove_free(imp, block, fl, sl);
+    return block;
+}
+
+static void mp_tlsf_add_region(struct mp_tlsf_imp *imp, char *mem, size_t bytes)
+{
+    size_t pool_bytes;
+    struct mp_tlsf_block *block;
+    struct mp_tlsf_block *next;
+
+    /* 首块的prev_phys落在区域之前，永远不会被访问；末尾放置大小为0的已使用哨兵块 */
+    pool_bytes = (bytes - 2 * MP_TLSF_BLOCK_OVERHEAD) & ~((size_t)MP_TLSF_ALIGN - 1);
+    block = (struct mp_tlsf_block *)(mem - MP_TLSF_BLOCK_OVERHEAD);
+    block->size = 0;
+    mp_tlsf_block_set_size(block, pool_bytes);
+    block->size |= MP_TLSF_BLOCK_FREE;
+    block->size &= ~MP_TLSF_BLOCK_PREV_FREE;
+    mp_tlsf_block_insert(imp, block);
+
+    next = mp_tlsf_block_link_next(block);
+    next->size = MP_TLSF_BLOCK_PREV_FREE;
+}
+
+void *mp_tlsf_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr)
+{
+    int i, j;
+    size_t total = 0;
+    struct mp_tlsf_imp *imp;
+
+    if (!arr) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    (void)attr;
+
+    imp = mp_tlsf_calloc(1, sizeof(struct mp_tlsf_imp));
+    if (!imp) {
+        MP_LOG_ERROR("calloc fail.");
+        return NULL;
+    }
+    if (pthread_mutex_init(&imp->lck, NULL) != 0) {
+        MP_LOG_ERROR("pthread_mutex_init fail.");
+        mp_tlsf_free(imp);
+        return NULL;
+    }
+
+    imp->block_null.next_free = &imp->block_null;
+    imp->block_null.prev_free = &imp->block_null;
+    for (i = 0; i < MP_TLSF_FL_INDEX_COUNT; i++) {
+        for (j = 0; j < MP_TLSF_SL_INDEX_COUNT; j++) {
+            imp->blocks[i][j] = &imp->block_null;
+        }
+    }
+
+    for (i = 0; i < arr_num; i++) {
+        total += (mp_tlsf_adjust_size(arr[i].size) + MP_TLSF_BLOCK_OVERHEAD) * (arr[i].capacity > 0 ? arr[i].capacity : 1);
+    }
+    total *= MP_TLSF_REGION_FACTOR;
+    if (total < MP_TLSF_REGION_MIN) {
+        total = MP_TLSF_REGION_MIN;
+    } else if (total > MP_TLSF_REGION_MAX) {
+        total = MP_TLSF_REGION_MAX;
+    }
+
+    /* 预取页面，运行时不产生缺页 */
+    imp->region = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (imp->region == MAP_FAILED) {
+        MP_LOG_ERROR("mmap region fail, size[%lu].", total);
+        imp->region = NULL;
+        mp_tlsf_destroy_imp(imp);
+        return NULL;
+    }
+    imp->region_size = total;
+    /* 区域头部留出一个块头的位置，容纳首块的prev_phys */
+    mp_tlsf_add_region(imp, imp->region + MP_TLSF_ALIGN, total - MP_TLSF_ALIGN);
+    MP_LOG_DEBUG("tlsf region [%p] size [%luKB].", imp->region, total/1024);
+    return imp;
+}
+
+void mp_tlsf_destroy_imp(void* mh)
+{
+    struct mp_tlsf_imp *imp;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_tlsf_imp *)mh;
+    if (imp->region) {
+        munmap(imp->region, imp->region_size);
+    }
+    pthread_mutex_destroy(&imp->lck);
+    mp_tlsf_free(imp);
+}
+
+void *mp_tlsf_alloc_imp(void* mh, size_t size)
+{
+    size_t adjust;
+    struct mp_tlsf_imp *imp;
+    struct mp_tlsf_block *block;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    imp = (struct mp_tlsf_imp *)mh;
+    adjust = mp_tlsf_adjust_size(size);
+    if (!adjust) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&imp->lck);
+    block = mp_tlsf_locate_free(imp, adjust);
+    if (!block) {
+        pthread_mutex_unlock(&imp->lck);
+        return NULL;
+    }
+    mp_tlsf_trim_free(imp, block, adjust);
+    mp_tlsf_block_mark_used(block);
+    pthread_mutex_unlock(&imp->lck);
+    return mp_tlsf_block_to_ptr(block);
+}
+
+void mp_tlsf_free_imp(void* mh, void *mem)
+{
+    struct mp_tlsf_imp *imp;
+    struct mp_tlsf_block *block;
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return;
+    }
+    imp = (struct mp_tlsf_imp *)mh;
+    block = mp_tlsf_block_from_ptr(mem);
+    if (mp_tlsf_block_is_free(block)) {
+        MP_LOG_ERROR("ptr[%p] double free.", mem);
+        abort();
+    }
+
+    pthread_mutex_lock(&imp->lck);
+    mp_tlsf_block_mark_free(block);
+    block = mp_tlsf_merge_prev(imp, block);
+    block = mp_tlsf_merge_next(imp, block);
+    mp_tlsf_block_insert(imp, block);
+    pthread_mutex_unlock(&imp->lck);
+}
+
+void *mp_tlsf_realloc_imp(void* mh, void *mem, size_t newsize)
+{
+    size_t adjust;
+    size_t cursize;
+    size_t combined;
+    struct mp_tlsf_imp *imp;
+    struct mp_tlsf_block *block;
+    struct mp_tlsf_block *next;
+    void *new_mem;
+
+    if (!mh) {
+        MP_LOG_ERROR("null ptr.");
+        return NULL;
+    }
+    if (!mem) {
+        return mp_tlsf_alloc_imp(mh, newsize);
+    }
+    if (newsize == 0) {
+        mp_tlsf_free_imp(mh, mem);
+        return NULL;
+    }
+
+    imp = (struct mp_tlsf_imp *)mh;
+    adjust = mp_tlsf_adjust_size(newsize);
+    if (!adjust) {
+        return NULL;
+    }
+    block = mp_tlsf_block_from_ptr(mem);
+
+    /* 后面的物理块空闲且合并后足够，则原地扩展；缩小则直接裁剪 */
+    pthread_mutex_lock(&imp->lck);
+    cursize = mp_tlsf_block_size(block);
+    next = mp_tlsf_block_next(block);
+    combined = cursize + mp_tlsf_block_size(next) + MP_TLSF_BLOCK_OVERHEAD;
+    if (adjust <= cursize || (mp_tlsf_block_is_free(next) && adjust <= combined)) {
+        if (adjust > cursize) {
+            mp_tlsf_merge_next(imp, block);
+            mp_tlsf_block_mark_used(block);
+        }
+        mp_tlsf_trim_used(imp, block, adjust);
+        pthread_mutex_unlock(&imp->lck);
+        return mem;
+    }
+    pthread_mutex_unlock(&imp->lck);
+
+    new_mem = mp_tlsf_alloc_imp(mh, newsize);
+    if (!new_mem) {
+        return NULL;
+    }
+    memcpy(new_mem, mem, cursize);
+    mp_tlsf_free_imp(mh, mem);
+    return new_mem;
+}
+
+size_t mp_tlsf_usable_size_imp(void* mh, const void *mem)
+{
+    size_t size;
+    struct mp_tlsf_imp *imp;
+
+    if (!mh || !mem) {
+        MP_LOG_ERROR("null ptr.");
+        return 0;
+    }
+    imp = (struct mp_tlsf_imp *)mh;
+    pthread_mutex_lock(&imp->lck);
+    size = mp_tlsf_block_size(mp_tlsf_block_from_ptr(mem));
+    pthread_mutex_unlock(&imp->lck);
+    return size;
+}
@@ -0,0 +1,21 @@
+#ifndef MPMALLOC_TLSF_IMP_H_
+#define MPMALLOC_TLSF_IMP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mp_unit;
+struct mp_attr;
+void *mp_tlsf_create_imp(const struct mp_unit *arr, int arr_num, const struct mp_attr *attr);
+void *mp_tlsf_alloc_imp(void* mh, size_t size);
+void *mp_tlsf_realloc_imp(void* mh, void *mem, size_t newsize);
+void mp_tlsf_free_imp(void* mh, void *mem);
+void mp_tlsf_destroy_imp(void* mh);
+size_t mp_tlsf_usable_size_imp(void* mh, const void *mem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
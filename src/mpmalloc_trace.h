@@ -0,0 +1,40 @@
+#ifndef MPMALLOC_TRACE_H_
+#define MPMALLOC_TRACE_H_
+
+/*
+ * 静态跟踪点（USDT），provider为mpmalloc，未挂载时只是一条nop指令。
+ *   有 <sys/sdt.h>（systemtap-sdt-dev）时自动开启，定义 MP_NO_USDT 可强制关闭；不支持时宏为空。
+ *   查看：perf list sdt_mpmalloc:* / bpftrace -l 'usdt:<libmpm.so>:mpmalloc:*'
+ *
+ *   pool_grow(node_id, unit_size, mempool_id, capacity)   动态内存池扩展
+ *   pool_shrink(node_id, unit_size, mempool_id, capacity) 动态内存池释放
+ *   fallback_alloc(size, ptr)                             内存池无法满足，退回glibc分配
+ *   fallback_free(ptr)                                    释放退回glibc的内存
+ *   lock_contend(node_id, unit_size)                      内存池写锁有竞争，开始等待
+ *   lock_acquire(node_id, wait_ticks)                     竞争后拿到写锁，等待的tick数
+ *   budget_reclaim(need, reclaimed)                       预算触发回收
+ *   budget_fail(used, need)                               超出预算，分配失败
+ *   tcache_refill(node_id, count)                         线程缓存从中转缓存取到一个满批次
+ *   tcache_fill(node_id, count)                           中转缓存为空，线程缓存直接从内存池装一批
+ *   tcache_flush(node_id, count)                          线程缓存把一个满批次交给中转缓存
+ *   tcache_drain(node_id, count)                          中转缓存已满或被回收，批次逐个还给内存池
+ *   calloc_zero(node_id, size)                            calloc取到的单元内容不确定为0，需要清零
+ */
+#if !defined(MP_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MP_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef MP_HAVE_USDT
+#include <sys/sdt.h>
+#define MP_TRACE1(name, a)              DTRACE_PROBE1(mpmalloc, name, a)
+#define MP_TRACE2(name, a, b)           DTRACE_PROBE2(mpmalloc, name, a, b)
+#define MP_TRACE4(name, a, b, c, d)     DTRACE_PROBE4(mpmalloc, name, a, b, c, d)
+#else
+#define MP_TRACE1(name, a)              do {} while (0)
+#define MP_TRACE2(name, a, b)           do {} while (0)
+#define MP_TRACE4(name, a, b, c, d)     do {} while (0)
+#endif
+
+#endif
@@ -1,5 +1,6 @@
 
 #include "mpmalloc.h"
+#include "mempool.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,6 +8,7 @@
 #include <assert.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 
 static const struct mp_unit g_mem_size_type[] = 
 {
@@ -299,6 +301,233 @@ int test_time(size_t nodes_num, size_t search_times)
     return 0;
 }
 
+/* 时延测试：随机分配释放，统计每次分配的平均、p99、p99.9和最坏时延；单线程和多线程竞争分别输出 */
+#define TEST_TYPE_LATENCY       2
+#define LATENCY_RUN_TIMES       200000
+#define LATENCY_SLOT_NUM        4096
+
+struct latency_args
+{
+    struct mp_handle    *mp;
+    unsigned int        seed;
+    unsigned long long  total_ns;
+    unsigned long long  max_ns;
+    size_t              count;
+    unsigned long long  *samples;   /* 每次分配的时延，最多LATENCY_RUN_TIMES个 */
+};
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void *thread_latency_test(void *args)
+{
+    int i;
+    int slot;
+    size_t size;
+    unsigned long long start, cost;
+    struct latency_args *la = (struct latency_args *)args;
+    void **parr = calloc(LATENCY_SLOT_NUM, sizeof(void *));
+
+    assert(parr != NULL);
+    for (i = 0; i < LATENCY_RUN_TIMES; i++) {
+        slot = rand_r(&la->seed) % LATENCY_SLOT_NUM;
+        if (parr[slot]) {
+            mp_free(la->mp, parr[slot]);
+            parr[slot] = NULL;
+            continue;
+        }
+        size = g_mem_size_type[rand_r(&la->seed) % (sizeof(g_mem_size_type)/sizeof(struct mp_unit))].size;
+        start = now_ns();
+        parr[slot] = mp_malloc(la->mp, size);
+        cost = now_ns() - start;
+        assert(parr[slot] != NULL);
+        la->total_ns += cost;
+        la->samples[la->count++] = cost;
+        if (cost > la->max_ns) {
+            la->max_ns = cost;
+        }
+    }
+    for (i = 0; i < LATENCY_SLOT_NUM; i++) {
+        if (parr[i]) {
+            mp_free(la->mp, parr[i]);
+        }
+    }
+    free(parr);
+    return NULL;
+}
+
+/* 编译时打开 MPM_LATENCY_HIST 后输出分配路径的百分位时延 */
+static void print_hist(struct mp_handle* mp)
+{
+    int t;
+    double tpn;
+    struct mp_hist h;
+    static const char *names[MP_HIST_E_MAX] = {"alloc fast", "alloc slow", "free fast", "free slow", "pool create", "lock wait"};
+
+    for (t = 0; t < MP_HIST_E_MAX; t++) {
+        if (mp_hist_get(mp, -1, (mp_hist_type_t)t, &h) != 0 || !h.count) {
+            continue;
+        }
+        tpn = mp_hist_ticks_per_ns();
+        printf("  %-12s count:[%llu] p50:[%.0f ns] p99:[%.0f ns] p99.9:[%.0f ns] max:[%.0f ns].\n", names[t], h.count,
+               mp_hist_percentile(&h, 50) / tpn, mp_hist_percentile(&h, 99) / tpn,
+               mp_hist_percentile(&h, 99.9) / tpn, h.max / tpn);
+    }
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* 已排序样本的百分位值 */
+static unsigned long long latency_percentile(const unsigned long long *sorted, size_t count, double p)
+{
+    size_t rank;
+
+    if (!count) {
+        return 0;
+    }
+    rank = (size_t)(count * p / 100.0);
+    return sorted[rank < count ? rank : count - 1];
+}
+
+/* thread_num个线程共用一个句柄，为1时即单线程无竞争的时延 */
+int test_latency(mp_method_t m, int thread_num)
+{
+    int i;
+    size_t count = 0;
+    unsigned long long total_ns = 0;
+    unsigned long long max_ns = 0;
+    unsigned long long *samples;
+    pthread_t thread_id[THREAD_NUM];
+    struct latency_args args[THREAD_NUM];
+    struct mp_handle* mp;
+
+    assert(thread_num > 0 && thread_num <= THREAD_NUM);
+    mp = mp_create(g_mem_size_type, (sizeof(g_mem_size_type)/sizeof(struct mp_unit)), m);
+    if (!mp) {
+        printf("mp_create fail, method[%d]!\n", m);
+        return -1;
+    }
+    samples = calloc((size_t)thread_num * LATENCY_RUN_TIMES, sizeof(unsigned long long));
+    assert(samples != NULL);
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < thread_num; i++) {
+        args[i].mp = mp;
+        args[i].seed = i + 1;
+        args[i].samples = samples + (size_t)i * LATENCY_RUN_TIMES;
+        pthread_create(&thread_id[i], NULL, thread_latency_test, &args[i]);
+    }
+    for (i = 0; i < thread_num; i++) {
+        pthread_join(thread_id[i], NULL);
+        total_ns += args[i].total_ns;
+        /* 样本紧凑排列后统一排序 */
+        memmove(samples + count, args[i].samples, args[i].count * sizeof(unsigned long long));
+        count += args[i].count;
+        if (args[i].max_ns > max_ns) {
+            max_ns = args[i].max_ns;
+        }
+    }
+    print_hist(mp);
+    mp_destroy(mp);
+
+    qsort(samples, count, sizeof(unsigned long long), latency_cmp);
+    printf("##### method[%d] %s thread num:[%d] alloc:[%lu] avg:[%llu ns] p99:[%llu ns] p99.9:[%llu ns] max:[%llu ns].\n",
+            m, thread_num > 1 ? "contended" : "single", thread_num, count, count ? total_ns / count : 0,
+            latency_percentile(samples, count, 99), latency_percentile(samples, count, 99.9), max_ns);
+    free(samples);
+    return 0;
+}
+
+/* 着色测试：遍历大量同size内存池的同一位置单元，比较着色前后的访问时间 */
+#define TEST_TYPE_COLOR         3
+#define COLOR_POOL_NUM          512
+#define COLOR_POOL_CAPACITY     8
+#define COLOR_ELE_SIZE          256
+#define COLOR_WALK_ROUNDS       20000
+
+int test_color(int flags)
+{
+    int i;
+    int r;
+    unsigned long long start, cost;
+    volatile unsigned long sum = 0;
+    struct mempool_imp *pools[COLOR_POOL_NUM];
+    unsigned long *objs[COLOR_POOL_NUM];
+
+    for (i = 0; i < COLOR_POOL_NUM; i++) {
+        pools[i] = mempool_create_ex_imp(0, COLOR_POOL_CAPACITY, COLOR_ELE_SIZE, 1, 0, flags);
+        assert(pools[i] != NULL);
+        objs[i] = (unsigned long *)mempool_get_imp(pools[i]);
+        assert(objs[i] != NULL);
+        objs[i][0] = i;
+    }
+
+    start = now_ns();
+    for (r = 0; r < COLOR_WALK_ROUNDS; r++) {
+        for (i = 0; i < COLOR_POOL_NUM; i++) {
+            sum += objs[i][0];
+        }
+    }
+    cost = now_ns() - start;
+
+    for (i = 0; i < COLOR_POOL_NUM; i++) {
+        mempool_put_imp(pools[i], objs[i]);
+        mempool_free_imp(pools[i]);
+    }
+    printf("##### %s pools:[%u] ele size:[%u] walk:[%llu ps/obj].\n", (flags & MEMPOOL_F_NO_COLOR) ? "no color" : "color",
+            COLOR_POOL_NUM, COLOR_ELE_SIZE, cost * 1000 / ((unsigned long long)COLOR_WALK_ROUNDS * COLOR_POOL_NUM));
+    return 0;
+}
+
+/* 单线程句柄测试：同一线程反复分配释放，比较加锁句柄和单线程句柄的每次耗时 */
+#define TEST_TYPE_SINGLE        4
+#define SINGLE_RUN_ROUNDS       2000
+#define SINGLE_SLOT_NUM         256
+
+int test_single(unsigned int flags)
+{
+    int i;
+    int r;
+    unsigned long long start, cost;
+    void *slots[SINGLE_SLOT_NUM];
+    struct mp_attr attr;
+    struct mp_handle* mp;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.flags = flags;
+    mp = mp_create_attr(g_mem_size_type, (sizeof(g_mem_size_type)/sizeof(struct mp_unit)), MP_METHOD_E_DEFAULT, &attr);
+    if (!mp) {
+        printf("mp_create_attr fail, flags[0x%x]!\n", flags);
+        return -1;
+    }
+    start = now_ns();
+    for (r = 0; r < SINGLE_RUN_ROUNDS; r++) {
+        for (i = 0; i < SINGLE_SLOT_NUM; i++) {
+            slots[i] = mp_malloc(mp, g_mem_size_type[(i + r) % (sizeof(g_mem_size_type)/sizeof(struct mp_unit))].size);
+            assert(slots[i] != NULL);
+        }
+        for (i = 0; i < SINGLE_SLOT_NUM; i++) {
+            mp_free(mp, slots[i]);
+        }
+    }
+    cost = now_ns() - start;
+    mp_destroy(mp);
+
+    printf("##### %s handle alloc+free:[%d] avg:[%llu ns].\n", (flags & MP_ATTR_F_SINGLE_THREAD) ? "single thread" : "locked",
+            SINGLE_RUN_ROUNDS * SINGLE_SLOT_NUM, cost / ((unsigned long long)SINGLE_RUN_ROUNDS * SINGLE_SLOT_NUM));
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     struct mp_handle* mp = NULL;
@@ -307,9 +536,30 @@ int main(int argc, char *argv[])
     int type = 0;
     size_t interval = 0;
     pthread_t		thread_id[THREAD_NUM] = {0};
+    static const mp_method_t latency_methods[] = {MP_METHOD_E_DEFAULT, MP_METHOD_E_TLSF, MP_METHOD_E_BUDDY};
 	struct timeval start_now;
 	struct timeval end_now;
 
+    if (argc > 1 && argv[1] && atoi(argv[1]) == TEST_TYPE_COLOR) {
+        test_color(MEMPOOL_F_NO_COLOR);
+        test_color(0);
+        return 0;
+    }
+
+    if (argc > 1 && argv[1] && atoi(argv[1]) == TEST_TYPE_SINGLE) {
+        test_single(0);
+        test_single(MP_ATTR_F_SINGLE_THREAD);
+        return 0;
+    }
+
+    if (argc > 1 && argv[1] && atoi(argv[1]) == TEST_TYPE_LATENCY) {
+        for (i = 0; i < (int)(sizeof(latency_methods) / sizeof(latency_methods[0])); i++) {
+            test_latency(latency_methods[i], 1);
+            test_latency(latency_methods[i], THREAD_NUM);
+        }
+        return 0;
+    }
+
     mp = mp_create(g_mem_size_type, (sizeof(g_mem_size_type)/sizeof(struct mp_unit)), MP_METHOD_E_DEFAULT);
     if (!mp) {
         printf("mp_create pdn mempool fail, regist type num of size:%d, method[%d]!\n",
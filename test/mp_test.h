@@ -0,0 +1,20 @@
+#ifndef MP_TEST_H_
+#define MP_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* 自检测试的断言：失败时打印位置，进程返回非0，ctest据此判定失败 */
+#define MP_CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+/* 运行环境不满足时的返回值，ctest记为跳过（见test/CMakeLists.txt的SKIP_RETURN_CODE） */
+#define MP_TEST_SKIP            77
+
+#define MP_TEST_ARRAY_SIZE(a)   (sizeof(a) / sizeof((a)[0]))
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * 区域方法自检（MP_METHOD_E_ARENA）
+ *   分配跨越多个块和大块后数据不互相覆盖；最近一次分配原地扩展；
+ *   mp_reset 后从第一个块重新开始分配，旧指针的地址被复用；其它方法不支持 mp_reset。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_ROUNDS        3
+#define ARENA_ALLOC_NUM     4096
+#define ARENA_LARGE_SIZE    (1024 * 1024)
+
+static const struct mp_unit g_units[] = {{64, 256}, {256, 64}};
+
+static size_t arena_size(int i)
+{
+    return 1 + (size_t)(i * 37) % 500;
+}
+
+static void arena_fill(struct mp_handle *mh, unsigned char **ptrs)
+{
+    int i;
+
+    for (i = 0; i < ARENA_ALLOC_NUM; i++) {
+        ptrs[i] = mp_malloc(mh, arena_size(i));
+        MP_CHECK(ptrs[i]);
+        MP_CHECK(((uintptr_t)ptrs[i] % MP_MALLOC_MIN_ALIGN) == 0);
+        MP_CHECK(mp_malloc_usable_size(mh, ptrs[i]) >= arena_size(i));
+        memset(ptrs[i], i & 0xff, arena_size(i));
+    }
+    for (i = 0; i < ARENA_ALLOC_NUM; i++) {
+        MP_CHECK(ptrs[i][0] == (i & 0xff) && ptrs[i][arena_size(i) - 1] == (i & 0xff));
+    }
+}
+
+int main(void)
+{
+    static unsigned char *ptrs[ARENA_ALLOC_NUM];
+    struct mp_handle *mh;
+    struct mp_handle *other;
+    unsigned char *first;
+    unsigned char *large;
+    unsigned char *p;
+    unsigned char *q;
+    int round;
+    size_t i;
+
+    mh = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_ARENA);
+    MP_CHECK(mh);
+    first = NULL;
+    for (round = 0; round < ARENA_ROUNDS; round++) {
+        arena_fill(mh, ptrs);
+        if (!first) {
+            first = ptrs[0];
+        }
+        /* reset后从第一个块的开头重新分配 */
+        MP_CHECK(ptrs[0] == first);
+
+        /* 大块单独分配，不打断当前块 */
+        large = mp_malloc(mh, ARENA_LARGE_SIZE);
+        MP_CHECK(large);
+        memset(large, 0x5a, ARENA_LARGE_SIZE);
+        p = mp_malloc(mh, 16);
+        MP_CHECK(p && (p < large || p >= large + ARENA_LARGE_SIZE));
+
+        /* 最近一次分配原地扩展，否则拷贝到新位置 */
+        memset(p, 0x11, 16);
+        q = mp_realloc(mh, p, 200);
+        MP_CHECK(q == p);
+        for (i = 0; i < 16; i++) {
+            MP_CHECK(q[i] == 0x11);
+        }
+        q = mp_realloc(mh, ptrs[1], 4000);
+        MP_CHECK(q && q != ptrs[1]);
+        MP_CHECK(q[0] == 1 && q[arena_size(1) - 1] == 1);
+
+        /* 释放为空操作，地址不会被复用 */
+        mp_free(mh, ptrs[2]);
+        p = mp_malloc(mh, arena_size(2));
+        MP_CHECK(p && p != ptrs[2]);
+        MP_CHECK(ptrs[2][0] == 2);
+        for (i = 0; i < ARENA_LARGE_SIZE; i += 4096) {
+            MP_CHECK(large[i] == 0x5a);
+        }
+
+        MP_CHECK(mp_reset(mh) == MP_OK);
+    }
+    mp_destroy(mh);
+
+    other = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_DEFAULT);
+    MP_CHECK(other);
+    MP_CHECK(mp_reset(other) == MP_ERR);
+    mp_destroy(other);
+
+    printf("test_arena ok\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * 自动分配单元自检（mp_create_auto）
+ *   [min_size, max_size] 内每个size都落在不小于它的单元上；
+ *   size不小于 16*100/max_waste_pct 时相对浪费不超过max_waste_pct，更小的size浪费不到16字节（16字节对齐的下限）；
+ *   非法参数和级数超过上限时返回NULL。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <string.h>
+
+#define AUTO_QUANTUM        16
+#define AUTO_MAX_SIZE       (32 * 1024)
+
+static void auto_check(unsigned int pct, size_t min_size, size_t max_size)
+{
+    struct mp_handle *mh;
+    size_t usable;
+    size_t size;
+    void *p;
+
+    mh = mp_create_auto(min_size, max_size, pct, 4);
+    MP_CHECK(mh);
+    for (size = min_size; size <= max_size; size += 1 + size / 512) {
+        p = mp_malloc(mh, size);
+        MP_CHECK(p);
+        usable = mp_malloc_usable_size(mh, p);
+        MP_CHECK(usable >= size);
+        if (size * pct >= AUTO_QUANTUM * 100) {
+            MP_CHECK((usable - size) * 100 <= pct * size);
+        } else {
+            MP_CHECK(usable - size < AUTO_QUANTUM);
+        }
+        memset(p, 0x5a, size);
+        mp_free(mh, p);
+    }
+    mp_destroy(mh);
+}
+
+int main(void)
+{
+    static const unsigned int pcts[] = {5, 10, 25, 50, 100};
+    unsigned int i;
+
+    for (i = 0; i < MP_TEST_ARRAY_SIZE(pcts); i++) {
+        auto_check(pcts[i], 1, AUTO_MAX_SIZE);
+        auto_check(pcts[i], 17, 4000);
+    }
+
+    MP_CHECK(mp_create_auto(0, 100, 10, 4) == NULL);
+    MP_CHECK(mp_create_auto(200, 100, 10, 4) == NULL);
+    MP_CHECK(mp_create_auto(1, 100, 0, 4) == NULL);
+    MP_CHECK(mp_create_auto(1, 100, 10, 0) == NULL);
+    MP_CHECK(mp_create_auto(1, (size_t)1 << 40, 1, 4) == NULL);
+
+    printf("test_auto ok\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * 伙伴方法自检（MP_METHOD_E_BUDDY）
+ *   拆分出的块不互相覆盖，按不同顺序释放后伙伴逐级合并，整个区域可以再次一次分配出来；
+ *   第一个区域耗尽时新增区域；
+ *   realloc在右伙伴空闲时原地扩展、缩小时原地拆分，否则搬移并保留数据，超过区域大小时走普通分配。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define BUDDY_REGION_SIZE   (1024 * 1024)       /* 分配单元总量较小时的区域大小 */
+#define BUDDY_HEAD_SIZE     16
+#define BUDDY_WHOLE         (BUDDY_REGION_SIZE - BUDDY_HEAD_SIZE)
+#define BUDDY_ALLOC_MAX     4096
+
+static const struct mp_unit g_units[] = {{64, 256}};
+
+static size_t buddy_size(int i)
+{
+    return 1 + (size_t)(i * 131) % 2000;
+}
+
+/* 整个区域作为一个块分配出来，说明所有伙伴都已合并；返回其地址 */
+static void *buddy_whole(struct mp_handle *mh)
+{
+    void *p;
+
+    p = mp_malloc(mh, BUDDY_WHOLE);
+    MP_CHECK(p && mp_malloc_usable_size(mh, p) == BUDDY_WHOLE);
+    mp_free(mh, p);
+    return p;
+}
+
+static void buddy_fill(struct mp_handle *mh, unsigned char **ptrs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        ptrs[i] = mp_malloc(mh, buddy_size(i));
+        MP_CHECK(ptrs[i]);
+        MP_CHECK(((uintptr_t)ptrs[i] % MP_MALLOC_MIN_ALIGN) == 0);
+        MP_CHECK(mp_malloc_usable_size(mh, ptrs[i]) >= buddy_size(i));
+        memset(ptrs[i], i & 0xff, buddy_size(i));
+    }
+    for (i = 0; i < n; i++) {
+        MP_CHECK(ptrs[i][0] == (i & 0xff) && ptrs[i][buddy_size(i) - 1] == (i & 0xff));
+    }
+}
+
+static void test_split_merge(struct mp_handle *mh, void *base)
+{
+    static unsigned char *ptrs[BUDDY_ALLOC_MAX];
+    int n;
+    int i;
+
+    /* 只占用第一个区域 */
+    n = 256;
+    buddy_fill(mh, ptrs, n);
+    for (i = 1; i < n; i += 2) {
+        mp_free(mh, ptrs[i]);
+    }
+    for (i = 0; i < n; i += 2) {
+        mp_free(mh, ptrs[i]);
+    }
+    MP_CHECK(buddy_whole(mh) == base);
+
+    /* 跨越多个区域，逆序释放 */
+    n = BUDDY_ALLOC_MAX;
+    buddy_fill(mh, ptrs, n);
+    for (i = n - 1; i >= 0; i--) {
+        mp_free(mh, ptrs[i]);
+    }
+    MP_CHECK(buddy_whole(mh) == base);
+
+    /* 顺序释放 */
+    buddy_fill(mh, ptrs, n);
+    for (i = 0; i < n; i++) {
+        mp_free(mh, ptrs[i]);
+    }
+    MP_CHECK(buddy_whole(mh) == base);
+}
+
+static void test_realloc(struct mp_handle *mh, void *base)
+{
+    unsigned char *p;
+    unsigned char *q;
+    unsigned char *r;
+    size_t i;
+
+    /* 空区域拆分出的第一个块位于区域开头 */
+    p = mp_malloc(mh, 100);
+    MP_CHECK(p == base);
+    memset(p, 0x11, 100);
+
+    /* 右伙伴逐级空闲，原地扩展 */
+    q = mp_realloc(mh, p, 1000);
+    MP_CHECK(q == p && mp_malloc_usable_size(mh, q) >= 1000);
+    memset(q + 100, 0x22, 900);
+
+    /* 右伙伴被占用，搬移并保留数据 */
+    r = mp_malloc(mh, 100);
+    MP_CHECK(r);
+    q = mp_realloc(mh, p, 2000);
+    MP_CHECK(q && q != p);
+    for (i = 0; i < 100; i++) {
+        MP_CHECK(q[i] == 0x11);
+    }
+    for (i = 100; i < 1000; i++) {
+        MP_CHECK(q[i] == 0x22);
+    }
+
+    /* 缩小原地拆分 */
+    p = mp_realloc(mh, q, 50);
+    MP_CHECK(p == q && p[0] == 0x11 && p[49] == 0x11);
+    MP_CHECK(mp_malloc_usable_size(mh, p) < 2000);
+
+    /* 超过区域大小走普通分配，再缩回区域内 */
+    q = mp_realloc(mh, p, 2 * BUDDY_REGION_SIZE);
+    MP_CHECK(q && mp_malloc_usable_size(mh, q) == 2 * BUDDY_REGION_SIZE);
+    MP_CHECK(q[0] == 0x11 && q[49] == 0x11);
+    q[2 * BUDDY_REGION_SIZE - 1] = 0x33;
+    p = mp_realloc(mh, q, 64);
+    MP_CHECK(p && p[0] == 0x11 && p[49] == 0x11);
+    MP_CHECK(mp_malloc_usable_size(mh, p) < BUDDY_REGION_SIZE);
+
+    mp_free(mh, p);
+    mp_free(mh, r);
+    MP_CHECK(buddy_whole(mh) == base);
+}
+
+int main(void)
+{
+    struct mp_handle *mh;
+    void *base;
+
+    mh = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_BUDDY);
+    MP_CHECK(mh);
+    base = buddy_whole(mh);
+
+    test_split_merge(mh, base);
+    test_realloc(mh, base);
+    mp_destroy(mh);
+
+    printf("test_buddy ok\n");
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * mpmalloc.hpp 自检：容器、pmr、智能指针在默认方法和只保证8字节对齐的方法上都返回满足对齐要求的内存
+ */
+#include "mpmalloc.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#ifdef MP_CXX_HAS_PMR
+#include <unordered_map>
+#endif
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        return 1; \
+    } \
+} while (0)
+
+#define ALIGNED(p, a)   ((reinterpret_cast<std::uintptr_t>(p) & ((a) - 1)) == 0)
+
+struct alignas(32) wide {
+    double v[3];
+    explicit wide(double x) : v{x, x, x} {}
+};
+
+struct base {
+    virtual ~base() {}
+    int id = 0;
+};
+
+struct same_size : base {
+    int get() const { return id; }
+};
+
+struct bigger : base {
+    char payload[64];
+};
+
+struct over_aligned : base {
+    alignas(32) double v;
+};
+
+struct plain_base {
+    int id;
+};
+
+struct plain_derived : plain_base {
+};
+
+/* 大小、对齐不同或基类没有虚析构时，不能转换成基类删除器 */
+static_assert(std::is_constructible<mp::deleter<base>, mp::deleter<same_size> >::value, "same layout converts");
+static_assert(!std::is_constructible<mp::deleter<base>, mp::deleter<bigger> >::value, "size differs");
+static_assert(!std::is_constructible<mp::deleter<base>, mp::deleter<over_aligned> >::value, "alignment differs");
+static_assert(!std::is_constructible<mp::deleter<plain_base>, mp::deleter<plain_derived> >::value, "no virtual dtor");
+static_assert(sizeof(mp::unique_ptr<wide>) == sizeof(wide *), "deleter is stateless");
+
+static int run(struct mp_handle *mh)
+{
+    int i;
+
+    {
+        std::vector<int, mp::allocator<int> > v{mp::allocator<int>(mh)};
+        for (i = 0; i < 1000; i++) {
+            v.push_back(i);
+        }
+        for (i = 0; i < 1000; i++) {
+            CHECK(v[i] == i);
+        }
+    }
+    {
+        std::vector<wide, mp::allocator<wide> > v{mp::allocator<wide>(mh)};
+        for (i = 0; i < 100; i++) {
+            v.emplace_back(i);
+            CHECK(ALIGNED(v.data(), 32));
+        }
+        CHECK(v[99].v[2] == 99.0);
+    }
+    {
+        std::vector<long double, mp::allocator<long double> > v(17, 1.0L, mp::allocator<long double>(mh));
+        CHECK(ALIGNED(v.data(), alignof(long double)));
+    }
+#ifdef MP_CXX_HAS_PMR
+    {
+        mp::memory_resource res(mh);
+        std::pmr::unordered_map<int, std::pmr::string> m(&res);
+        for (i = 0; i < 500; i++) {
+            m.emplace(i, std::pmr::string(std::to_string(i) + " a string long enough to leave SSO", &res));
+        }
+        for (i = 0; i < 500; i++) {
+            CHECK(m.at(i).compare(0, std::to_string(i).size(), std::to_string(i)) == 0);
+        }
+        m.clear();
+        void *p = res.allocate(100, 64);
+        CHECK(p && ALIGNED(p, 64));
+        res.deallocate(p, 100, 64);
+        CHECK(res.is_equal(res));
+    }
+#endif
+    {
+        /* 同一个缓存换了size需要重新查找，不支持的方法退回mp_malloc */
+        struct mp_fixed_class fc = {};
+        void *p = mp_alloc_fixed<40>(mh);
+        void *q = mp_alloc_fixed<200>(mh);
+        CHECK(p && mp_malloc_usable_size(mh, p) >= 40);
+        CHECK(q && mp_malloc_usable_size(mh, q) >= 200);
+        mp_free(mh, p);
+        mp_free(mh, q);
+        p = mp_fixed_alloc(mh, 40, &fc);
+        q = mp_fixed_alloc(mh, 200, &fc);
+        CHECK(p && mp_malloc_usable_size(mh, p) >= 40);
+        CHECK(q && mp_malloc_usable_size(mh, q) >= 200);
+        mp_free(mh, p);
+        mp_free(mh, q);
+    }
+    {
+        /* 按申请大小释放：内存池单元、realloc原地缩小后的单元和退回glibc的大块 */
+        void *p = mp_malloc(mh, 100);
+        CHECK(p);
+        mp_free_sized(mh, p, 100);
+        p = mp_malloc(mh, 1000);
+        CHECK(p);
+        p = mp_realloc(mh, p, 20);
+        CHECK(p);
+        mp_free_sized(mh, p, 20);
+        p = mp_malloc(mh, 1 << 16);
+        CHECK(p);
+        mp_free_sized(mh, p, 1 << 16);
+    }
+    mp::bind(mh);
+    {
+        std::vector<mp::unique_ptr<wide> > v;
+        for (i = 0; i < 64; i++) {
+            v.push_back(mp::make_unique<wide>(i));
+            CHECK(ALIGNED(v.back().get(), 32));
+        }
+        mp::unique_ptr<base> b = mp::make_unique<same_size>();
+        b->id = 7;
+        CHECK(static_cast<same_size *>(b.get())->get() == 7);
+    }
+    mp::bind(nullptr);
+    return 0;
+}
+
+/* 默认方法加固级别不低于1时，size比单元大说明大小或指针有误，abort */
+static int check_free_sized_mismatch(struct mp_handle *mh)
+{
+#if MP_HARDEN_LEVEL >= 1
+    int status;
+    pid_t pid;
+    void *p = mp_malloc(mh, 16);
+
+    CHECK(p);
+    pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        mp_free_sized(mh, p, 1000);
+        _exit(0);
+    }
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    mp_free_sized(mh, p, 16);
+#else
+    (void)mh;
+#endif
+    return 0;
+}
+
+int main()
+{
+    static const struct mp_unit units[] = {{16, 256}, {32, 256}, {64, 256}, {100, 64}, {256, 64}, {1024, 64}};
+    static const mp_method_t methods[] = {MP_METHOD_E_DEFAULT, MP_METHOD_E_TLSF, MP_METHOD_E_BUDDY};
+    struct mp_handle *mh;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        mh = mp_create(units, sizeof(units) / sizeof(units[0]), methods[i]);
+        CHECK(mh);
+        if (run(mh)) {
+            fprintf(stderr, "method %d failed\n", methods[i]);
+            return 1;
+        }
+        if (methods[i] == MP_METHOD_E_DEFAULT && check_free_sized_mismatch(mh)) {
+            return 1;
+        }
+        mp_destroy(mh);
+    }
+    printf("test_cxx ok\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * 时延直方图自检（内部接口 mpmalloc_hist.h）
+ *   线程退出后缓冲释放，统计合并进已退出线程的汇总，合并结果和存活线程的统计一起计入；
+ *   反复创建退出线程后计数、总和、最大值和桶计数都不丢失。
+ */
+#include "mpmalloc.h"
+#include "mpmalloc_hist.h"
+#include "mp_test.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#define HIST_CLASS_NUM      3
+#define HIST_THREAD_NUM     4
+#define HIST_ROUNDS         8
+#define HIST_RECORDS        1000
+
+struct hist_arg {
+    struct mp_hist_ctx  *ctx;
+    int                 id;
+    pthread_mutex_t     *hold;  /* 非NULL时记录完等待该锁，保持线程存活 */
+};
+
+static uint64_t hist_ticks(int id, int i)
+{
+    return (uint64_t)(id * 7 + i % 100 + 1);
+}
+
+static void *hist_worker(void *arg)
+{
+    struct hist_arg *ha = (struct hist_arg *)arg;
+    int i;
+
+    for (i = 0; i < HIST_RECORDS; i++) {
+        mp_hist_record(ha->ctx, ha->id % HIST_CLASS_NUM, MP_HIST_E_ALLOC_FAST, hist_ticks(ha->id, i));
+    }
+    if (ha->hold) {
+        pthread_mutex_lock(ha->hold);
+        pthread_mutex_unlock(ha->hold);
+    }
+    return NULL;
+}
+
+static void hist_expect(struct mp_hist *expect, int id)
+{
+    int i;
+
+    for (i = 0; i < HIST_RECORDS; i++) {
+        expect->count++;
+        expect->sum += hist_ticks(id, i);
+        if (hist_ticks(id, i) > expect->max) {
+            expect->max = hist_ticks(id, i);
+        }
+    }
+}
+
+static void hist_check(struct mp_hist_ctx *ctx, const struct mp_hist *expect)
+{
+    struct mp_hist out;
+    unsigned long long total = 0;
+    int i;
+
+    MP_CHECK(mp_hist_ctx_merge(ctx, -1, MP_HIST_E_ALLOC_FAST, &out) == MP_OK);
+    MP_CHECK(out.count == expect->count);
+    MP_CHECK(out.sum == expect->sum);
+    MP_CHECK(out.max == expect->max);
+    for (i = 0; i < MP_HIST_BUCKET_NUM; i++) {
+        total += out.buckets[i];
+    }
+    MP_CHECK(total == expect->count);
+    MP_CHECK(mp_hist_ctx_merge(ctx, -1, MP_HIST_E_FREE_FAST, &out) == MP_OK && out.count == 0);
+}
+
+int main(void)
+{
+    pthread_mutex_t hold = PTHREAD_MUTEX_INITIALIZER;
+    struct hist_arg args[HIST_THREAD_NUM];
+    pthread_t tids[HIST_THREAD_NUM];
+    struct hist_arg live_arg;
+    struct mp_hist expect;
+    struct mp_hist_ctx *ctx;
+    pthread_t live;
+    int round;
+    int i;
+
+    ctx = mp_hist_ctx_create(HIST_CLASS_NUM);
+    MP_CHECK(ctx);
+    memset(&expect, 0, sizeof(expect));
+
+    /* 一个线程在整个过程中存活 */
+    pthread_mutex_lock(&hold);
+    live_arg.ctx = ctx;
+    live_arg.id = HIST_THREAD_NUM * HIST_ROUNDS;
+    live_arg.hold = &hold;
+    MP_CHECK(pthread_create(&live, NULL, hist_worker, &live_arg) == 0);
+    hist_expect(&expect, live_arg.id);
+
+    for (round = 0; round < HIST_ROUNDS; round++) {
+        for (i = 0; i < HIST_THREAD_NUM; i++) {
+            args[i].ctx = ctx;
+            args[i].id = round * HIST_THREAD_NUM + i;
+            args[i].hold = NULL;
+            MP_CHECK(pthread_create(&tids[i], NULL, hist_worker, &args[i]) == 0);
+            hist_expect(&expect, args[i].id);
+        }
+        for (i = 0; i < HIST_THREAD_NUM; i++) {
+            MP_CHECK(pthread_join(tids[i], NULL) == 0);
+        }
+        /* 主线程不打点，存活线程记录完成前计数可能偏少 */
+        while (1) {
+            struct mp_hist out;
+
+            MP_CHECK(mp_hist_ctx_merge(ctx, -1, MP_HIST_E_ALLOC_FAST, &out) == MP_OK);
+            if (out.count == expect.count) {
+                break;
+            }
+            MP_CHECK(out.count < expect.count);
+        }
+        hist_check(ctx, &expect);
+    }
+
+    pthread_mutex_unlock(&hold);
+    MP_CHECK(pthread_join(live, NULL) == 0);
+    hist_check(ctx, &expect);
+    mp_hist_ctx_destroy(ctx);
+
+    printf("test_hist ok\n");
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * 使用中单元遍历自检（mp_foreach_live，MP_METHOD_E_DEFAULT）
+ *   遍历恰好访问业务持有的每个内存池单元一次，大小为实际可用大小；
+ *   已释放（包括停在线程缓存和隔离区里）的单元和退回glibc的分配不被访问；
+ *   标签子内存池的单元同样访问；不支持的方法返回MP_ERR。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LIVE_ALLOC_NUM      1200
+#define LIVE_BIG_SIZE       (1024 * 1024)
+
+static const struct mp_unit g_units[] = {{32, 256}, {100, 128}, {1024, 64}};
+
+struct live_ctx {
+    struct mp_handle    *mh;
+    void                **seen;
+    int                 num;
+    int                 max;
+};
+
+static void live_collect(void *p, size_t size, void *arg)
+{
+    struct live_ctx *ctx = (struct live_ctx *)arg;
+
+    MP_CHECK(ctx->num < ctx->max);
+    MP_CHECK(size == mp_malloc_usable_size(ctx->mh, p));
+    ctx->seen[ctx->num++] = p;
+}
+
+static int live_ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void * const *)a;
+    uintptr_t y = (uintptr_t)*(void * const *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* 遍历结果和期望的指针集合完全一致 */
+static void live_check(struct mp_handle *mh, void **expect, int n)
+{
+    static void *seen[LIVE_ALLOC_NUM];
+    static void *sorted[LIVE_ALLOC_NUM];
+    struct live_ctx ctx;
+    int i;
+
+    ctx.mh = mh;
+    ctx.seen = seen;
+    ctx.num = 0;
+    ctx.max = LIVE_ALLOC_NUM;
+    MP_CHECK(mp_foreach_live(mh, live_collect, &ctx) == n);
+    MP_CHECK(ctx.num == n);
+    MP_CHECK(mp_foreach_live(mh, NULL, NULL) == n);
+
+    memcpy(sorted, expect, n * sizeof(void *));
+    qsort(sorted, n, sizeof(void *), live_ptr_cmp);
+    qsort(seen, n, sizeof(void *), live_ptr_cmp);
+    for (i = 0; i < n; i++) {
+        MP_CHECK(seen[i] == sorted[i]);
+    }
+}
+
+static size_t live_size(int i)
+{
+    static const size_t sizes[] = {1, 32, 50, 100, 700, 1024};
+
+    return sizes[i % MP_TEST_ARRAY_SIZE(sizes)];
+}
+
+static void test_live(struct mp_handle *mh)
+{
+    static void *ptrs[LIVE_ALLOC_NUM];
+    static void *live[LIVE_ALLOC_NUM];
+    void *big;
+    int n;
+    int i;
+
+    live_check(mh, NULL, 0);
+
+    /* 超过容量的部分进入动态内存池，部分单元打标签 */
+    for (i = 0; i < LIVE_ALLOC_NUM; i++) {
+        ptrs[i] = (i % 7 == 3) ? mp_malloc_tagged(mh, 1 + i % 3, live_size(i)) : mp_malloc(mh, live_size(i));
+        MP_CHECK(ptrs[i]);
+    }
+    big = mp_malloc(mh, LIVE_BIG_SIZE);
+    MP_CHECK(big);
+    live_check(mh, ptrs, LIVE_ALLOC_NUM);
+
+    /* 释放一部分，释放的单元可能停在线程缓存或隔离区 */
+    n = 0;
+    for (i = 0; i < LIVE_ALLOC_NUM; i++) {
+        if (i % 3) {
+            mp_free(mh, ptrs[i]);
+        } else {
+            live[n++] = ptrs[i];
+        }
+    }
+    live_check(mh, live, n);
+
+    /* 遍历后照常分配释放 */
+    for (i = 0; i < n; i++) {
+        mp_free(mh, live[i]);
+    }
+    mp_free(mh, big);
+    live_check(mh, NULL, 0);
+    for (i = 0; i < 10; i++) {
+        live[i] = mp_malloc(mh, live_size(i));
+        MP_CHECK(live[i]);
+    }
+    live_check(mh, live, 10);
+    for (i = 0; i < 10; i++) {
+        mp_free(mh, live[i]);
+    }
+}
+
+int main(void)
+{
+    struct mp_attr attr = {0};
+    struct mp_handle *mh;
+
+    mh = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_DEFAULT);
+    MP_CHECK(mh);
+    test_live(mh);
+    mp_destroy(mh);
+
+    attr.flags = MP_ATTR_F_THREAD_CACHE;
+    mh = mp_create_attr(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_DEFAULT, &attr);
+    MP_CHECK(mh);
+    test_live(mh);
+    mp_destroy(mh);
+
+    attr.flags = MP_ATTR_F_SINGLE_THREAD;
+    mh = mp_create_attr(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_DEFAULT, &attr);
+    MP_CHECK(mh);
+    test_live(mh);
+    mp_destroy(mh);
+
+    mh = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_TLSF);
+    MP_CHECK(mh);
+    MP_CHECK(mp_foreach_live(mh, NULL, NULL) == MP_ERR);
+    mp_destroy(mh);
+
+    printf("test_live ok\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * 对象缓存自检（mp_objcache_*）
+ *   每个池单元只构造一次，归还再取出时仍保持构造状态，析构只在内存池缩减和销毁时发生；
+ *   池耗尽后退回posix_memalign，这些对象每次分配构造、释放析构；
+ *   对象按align对齐（0按max_align_t），销毁后构造和析构次数相等。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define OBJ_MAGIC           0x6f626a63u
+#define OBJ_POOL_CAPACITY   512                     /* 第一个内存池的对象个数 */
+#define OBJ_POOL_TOTAL      (OBJ_POOL_CAPACITY * 36) /* 8个内存池，第n个为n倍容量 */
+#define OBJ_ANY_NUM         10
+
+struct obj {
+    unsigned int    magic;
+    unsigned int    state;
+    char            payload[40];
+};
+
+static int g_ctor_num;
+static int g_dtor_num;
+
+static void obj_ctor(void *p)
+{
+    struct obj *o = (struct obj *)p;
+
+    MP_CHECK(o->magic != OBJ_MAGIC);
+    o->magic = OBJ_MAGIC;
+    o->state = 0;
+    g_ctor_num++;
+}
+
+static void obj_dtor(void *p)
+{
+    struct obj *o = (struct obj *)p;
+
+    MP_CHECK(o->magic == OBJ_MAGIC);
+    o->magic = 0;
+    g_dtor_num++;
+}
+
+static struct obj *obj_alloc(struct mp_objcache *oc, size_t align)
+{
+    struct obj *o;
+
+    o = (struct obj *)mp_objcache_alloc(oc);
+    MP_CHECK(o);
+    MP_CHECK(((uintptr_t)o % align) == 0);
+    MP_CHECK(o->magic == OBJ_MAGIC);
+    return o;
+}
+
+static void test_reuse(size_t align)
+{
+    static struct obj *objs[OBJ_POOL_TOTAL + OBJ_ANY_NUM];
+    struct mp_objcache *oc;
+    size_t expect_align = align ? align : _Alignof(max_align_t);
+    int ctor;
+    int i;
+
+    g_ctor_num = 0;
+    g_dtor_num = 0;
+    oc = mp_objcache_create(sizeof(struct obj), align, obj_ctor, obj_dtor);
+    MP_CHECK(oc);
+    MP_CHECK(g_ctor_num == 0);
+
+    /* 第一个内存池：每个单元第一次取出时构造，归还后再取出不再构造，状态保留 */
+    for (i = 0; i < OBJ_POOL_CAPACITY; i++) {
+        objs[i] = obj_alloc(oc, expect_align);
+        objs[i]->state = 1;
+    }
+    MP_CHECK(g_ctor_num == OBJ_POOL_CAPACITY);
+    for (i = 0; i < OBJ_POOL_CAPACITY; i++) {
+        mp_objcache_free(oc, objs[i]);
+    }
+    MP_CHECK(g_dtor_num == 0);
+    for (i = 0; i < OBJ_POOL_CAPACITY; i++) {
+        objs[i] = obj_alloc(oc, expect_align);
+        MP_CHECK(objs[i]->state == 1);
+    }
+    MP_CHECK(g_ctor_num == OBJ_POOL_CAPACITY);
+
+    /* 扩展出第二个内存池，先归还动态内存池的对象，不触发缩减；shrink时才析构 */
+    for (i = OBJ_POOL_CAPACITY; i < OBJ_POOL_CAPACITY * 3; i++) {
+        objs[i] = obj_alloc(oc, expect_align);
+    }
+    MP_CHECK(g_ctor_num == OBJ_POOL_CAPACITY * 3);
+    for (i = OBJ_POOL_CAPACITY * 3 - 1; i >= 0; i--) {
+        mp_objcache_free(oc, objs[i]);
+    }
+    MP_CHECK(g_dtor_num == 0);
+    MP_CHECK(mp_objcache_shrink(oc) == 1);
+    MP_CHECK(g_dtor_num == OBJ_POOL_CAPACITY * 2);
+    MP_CHECK(mp_objcache_shrink(oc) == 0);
+
+    /* 取尽所有内存池后退回posix_memalign，这些对象分配时构造，释放时立即析构 */
+    for (i = 0; i < OBJ_POOL_TOTAL; i++) {
+        objs[i] = obj_alloc(oc, expect_align);
+    }
+    MP_CHECK(g_ctor_num == OBJ_POOL_CAPACITY * 3 + (OBJ_POOL_TOTAL - OBJ_POOL_CAPACITY));
+    ctor = g_ctor_num;
+    for (i = OBJ_POOL_TOTAL; i < OBJ_POOL_TOTAL + OBJ_ANY_NUM; i++) {
+        objs[i] = obj_alloc(oc, expect_align);
+    }
+    MP_CHECK(g_ctor_num == ctor + OBJ_ANY_NUM);
+    for (i = OBJ_POOL_TOTAL; i < OBJ_POOL_TOTAL + OBJ_ANY_NUM; i++) {
+        mp_objcache_free(oc, objs[i]);
+        MP_CHECK(g_dtor_num == OBJ_POOL_CAPACITY * 2 + (i - OBJ_POOL_TOTAL + 1));
+    }
+
+    /* 归还后销毁，所有构造过的对象都已析构 */
+    for (i = OBJ_POOL_TOTAL - 1; i >= 0; i--) {
+        mp_objcache_free(oc, objs[i]);
+    }
+    mp_objcache_destroy(oc);
+    MP_CHECK(g_ctor_num == g_dtor_num);
+}
+
+int main(void)
+{
+    struct mp_objcache *oc;
+    void *p;
+
+    test_reuse(0);
+    test_reuse(64);
+
+    /* 小于指针大小的对齐按指针大小，非法对齐返回NULL */
+    oc = mp_objcache_create(3, 1, NULL, NULL);
+    MP_CHECK(oc);
+    p = mp_objcache_alloc(oc);
+    MP_CHECK(p && ((uintptr_t)p % sizeof(void *)) == 0);
+    mp_objcache_free(oc, p);
+    mp_objcache_destroy(oc);
+    MP_CHECK(mp_objcache_create(16, 48, NULL, NULL) == NULL);
+    MP_CHECK(mp_objcache_create(0, 0, NULL, NULL) == NULL);
+
+    printf("test_objcache ok\n");
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * 持久化自检（MP_METHOD_E_SHM + MP_ATTR_F_PERSIST）
+ *   进程在分配释放中途被杀死后重新打开：根对象和数据保留，空闲链表可用；
+ *   正常关闭后再打开，占用状态不变；布局不一致或文件已被打开时拒绝。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PERSIST_SLOT_SIZE   64
+#define PERSIST_SLOT_COUNT  64
+#define PERSIST_KEEP        8       /* 根对象里保存的分配个数 */
+
+struct persist_root {
+    size_t off[PERSIST_KEEP];
+};
+
+static const struct mp_unit g_units[] = {{PERSIST_SLOT_SIZE, PERSIST_SLOT_COUNT}};
+static char g_path[64];
+
+static struct mp_handle *persist_open(const struct mp_unit *units, int num)
+{
+    struct mp_attr attr = {0};
+
+    attr.flags = MP_ATTR_F_PERSIST;
+    attr.name = g_path;
+    return mp_create_attr(units, num, MP_METHOD_E_SHM, &attr);
+}
+
+static int persist_drain(struct mp_handle *mh, void **out, int max)
+{
+    int n = 0;
+    void *p;
+
+    while ((p = mp_malloc(mh, PERSIST_SLOT_SIZE)) != NULL) {
+        MP_CHECK(n < max);
+        out[n++] = p;
+    }
+    return n;
+}
+
+static void persist_release(struct mp_handle *mh, void **ptrs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        mp_free(mh, ptrs[i]);
+    }
+}
+
+/* 子进程：写入根对象和数据后反复分配释放，等待被杀 */
+static void persist_writer(void)
+{
+    struct mp_handle *mh;
+    struct persist_root *root;
+    char *data;
+    void *p;
+    int i;
+
+    mh = persist_open(g_units, 1);
+    MP_CHECK(mh);
+    root = mp_malloc(mh, sizeof(*root));
+    MP_CHECK(root);
+    for (i = 0; i < PERSIST_KEEP; i++) {
+        data = mp_malloc(mh, PERSIST_SLOT_SIZE);
+        MP_CHECK(data);
+        snprintf(data, PERSIST_SLOT_SIZE, "record %d", i);
+        root->off[i] = mp_offset(mh, data);
+    }
+    MP_CHECK(mp_set_root(mh, root) == MP_OK);
+    /* 通知父进程数据已写完 */
+    kill(getppid(), SIGUSR1);
+    for (;;) {
+        p = mp_malloc(mh, PERSIST_SLOT_SIZE);
+        if (p) {
+            mp_free(mh, p);
+        }
+    }
+}
+
+static volatile sig_atomic_t g_ready;
+
+static void on_ready(int sig)
+{
+    (void)sig;
+    g_ready = 1;
+}
+
+int main(void)
+{
+    static const struct mp_unit other[] = {{PERSIST_SLOT_SIZE * 2, PERSIST_SLOT_COUNT}};
+    void *ptrs[PERSIST_SLOT_COUNT];
+    struct persist_root *root;
+    struct mp_handle *mh;
+    sigset_t mask;
+    sigset_t old;
+    char expect[PERSIST_SLOT_SIZE];
+    int status;
+    int free_cnt;
+    int n;
+    int i;
+    pid_t pid;
+
+    snprintf(g_path, sizeof(g_path), "/tmp/mpm_persist_%d.dat", (int)getpid());
+    unlink(g_path);
+
+    signal(SIGUSR1, on_ready);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, &old);
+    alarm(30);
+    pid = fork();
+    MP_CHECK(pid >= 0);
+    if (pid == 0) {
+        persist_writer();
+    }
+    while (!g_ready) {
+        sigsuspend(&old);
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    usleep(2000);
+    MP_CHECK(kill(pid, SIGKILL) == 0);
+    MP_CHECK(waitpid(pid, &status, 0) == pid);
+    MP_CHECK(WIFSIGNALED(status));
+
+    /* 异常退出后重新打开，根对象和数据都在 */
+    mh = persist_open(g_units, 1);
+    MP_CHECK(mh);
+    MP_CHECK(persist_open(g_units, 1) == NULL);
+    root = mp_get_root(mh);
+    MP_CHECK(root);
+    for (i = 0; i < PERSIST_KEEP; i++) {
+        snprintf(expect, sizeof(expect), "record %d", i);
+        MP_CHECK(strcmp(mp_ptr(mh, root->off[i]), expect) == 0);
+    }
+    /* 根对象和保存的数据占用的单元不会再分配出来；被杀时手上的单元最多泄漏一个 */
+    free_cnt = persist_drain(mh, ptrs, PERSIST_SLOT_COUNT);
+    MP_CHECK(free_cnt == PERSIST_SLOT_COUNT - 1 - PERSIST_KEEP
+             || free_cnt == PERSIST_SLOT_COUNT - 2 - PERSIST_KEEP);
+    for (i = 0; i < free_cnt; i++) {
+        MP_CHECK(ptrs[i] != (void *)root);
+    }
+    persist_release(mh, ptrs, free_cnt);
+    /* 释放一半保存的数据，正常关闭 */
+    for (i = 0; i < PERSIST_KEEP / 2; i++) {
+        mp_free(mh, mp_ptr(mh, root->off[i]));
+        root->off[i] = 0;
+    }
+    mp_destroy(mh);
+
+    /* 布局不一致的打开被拒绝，文件保持不变 */
+    MP_CHECK(persist_open(other, 1) == NULL);
+
+    /* 正常关闭后再打开，占用状态和数据保持 */
+    mh = persist_open(g_units, 1);
+    MP_CHECK(mh);
+    root = mp_get_root(mh);
+    MP_CHECK(root);
+    for (i = PERSIST_KEEP / 2; i < PERSIST_KEEP; i++) {
+        snprintf(expect, sizeof(expect), "record %d", i);
+        MP_CHECK(strcmp(mp_ptr(mh, root->off[i]), expect) == 0);
+    }
+    n = persist_drain(mh, ptrs, PERSIST_SLOT_COUNT);
+    MP_CHECK(n == free_cnt + PERSIST_KEEP / 2);
+    persist_release(mh, ptrs, n);
+    mp_destroy(mh);
+    alarm(0);
+
+    unlink(g_path);
+    printf("test_persist ok\n");
+    return 0;
+}
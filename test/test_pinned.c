@@ -0,0 +1,143 @@
+/*
+ * 锁定区域自检（MP_METHOD_E_BUDDY + MP_ATTR_F_PINNED）
+ *   区域只增不减，新增区域追加在末尾，已有区域的下标、地址和长度在句柄生命周期内不变；
+ *   mp_region_index 把区域内（包括缓冲区内部）的指针转换为下标和偏移，区域外的指针返回MP_ERR；
+ *   锁定模式不退回普通分配，非锁定句柄不支持区域接口。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+
+#define PINNED_REGION_SIZE  (1024 * 1024)       /* 分配单元总量较小时的区域大小 */
+#define PINNED_REGION_NUM   3
+#define PINNED_BUF_SIZE     4000
+#define PINNED_ALLOC_MAX    1024
+
+static const struct mp_unit g_units[] = {{PINNED_BUF_SIZE, 64}};
+
+/* RLIMIT_MEMLOCK不够锁定所有区域时跳过 */
+static int pinned_supported(void)
+{
+    struct rlimit rl;
+    size_t size = (size_t)PINNED_REGION_SIZE * PINNED_REGION_NUM;
+    void *p;
+    int rc;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_MEMLOCK, &rl);
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    MP_CHECK(p != MAP_FAILED);
+    rc = mlock(p, size);
+    munmap(p, size);
+    return rc == 0;
+}
+
+/* 每个指针都落在返回下标的区域内，偏移一致 */
+static void pinned_check_index(struct mp_handle *mh, const struct iovec *iov, int num, const unsigned char *p)
+{
+    size_t off;
+    int idx;
+
+    idx = mp_region_index(mh, p, &off);
+    MP_CHECK(idx >= 0 && idx < num);
+    MP_CHECK(p >= (unsigned char *)iov[idx].iov_base && p + PINNED_BUF_SIZE <= (unsigned char *)iov[idx].iov_base + iov[idx].iov_len);
+    MP_CHECK(off == (size_t)(p - (unsigned char *)iov[idx].iov_base));
+    MP_CHECK(mp_region_index(mh, p + PINNED_BUF_SIZE - 1, &off) == idx);
+    MP_CHECK(off == (size_t)(p - (unsigned char *)iov[idx].iov_base) + PINNED_BUF_SIZE - 1);
+    MP_CHECK(mp_region_index(mh, p, NULL) == idx);
+}
+
+int main(void)
+{
+    static unsigned char *ptrs[PINNED_ALLOC_MAX];
+    struct iovec first[PINNED_REGION_NUM];
+    struct iovec iov[PINNED_REGION_NUM + 1];
+    struct mp_attr attr = {0};
+    struct mp_handle *mh;
+    struct mp_handle *plain;
+    int local;
+    int num;
+    int n;
+    int i;
+
+    if (!pinned_supported()) {
+        printf("test_pinned skipped: RLIMIT_MEMLOCK too small\n");
+        return MP_TEST_SKIP;
+    }
+
+    attr.flags = MP_ATTR_F_PINNED;
+    mh = mp_create_attr(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_BUDDY, &attr);
+    MP_CHECK(mh);
+    MP_CHECK(mp_regions(mh, NULL, 0) == 1);
+    MP_CHECK(mp_regions(mh, first, 1) == 1);
+    MP_CHECK(first[0].iov_base && first[0].iov_len == PINNED_REGION_SIZE);
+
+    /* 分配到出现第PINNED_REGION_NUM个区域，每次新增区域时已有的区域不变 */
+    num = 1;
+    for (n = 0; num < PINNED_REGION_NUM; n++) {
+        MP_CHECK(n < PINNED_ALLOC_MAX);
+        ptrs[n] = mp_malloc(mh, PINNED_BUF_SIZE);
+        MP_CHECK(ptrs[n]);
+        memset(ptrs[n], n & 0xff, PINNED_BUF_SIZE);
+        i = mp_regions(mh, iov, PINNED_REGION_NUM + 1);
+        MP_CHECK(i == num || i == num + 1);
+        if (i > num) {
+            first[num] = iov[num];
+            num = i;
+        }
+        for (i = 0; i < num; i++) {
+            MP_CHECK(iov[i].iov_base == first[i].iov_base && iov[i].iov_len == first[i].iov_len);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        pinned_check_index(mh, first, num, ptrs[i]);
+        MP_CHECK(ptrs[i][0] == (i & 0xff) && ptrs[i][PINNED_BUF_SIZE - 1] == (i & 0xff));
+    }
+    MP_CHECK(mp_region_index(mh, ptrs[n - 1], NULL) == PINNED_REGION_NUM - 1);
+
+    /* 区域外的指针 */
+    MP_CHECK(mp_region_index(mh, &local, NULL) == MP_ERR);
+    MP_CHECK(mp_region_index(mh, (unsigned char *)first[0].iov_base + first[0].iov_len, NULL) != 0);
+
+    /* 超过区域大小不退回普通分配 */
+    MP_CHECK(mp_malloc(mh, 2 * PINNED_REGION_SIZE) == NULL);
+
+    /* 全部释放后区域保留，下标不变；再次分配复用已有区域 */
+    for (i = 0; i < n; i++) {
+        mp_free(mh, ptrs[i]);
+    }
+    MP_CHECK(mp_regions(mh, iov, PINNED_REGION_NUM + 1) == PINNED_REGION_NUM);
+    for (i = 0; i < PINNED_REGION_NUM; i++) {
+        MP_CHECK(iov[i].iov_base == first[i].iov_base && iov[i].iov_len == first[i].iov_len);
+    }
+    for (i = 0; i < n; i++) {
+        ptrs[i] = mp_malloc(mh, PINNED_BUF_SIZE);
+        MP_CHECK(ptrs[i]);
+        pinned_check_index(mh, first, PINNED_REGION_NUM, ptrs[i]);
+    }
+    MP_CHECK(mp_regions(mh, NULL, 0) == PINNED_REGION_NUM);
+    for (i = 0; i < n; i++) {
+        mp_free(mh, ptrs[i]);
+    }
+    mp_destroy(mh);
+
+    /* 非锁定句柄不支持区域接口 */
+    plain = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_BUDDY);
+    MP_CHECK(plain);
+    MP_CHECK(mp_regions(plain, NULL, 0) == MP_ERR);
+    mp_destroy(plain);
+    plain = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_DEFAULT);
+    MP_CHECK(plain);
+    MP_CHECK(mp_regions(plain, NULL, 0) == MP_ERR);
+    mp_destroy(plain);
+
+    printf("test_pinned ok\n");
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * 共享方法自检（MP_METHOD_E_SHM）
+ *   1.子进程attach后通过偏移访问、释放父进程的分配，父进程能看到子进程的分配；
+ *   2.持锁进程被杀死后，其它进程仍能加锁，空闲链表按单元状态恢复。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SHM_SLOT_SIZE       64
+#define SHM_SLOT_COUNT      32
+#define SHM_KILL_ROUNDS     20
+
+struct shm_root {
+    size_t parent_off;      /* 父进程的分配，子进程释放 */
+    size_t child_off;       /* 子进程的分配，父进程读取 */
+};
+
+static int child_wait(pid_t pid)
+{
+    int status;
+
+    MP_CHECK(waitpid(pid, &status, 0) == pid);
+    return status;
+}
+
+/* 分配到耗尽，指针各不相同，返回个数 */
+static int shm_drain(struct mp_handle *mh, void **out, int max)
+{
+    int n = 0;
+    int i;
+    void *p;
+
+    while ((p = mp_malloc(mh, SHM_SLOT_SIZE)) != NULL) {
+        MP_CHECK(n < max);
+        for (i = 0; i < n; i++) {
+            MP_CHECK(out[i] != p);
+        }
+        MP_CHECK(mp_offset(mh, p) != MP_OFFSET_INVALID);
+        out[n++] = p;
+    }
+    return n;
+}
+
+static void shm_release(struct mp_handle *mh, void **ptrs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        mp_free(mh, ptrs[i]);
+    }
+}
+
+static int offset_cmp(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+/*
+ * 只少一个单元时按步长找出缺的那个并释放：被杀进程分配后没来得及释放的单元处于使用状态，
+ * 释放后恢复；如果单元是空闲状态却不在链表里（链表没有正确重建），释放会被当成重复释放拒绝
+ */
+static void shm_free_missing(struct mp_handle *mh, void **ptrs, int n)
+{
+    size_t offs[SHM_SLOT_COUNT];
+    size_t stride = 0;
+    void *p;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        offs[i] = mp_offset(mh, ptrs[i]);
+    }
+    qsort(offs, n, sizeof(offs[0]), offset_cmp);
+    for (i = 1; i < n; i++) {
+        if (!stride || offs[i] - offs[i - 1] < stride) {
+            stride = offs[i] - offs[i - 1];
+        }
+    }
+    for (i = 1; i < n; i++) {
+        if (offs[i] - offs[i - 1] != stride) {
+            mp_free(mh, mp_ptr(mh, offs[i - 1] + stride));
+            return;
+        }
+    }
+    /* 缺的在两端，不属于该单元的一端会被mp_free拒绝 */
+    p = mp_ptr(mh, offs[0] - stride);
+    if (p) {
+        mp_free(mh, p);
+    }
+    p = mp_ptr(mh, offs[n - 1] + stride);
+    if (p) {
+        mp_free(mh, p);
+    }
+}
+
+static void test_attach(void)
+{
+    static const struct mp_unit units[] = {{SHM_SLOT_SIZE, SHM_SLOT_COUNT}};
+    struct mp_handle *mh;
+    struct mp_handle *peer;
+    struct shm_root *root;
+    void *ptrs[SHM_SLOT_COUNT];
+    char *data;
+    pid_t pid;
+    int n;
+
+    mh = mp_create(units, 1, MP_METHOD_E_SHM);
+    MP_CHECK(mh);
+    MP_CHECK(mp_fd(mh) >= 0);
+    root = mp_malloc(mh, sizeof(*root));
+    data = mp_malloc(mh, SHM_SLOT_SIZE);
+    MP_CHECK(root && data);
+    strcpy(data, "from parent");
+    root->parent_off = mp_offset(mh, data);
+    root->child_off = 0;
+    MP_CHECK(mp_set_root(mh, root) == MP_OK);
+
+    pid = fork();
+    MP_CHECK(pid >= 0);
+    if (pid == 0) {
+        struct shm_root *r;
+        char *mine;
+
+        peer = mp_attach(NULL, mp_fd(mh));
+        MP_CHECK(peer);
+        r = mp_get_root(peer);
+        MP_CHECK(r && mp_offset(peer, r) == mp_offset(mh, root));
+        MP_CHECK(strcmp(mp_ptr(peer, r->parent_off), "from parent") == 0);
+        mine = mp_malloc(peer, SHM_SLOT_SIZE);
+        MP_CHECK(mine);
+        strcpy(mine, "from child");
+        r->child_off = mp_offset(peer, mine);
+        mp_free(peer, mp_ptr(peer, r->parent_off));
+        r->parent_off = 0;
+        mp_destroy(peer);
+        _exit(0);
+    }
+    MP_CHECK(child_wait(pid) == 0);
+
+    MP_CHECK(root->parent_off == 0 && root->child_off != 0);
+    MP_CHECK(strcmp(mp_ptr(mh, root->child_off), "from child") == 0);
+    /* 子进程释放了一个、分配了一个，占用个数不变 */
+    n = shm_drain(mh, ptrs, SHM_SLOT_COUNT);
+    MP_CHECK(n == SHM_SLOT_COUNT - 2);
+    shm_release(mh, ptrs, n);
+    mp_free(mh, mp_ptr(mh, root->child_off));
+    MP_CHECK(mp_set_root(mh, NULL) == MP_OK);
+    mp_free(mh, root);
+    mp_destroy(mh);
+}
+
+static void test_owner_killed(void)
+{
+    static const struct mp_unit units[] = {{SHM_SLOT_SIZE, SHM_SLOT_COUNT}};
+    struct mp_handle *mh;
+    void *ptrs[SHM_SLOT_COUNT];
+    int round;
+    int n;
+    int status;
+    pid_t pid;
+
+    mh = mp_create(units, 1, MP_METHOD_E_SHM);
+    MP_CHECK(mh);
+    for (round = 0; round < SHM_KILL_ROUNDS; round++) {
+        pid = fork();
+        MP_CHECK(pid >= 0);
+        if (pid == 0) {
+            struct mp_handle *peer = mp_attach(NULL, mp_fd(mh));
+            void *p;
+
+            MP_CHECK(peer);
+            /* 大部分时间持有单元锁，被杀时大概率处在链表更新中途 */
+            for (;;) {
+                p = mp_malloc(peer, SHM_SLOT_SIZE);
+                if (p) {
+                    mp_free(peer, p);
+                }
+            }
+        }
+        usleep(1000 + (round % 5) * 700);
+        MP_CHECK(kill(pid, SIGKILL) == 0);
+        status = child_wait(pid);
+        MP_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+        /* 加锁不能卡死；子进程最多在释放前丢下一个单元，归还后所有单元都能再分配出来 */
+        alarm(30);
+        n = shm_drain(mh, ptrs, SHM_SLOT_COUNT);
+        MP_CHECK(n == SHM_SLOT_COUNT || n == SHM_SLOT_COUNT - 1);
+        if (n != SHM_SLOT_COUNT) {
+            shm_free_missing(mh, ptrs, n);
+        }
+        shm_release(mh, ptrs, n);
+        n = shm_drain(mh, ptrs, SHM_SLOT_COUNT);
+        MP_CHECK(n == SHM_SLOT_COUNT);
+        shm_release(mh, ptrs, n);
+        alarm(0);
+    }
+    mp_destroy(mh);
+}
+
+int main(void)
+{
+    test_attach();
+    test_owner_killed();
+    printf("test_shm ok\n");
+    return 0;
+}
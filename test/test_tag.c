@@ -0,0 +1,207 @@
+/*
+ * 标签统计自检（MP_METHOD_E_DEFAULT）
+ *   按标签分配后使用字节数等于各分配的实际可用大小之和，个数随分配释放增减，全部释放后归零；
+ *   子内存池不足和退回glibc的分配同样计入；realloc保持原标签并按新大小记账；
+ *   多线程并发分配释放后统计归零；非法标签和不支持的方法返回错误。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#define TAG_SMALL_SIZE      40
+#define TAG_MID_SIZE        200
+#define TAG_LARGE_SIZE      10000       /* 超过最大分配单元，退回glibc */
+#define TAG_ALLOC_NUM       300         /* 超过子内存池的初始容量 */
+#define TAG_THREAD_NUM      4
+#define TAG_THREAD_LOOPS    20000
+
+static const struct mp_unit g_units[] = {{64, 128}, {256, 64}};
+
+struct tag_expect {
+    size_t used;
+    size_t count;
+};
+
+static void tag_check(struct mp_handle *mh, int tag, const struct tag_expect *e)
+{
+    struct mp_tag_stats st;
+
+    MP_CHECK(mp_tag_stats(mh, tag, &st) == MP_OK);
+    MP_CHECK(st.used == e->used && st.count == e->count);
+}
+
+static void *tag_alloc(struct mp_handle *mh, int tag, size_t size, struct tag_expect *e)
+{
+    void *p;
+
+    p = mp_malloc_tagged(mh, tag, size);
+    MP_CHECK(p && mp_malloc_usable_size(mh, p) >= size);
+    memset(p, tag, size);
+    e->used += mp_malloc_usable_size(mh, p);
+    e->count++;
+    return p;
+}
+
+static void tag_free(struct mp_handle *mh, void *p, struct tag_expect *e)
+{
+    e->used -= mp_malloc_usable_size(mh, p);
+    e->count--;
+    mp_free(mh, p);
+}
+
+static void *tag_realloc(struct mp_handle *mh, void *p, size_t size, struct tag_expect *e)
+{
+    void *q;
+
+    e->used -= mp_malloc_usable_size(mh, p);
+    q = mp_realloc(mh, p, size);
+    MP_CHECK(q && mp_malloc_usable_size(mh, q) >= size);
+    e->used += mp_malloc_usable_size(mh, q);
+    return q;
+}
+
+static void test_account(struct mp_handle *mh)
+{
+    static void *ones[TAG_ALLOC_NUM];
+    static void *twos[TAG_ALLOC_NUM];
+    struct tag_expect zero = {0, 0};
+    struct tag_expect e1 = {0, 0};
+    struct tag_expect e2 = {0, 0};
+    unsigned char *p;
+    void *plain;
+    int i;
+
+    for (i = 1; i < MP_TAG_MAX; i++) {
+        tag_check(mh, i, &zero);
+    }
+
+    for (i = 0; i < TAG_ALLOC_NUM; i++) {
+        ones[i] = tag_alloc(mh, 1, TAG_SMALL_SIZE, &e1);
+        twos[i] = tag_alloc(mh, 2, (i % 3) ? TAG_MID_SIZE : TAG_LARGE_SIZE, &e2);
+    }
+    tag_check(mh, 1, &e1);
+    tag_check(mh, 2, &e2);
+    MP_CHECK(e1.count == TAG_ALLOC_NUM && e2.count == TAG_ALLOC_NUM);
+
+    /* 未打标签的分配不计入任何标签 */
+    plain = mp_malloc(mh, TAG_SMALL_SIZE);
+    MP_CHECK(plain);
+    p = mp_malloc_tagged(mh, 0, TAG_SMALL_SIZE);
+    MP_CHECK(p);
+    tag_check(mh, 1, &e1);
+    tag_check(mh, 2, &e2);
+    tag_check(mh, 3, &zero);
+    mp_free(mh, plain);
+    mp_free(mh, p);
+
+    /* realloc：单元内不变，跨单元、进出glibc都保持标签和数据 */
+    ones[0] = tag_realloc(mh, ones[0], TAG_SMALL_SIZE + 8, &e1);
+    ones[1] = tag_realloc(mh, ones[1], TAG_MID_SIZE, &e1);
+    ones[2] = tag_realloc(mh, ones[2], TAG_LARGE_SIZE, &e1);
+    ones[2] = tag_realloc(mh, ones[2], TAG_LARGE_SIZE * 2, &e1);
+    twos[0] = tag_realloc(mh, twos[0], TAG_LARGE_SIZE * 3, &e2);
+    tag_check(mh, 1, &e1);
+    tag_check(mh, 2, &e2);
+    for (i = 0; i < 3; i++) {
+        p = ones[i];
+        MP_CHECK(p[0] == 1 && p[TAG_SMALL_SIZE - 1] == 1);
+    }
+    p = twos[0];
+    MP_CHECK(p[0] == 2 && p[TAG_LARGE_SIZE - 1] == 2);
+
+    /* 释放后和新分配交替，统计保持一致 */
+    for (i = 0; i < TAG_ALLOC_NUM; i += 2) {
+        tag_free(mh, ones[i], &e1);
+        tag_free(mh, twos[i], &e2);
+    }
+    tag_check(mh, 1, &e1);
+    tag_check(mh, 2, &e2);
+    for (i = 0; i < TAG_ALLOC_NUM; i += 2) {
+        ones[i] = tag_alloc(mh, 1, TAG_MID_SIZE, &e1);
+        twos[i] = tag_alloc(mh, 2, TAG_SMALL_SIZE, &e2);
+    }
+    tag_check(mh, 1, &e1);
+    tag_check(mh, 2, &e2);
+
+    for (i = 0; i < TAG_ALLOC_NUM; i++) {
+        tag_free(mh, ones[i], &e1);
+        tag_free(mh, twos[i], &e2);
+    }
+    MP_CHECK(e1.used == 0 && e1.count == 0 && e2.used == 0 && e2.count == 0);
+    tag_check(mh, 1, &zero);
+    tag_check(mh, 2, &zero);
+}
+
+static void *tag_worker(void *arg)
+{
+    struct mp_handle *mh = (struct mp_handle *)arg;
+    void *ptrs[16];
+    int tag;
+    int i;
+    int j;
+
+    for (i = 0; i < TAG_THREAD_LOOPS; i++) {
+        j = i % 16;
+        tag = 1 + (i % (MP_TAG_MAX - 1));
+        if (i >= 16) {
+            mp_free(mh, ptrs[j]);
+        }
+        ptrs[j] = mp_malloc_tagged(mh, tag, (i % 5) ? TAG_SMALL_SIZE : TAG_MID_SIZE);
+        MP_CHECK(ptrs[j]);
+        if (i % 7 == 0) {
+            ptrs[j] = mp_realloc(mh, ptrs[j], TAG_MID_SIZE);
+            MP_CHECK(ptrs[j]);
+        }
+    }
+    for (j = 0; j < 16; j++) {
+        mp_free(mh, ptrs[j]);
+    }
+    return NULL;
+}
+
+static void test_threads(struct mp_handle *mh)
+{
+    static const struct tag_expect zero = {0, 0};
+    pthread_t tids[TAG_THREAD_NUM];
+    int i;
+
+    for (i = 0; i < TAG_THREAD_NUM; i++) {
+        MP_CHECK(pthread_create(&tids[i], NULL, tag_worker, mh) == 0);
+    }
+    for (i = 0; i < TAG_THREAD_NUM; i++) {
+        MP_CHECK(pthread_join(tids[i], NULL) == 0);
+    }
+    for (i = 1; i < MP_TAG_MAX; i++) {
+        tag_check(mh, i, &zero);
+    }
+}
+
+int main(void)
+{
+    struct mp_tag_stats st;
+    struct mp_handle *mh;
+
+    mh = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_DEFAULT);
+    MP_CHECK(mh);
+    test_account(mh);
+    test_threads(mh);
+
+    /* 非法标签 */
+    MP_CHECK(mp_malloc_tagged(mh, -1, TAG_SMALL_SIZE) == NULL);
+    MP_CHECK(mp_malloc_tagged(mh, MP_TAG_MAX, TAG_SMALL_SIZE) == NULL);
+    MP_CHECK(mp_tag_stats(mh, 0, &st) == MP_ERR);
+    MP_CHECK(mp_tag_stats(mh, MP_TAG_MAX, &st) == MP_ERR);
+    mp_destroy(mh);
+
+    /* 不支持标签的方法 */
+    mh = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_TLSF);
+    MP_CHECK(mh);
+    MP_CHECK(mp_malloc_tagged(mh, 1, TAG_SMALL_SIZE) == NULL);
+    MP_CHECK(mp_tag_stats(mh, 1, &st) == MP_ERR);
+    mp_destroy(mh);
+
+    printf("test_tag ok\n");
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * 线程缓存自检（MP_METHOD_E_DEFAULT + MP_ATTR_F_THREAD_CACHE）
+ *   预算限制为创建时的固定内存池，不能新建内存池和退回glibc，能分配出的单元个数固定；
+ *   线程释放后退出，缓存的单元归还内存池，之后的线程仍能分配出全部单元，句柄正常销毁。
+ *   存活线程的缓存不会归还，所以每次计数都在一个新线程里完成，主线程不直接分配。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#define TCACHE_SLOT_SIZE    64
+#define TCACHE_SLOT_COUNT   2048
+#define TCACHE_THREAD_NUM   4
+#define TCACHE_ROUNDS       3
+
+static const struct mp_unit g_units[] = {{TCACHE_SLOT_SIZE, TCACHE_SLOT_COUNT}};
+
+struct tcache_arg {
+    struct mp_handle    *mh;
+    void                **ptrs;
+    int                 max;
+    int                 n;
+};
+
+/* 分配到返回NULL，返回个数 */
+static int tcache_drain(struct mp_handle *mh, void **ptrs, int max)
+{
+    int n = 0;
+    void *p;
+
+    while ((p = mp_malloc(mh, TCACHE_SLOT_SIZE)) != NULL) {
+        MP_CHECK(n < max);
+        memset(p, 0xa5, TCACHE_SLOT_SIZE);
+        ptrs[n++] = p;
+    }
+    return n;
+}
+
+static void tcache_release(struct mp_handle *mh, void **ptrs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        mp_free(mh, ptrs[i]);
+    }
+}
+
+/* 全部分配出来再释放，单元留在本线程缓存里退出 */
+static void *tcache_worker(void *arg)
+{
+    struct tcache_arg *ta = (struct tcache_arg *)arg;
+
+    ta->n = tcache_drain(ta->mh, ta->ptrs, ta->max);
+    tcache_release(ta->mh, ta->ptrs, ta->n);
+    return NULL;
+}
+
+/* 每个线程只分配一部分，由另一组线程释放 */
+static void *tcache_mixed(void *arg)
+{
+    struct tcache_arg *ta = (struct tcache_arg *)arg;
+    int i;
+
+    for (i = 0; i < ta->max; i++) {
+        ta->ptrs[i] = mp_malloc(ta->mh, TCACHE_SLOT_SIZE);
+        MP_CHECK(ta->ptrs[i]);
+    }
+    ta->n = ta->max;
+    return NULL;
+}
+
+static void *tcache_mixed_free(void *arg)
+{
+    struct tcache_arg *ta = (struct tcache_arg *)arg;
+
+    tcache_release(ta->mh, ta->ptrs, ta->n);
+    return NULL;
+}
+
+static void tcache_run(void *(*fn)(void *), struct tcache_arg *args, int num)
+{
+    pthread_t tids[TCACHE_THREAD_NUM];
+    int i;
+
+    for (i = 0; i < num; i++) {
+        MP_CHECK(pthread_create(&tids[i], NULL, fn, &args[i]) == 0);
+    }
+    for (i = 0; i < num; i++) {
+        MP_CHECK(pthread_join(tids[i], NULL) == 0);
+    }
+}
+
+/* 新线程里取尽全部单元再释放后退出，返回个数 */
+static int tcache_count(struct mp_handle *mh, void **ptrs, int max)
+{
+    struct tcache_arg arg;
+
+    arg.mh = mh;
+    arg.ptrs = ptrs;
+    arg.max = max;
+    arg.n = 0;
+    tcache_run(tcache_worker, &arg, 1);
+    return arg.n;
+}
+
+int main(void)
+{
+    static void *ptrs[TCACHE_THREAD_NUM][TCACHE_SLOT_COUNT * 2];
+    struct tcache_arg args[TCACHE_THREAD_NUM];
+    struct mp_attr attr = {0};
+    struct mp_handle *mh;
+    size_t used;
+    int total;
+    int round;
+    int i;
+
+#if MP_HARDEN_LEVEL >= 2
+    /* 调试加固级别下线程缓存不生效，释放的单元先进入隔离区，可分配个数不固定 */
+    printf("test_tcache skipped: MP_HARDEN_LEVEL %d\n", MP_HARDEN_LEVEL);
+    return MP_TEST_SKIP;
+#endif
+    attr.flags = MP_ATTR_F_THREAD_CACHE;
+    mh = mp_create_attr(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_DEFAULT, &attr);
+    MP_CHECK(mh);
+    MP_CHECK(mp_get_budget(mh, NULL, &used) == MP_OK && used > 0);
+    MP_CHECK(mp_set_budget(mh, used) == MP_OK);
+
+    total = tcache_count(mh, ptrs[0], TCACHE_SLOT_COUNT * 2);
+    MP_CHECK(total >= TCACHE_SLOT_COUNT);
+
+    for (round = 0; round < TCACHE_ROUNDS; round++) {
+        /* 上一个线程退出时缓存已归还 */
+        MP_CHECK(tcache_count(mh, ptrs[0], TCACHE_SLOT_COUNT * 2) == total);
+
+        /* 一组线程分配，另一组线程释放，单元散落在各线程缓存中 */
+        for (i = 0; i < TCACHE_THREAD_NUM; i++) {
+            args[i].mh = mh;
+            args[i].ptrs = ptrs[i];
+            args[i].max = total / TCACHE_THREAD_NUM;
+            args[i].n = 0;
+        }
+        tcache_run(tcache_mixed, args, TCACHE_THREAD_NUM);
+        tcache_run(tcache_mixed_free, args, TCACHE_THREAD_NUM);
+        MP_CHECK(tcache_count(mh, ptrs[0], TCACHE_SLOT_COUNT * 2) == total);
+    }
+    mp_destroy(mh);
+
+    printf("test_tcache ok\n");
+    return 0;
+}
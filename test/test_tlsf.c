@@ -0,0 +1,164 @@
+/*
+ * 两级分离适配方法自检（MP_METHOD_E_TLSF）
+ *   区域填满后数据不互相覆盖，耗尽时返回NULL而不退回glibc；
+ *   按不同顺序全部释放后相邻空闲块完全合并，最大的块可以再次分配；
+ *   realloc在后一块空闲时原地扩展、缩小时原地裁剪，否则搬移并保留数据。
+ */
+#include "mpmalloc.h"
+#include "mp_test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define TLSF_ALLOC_MAX      8192
+
+static const struct mp_unit g_units[] = {{64, 256}};
+
+static size_t tlsf_size(int i)
+{
+    return 1 + (size_t)(i * 97) % 700;
+}
+
+/* 空区域里能分配的最大块 */
+static size_t tlsf_max_block(struct mp_handle *mh)
+{
+    size_t lo = 1;
+    size_t hi = 64 * 1024 * 1024;
+    size_t mid;
+    void *p;
+
+    while (lo + 1 < hi) {
+        mid = lo + (hi - lo) / 2;
+        p = mp_malloc(mh, mid);
+        if (p) {
+            mp_free(mh, p);
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void tlsf_check_max(struct mp_handle *mh, size_t max)
+{
+    void *p;
+
+    p = mp_malloc(mh, max);
+    MP_CHECK(p && mp_malloc_usable_size(mh, p) >= max);
+    mp_free(mh, p);
+}
+
+/* 填满区域，返回分配个数 */
+static int tlsf_fill(struct mp_handle *mh, unsigned char **ptrs)
+{
+    int n;
+    int i;
+
+    for (n = 0; n < TLSF_ALLOC_MAX; n++) {
+        ptrs[n] = mp_malloc(mh, tlsf_size(n));
+        if (!ptrs[n]) {
+            break;
+        }
+        MP_CHECK(((uintptr_t)ptrs[n] % MP_MALLOC_MIN_ALIGN) == 0);
+        MP_CHECK(mp_malloc_usable_size(mh, ptrs[n]) >= tlsf_size(n));
+        memset(ptrs[n], n & 0xff, tlsf_size(n));
+    }
+    MP_CHECK(n > 0 && n < TLSF_ALLOC_MAX);
+    for (i = 0; i < n; i++) {
+        MP_CHECK(ptrs[i][0] == (i & 0xff) && ptrs[i][tlsf_size(i) - 1] == (i & 0xff));
+    }
+    return n;
+}
+
+static void test_split_merge(struct mp_handle *mh, size_t max)
+{
+    static unsigned char *ptrs[TLSF_ALLOC_MAX];
+    int n;
+    int i;
+
+    /* 先奇后偶：偶数块释放时前后都已空闲，同时向两侧合并 */
+    n = tlsf_fill(mh, ptrs);
+    MP_CHECK(mp_malloc(mh, max) == NULL);
+    for (i = 1; i < n; i += 2) {
+        mp_free(mh, ptrs[i]);
+    }
+    for (i = 0; i < n; i += 2) {
+        mp_free(mh, ptrs[i]);
+    }
+    tlsf_check_max(mh, max);
+
+    /* 逆序释放：每次只和后一块合并 */
+    n = tlsf_fill(mh, ptrs);
+    for (i = n - 1; i >= 0; i--) {
+        mp_free(mh, ptrs[i]);
+    }
+    tlsf_check_max(mh, max);
+
+    /* 顺序释放：每次只和前一块合并 */
+    n = tlsf_fill(mh, ptrs);
+    for (i = 0; i < n; i++) {
+        mp_free(mh, ptrs[i]);
+    }
+    tlsf_check_max(mh, max);
+}
+
+static void test_realloc(struct mp_handle *mh, size_t max)
+{
+    unsigned char *p;
+    unsigned char *q;
+    unsigned char *r;
+    size_t i;
+
+    p = mp_malloc(mh, 100);
+    MP_CHECK(p);
+    memset(p, 0x11, 100);
+
+    /* 后一块空闲，原地扩展 */
+    q = mp_realloc(mh, p, 4000);
+    MP_CHECK(q == p && mp_malloc_usable_size(mh, q) >= 4000);
+    memset(q + 100, 0x22, 3900);
+
+    /* 后面被占用，搬移并保留数据 */
+    r = mp_malloc(mh, 64);
+    MP_CHECK(r);
+    q = mp_realloc(mh, p, 8000);
+    MP_CHECK(q && q != p);
+    for (i = 0; i < 100; i++) {
+        MP_CHECK(q[i] == 0x11);
+    }
+    for (i = 100; i < 4000; i++) {
+        MP_CHECK(q[i] == 0x22);
+    }
+
+    /* 缩小原地裁剪，裁下的部分可以再分配 */
+    p = mp_realloc(mh, q, 50);
+    MP_CHECK(p == q && p[0] == 0x11 && p[49] == 0x11);
+    MP_CHECK(mp_malloc_usable_size(mh, p) < 8000);
+
+    /* 超过区域的请求失败，原块不受影响 */
+    MP_CHECK(mp_realloc(mh, p, 2 * max) == NULL);
+    MP_CHECK(p[0] == 0x11);
+
+    mp_free(mh, p);
+    mp_free(mh, r);
+    tlsf_check_max(mh, max);
+}
+
+int main(void)
+{
+    struct mp_handle *mh;
+    size_t max;
+
+    mh = mp_create(g_units, MP_TEST_ARRAY_SIZE(g_units), MP_METHOD_E_TLSF);
+    MP_CHECK(mh);
+    max = tlsf_max_block(mh);
+    MP_CHECK(max >= 512 * 1024);
+
+    test_split_merge(mh, max);
+    test_realloc(mh, max);
+    mp_destroy(mh);
+
+    printf("test_tlsf ok\n");
+    return 0;
+}